@@ -114,6 +114,17 @@ public:
   /// \brief Retrieve the current position in the stream, in bits.
   uint64_t GetCurrentBitNo() const { return GetBufferOffset() * 8 + CurBit; }
 
+  /// BackpatchField - Overwrite a 32-bit field that was written at bit BitNo,
+  /// which need not be word aligned, but must have been flushed to the buffer.
+  void BackpatchField(uint64_t BitNo, uint32_t NewValue) {
+    assert(BitNo + 32 <= GetBufferOffset() * 8 && "Field not written yet");
+    for (unsigned i = 0; i != 32; ++i, ++BitNo) {
+      char &Byte = Out[BitNo / 8];
+      char Mask = char(1 << (BitNo % 8));
+      Byte = (NewValue >> i) & 1 ? (Byte | Mask) : (Byte & ~Mask);
+    }
+  }
+
   //===--------------------------------------------------------------------===//
   // Basic Primitives for emitting bits to the stream.
   //===--------------------------------------------------------------------===//
@@ -265,6 +276,20 @@ public:
     BlockScope.pop_back();
   }
 
+  /// EmitSubblock - Emit a whole block whose body was encoded by another
+  /// BitstreamWriter.  Body is everything after the block's size word, through
+  /// END_BLOCK and the padding to a word boundary; any abbrevs it uses must be
+  /// defined the same way in this stream.
+  void EmitSubblock(unsigned BlockID, unsigned CodeLen, StringRef Body) {
+    assert((Body.size() & 3) == 0 && "Block body not 32-bit aligned");
+    EmitCode(bitc::ENTER_SUBBLOCK);
+    EmitVBR(BlockID, bitc::BlockIDWidth);
+    EmitVBR(CodeLen, bitc::CodeLenWidth);
+    FlushToWord();
+    Emit(static_cast<uint32_t>(Body.size() / 4), bitc::BlockSizeWidth);
+    Out.append(Body.begin(), Body.end());
+  }
+
   //===--------------------------------------------------------------------===//
   // Record Emission
   //===--------------------------------------------------------------------===//
@@ -43,7 +43,12 @@ namespace bitc {
     
     TYPE_BLOCK_ID_NEW,
 
-    USELIST_BLOCK_ID
+    USELIST_BLOCK_ID,
+
+    // Block ids from 1000 on are local extensions, not part of the LLVM
+    // format.  They are kept well clear of the ids upstream adds next, and
+    // readers that don't know them skip the blocks.
+    FUNCTION_INDEX_BLOCK_ID  = 1000
   };
 
 
@@ -70,7 +75,14 @@ namespace bitc {
     /// MODULE_CODE_PURGEVALS: [numvals]
     MODULE_CODE_PURGEVALS   = 10,
 
-    MODULE_CODE_GCNAME      = 11   // GCNAME: [strchr x N]
+    MODULE_CODE_GCNAME      = 11,  // GCNAME: [strchr x N]
+
+    // Codes from 1000 on are local extensions, like the block ids above.
+    // Readers that don't know them ignore the records.
+
+    /// FNINDEX: [offset], the 32-bit word offset of the module's
+    /// FUNCTION_INDEX_BLOCK from the start of the bitcode.
+    MODULE_CODE_FNINDEX     = 1000
   };
 
   /// PARAMATTR blocks have code for defining a parameter attribute set.
@@ -320,6 +332,12 @@ namespace bitc {
   enum UseListCodes {
     USELIST_CODE_ENTRY = 1   // USELIST_CODE_ENTRY: TBD.
   };
+
+  /// The function index block lists where the body of each function starts,
+  /// so that a reader can go straight to it.
+  enum FunctionIndexCodes {
+    FNINDEX_CODE_ENTRY = 1   // ENTRY: [valueid, bit offset of FUNCTION_BLOCK]
+  };
 } // End bitc namespace
 } // End llvm namespace
 
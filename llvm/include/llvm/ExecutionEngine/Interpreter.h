@@ -7,8 +7,8 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file forces the interpreter to link in on certain operating systems.
-// (Windows).
+// This file forces the interpreter to link in on certain operating systems
+// (Windows), and declares the interface for running hot functions natively.
 //
 //===----------------------------------------------------------------------===//
 
@@ -16,10 +16,56 @@
 #define EXECUTION_ENGINE_INTERPRETER_H
 
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Support/Atomic.h"
 #include <cstdlib>
+#include <utility>
+#include <vector>
 
 extern "C" void LLVMLinkInInterpreter();
 
+namespace llvm {
+
+class Function;
+
+/// InterpreterTierUp - Supplies native code for the functions an interpreter
+/// finds hot, for example by compiling them on another thread.  The
+/// interpreter only calls it from the thread the program runs on.
+class InterpreterTierUp {
+protected:
+  /// NumCompiled - Incremented whenever takeCompiled has more to return.  The
+  /// interpreter reads it before each call it makes.
+  volatile sys::cas_flag NumCompiled;
+
+public:
+  /// NativeEntry - How the interpreter calls native code.  Args holds a
+  /// pointer to each argument stored in memory as the target lays it out, and
+  /// the result, if any, is stored to Result in the same way.
+  typedef void (*NativeEntry)(void **Args, void *Result);
+
+  InterpreterTierUp() : NumCompiled(0) {}
+  virtual ~InterpreterTierUp();
+
+  sys::cas_flag getNumCompiled() const { return NumCompiled; }
+
+  /// functionIsHot - F has been called, or has gone around its loops, as many
+  /// times as the threshold.  The interpreter stops counting for F.
+  virtual void functionIsHot(Function *F) = 0;
+
+  /// takeCompiled - Append the functions whose native code became available
+  /// since the last call to Compiled.
+  virtual void
+  takeCompiled(std::vector<std::pair<Function*, NativeEntry> > &Compiled) = 0;
+};
+
+/// setInterpreterTierUp - Count the calls and loop back-edges of each function
+/// that EE, which must be an interpreter, runs, and hand TierUp the functions
+/// that reach Threshold.  Calls to a function with native code run that code
+/// from then on.  EE takes ownership of TierUp.
+void setInterpreterTierUp(ExecutionEngine *EE, InterpreterTierUp *TierUp,
+                          unsigned Threshold);
+
+} // End llvm namespace
+
 namespace {
   struct ForceInterpreterLinking {
     ForceInterpreterLinking() {
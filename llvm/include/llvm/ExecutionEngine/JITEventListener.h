@@ -59,6 +59,13 @@ public:
   JITEventListener() {}
   virtual ~JITEventListener();
 
+  /// NotifyFunctionMaterialized - Called before the JIT generates code for a
+  /// function whose body is available.  Unlike the other notifications, the
+  /// listener may change the IR of the function's module here, for example
+  /// to instrument it; functions that were already emitted are not revisited
+  /// unless the listener recompiles them.
+  virtual void NotifyFunctionMaterialized(Function &) {}
+
   /// NotifyFunctionEmitted - Called after a function has been successfully
   /// emitted to memory.  The function still has its MachineFunction attached,
   /// if you should happen to need that.
@@ -295,12 +295,10 @@ public:
   void copyAttributesFrom(const GlobalValue *Src);
 
   /// deleteBody - This method deletes the body of the function, and converts
-  /// the linkage to external.
+  /// the linkage to external.  A body that has not been materialized yet is
+  /// discarded without reading it.
   ///
-  void deleteBody() {
-    dropAllReferences();
-    setLinkage(ExternalLinkage);
-  }
+  void deleteBody();
 
   /// removeFromParent - This method unlinks 'this' from the containing module,
   /// but does not delete it.
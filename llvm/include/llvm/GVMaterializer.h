@@ -54,6 +54,11 @@ public:
   ///
   virtual void Dematerialize(GlobalValue *) {}
 
+  /// Discard - The given GlobalValue has not been materialized and never will
+  /// be, because its definition is being deleted.  Forget how to read it, so
+  /// that it isn't read by MaterializeModule.
+  virtual void Discard(GlobalValue *) {}
+
   /// MaterializeModule - make sure the entire Module has been completely read.
   /// On error, this returns true and fills in the optional string with
   /// information about the problem.  If successful, this returns false.
@@ -458,6 +458,9 @@ public:
   /// supports it, release the memory for the function, and set it up to be
   /// materialized lazily.  If !isDematerializable(), this method is a noop.
   void Dematerialize(GlobalValue *GV);
+  /// Discard - Tell the GVMaterializer that the GlobalValue, which is not read
+  /// in, is being deleted and must not be read by MaterializeAll.
+  void Discard(GlobalValue *GV);
 
   /// MaterializeAll - Make sure all GlobalValues in this Module are fully read.
   /// If the module is corrupt, this returns true and fills in the optional
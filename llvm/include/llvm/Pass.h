@@ -230,6 +230,11 @@ public:
   /// being operated on.
   virtual bool runOnModule(Module &M) = 0;
 
+  /// materializesFunctions - Return true if the pass reads the bodies it needs
+  /// from a lazily loaded module itself.  Before running any other module pass
+  /// on such a module, the pass manager reads all of them.
+  virtual bool materializesFunctions() const { return false; }
+
   virtual void assignPassManager(PMStack &PMS,
                                  PassManagerType T);
 
@@ -91,6 +91,7 @@
 #include "llvm/Support/PrettyStackTrace.h"
 
 namespace llvm {
+  class Function;
   class Module;
   class Pass;
   class StringRef;
@@ -427,6 +428,9 @@ public:
   ///
   bool doFinalization(Module &M);
 
+  /// Bodies are read one function at a time, see runOnFunction.
+  virtual bool materializesFunctions() const { return true; }
+
   virtual PMDataManager *getAsPMDataManager() { return this; }
   virtual Pass *getAsPass() { return this; }
 
@@ -455,6 +459,24 @@ public:
 
 Timer *getPassTimer(Pass *);
 
+/// PassTraceRegion - Record the run of a pass over a function, or over a
+/// module, with its elapsed time, the change in the number of instructions and
+/// the growth of the heap, when -time-passes-trace is given.
+class PassTraceRegion {
+  Pass *P;
+  const Function *F;
+  const Module *M;
+  unsigned Instructions;
+  double WallTime;
+  int64_t MemUsed;
+
+  void start();
+public:
+  PassTraceRegion(Pass *p, const Function &f) : P(p), F(&f), M(0) { start(); }
+  PassTraceRegion(Pass *p, const Module &m) : P(p), F(0), M(&m) { start(); }
+  ~PassTraceRegion();
+};
+
 }
 
 #endif
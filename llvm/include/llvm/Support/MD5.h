@@ -0,0 +1,53 @@
+//===- llvm/Support/MD5.h - MD5 message digest ------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the MD5 class, which computes the RFC 1321 message digest
+// of a stream of bytes.  It is meant for naming things after their contents,
+// such as cache entries, where the name must not change between runs, hosts or
+// versions of LLVM, as hash_value may; it is not for security.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_SUPPORT_MD5_H
+#define LLVM_SUPPORT_MD5_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+
+namespace llvm {
+
+class MD5 {
+  uint32_t A, B, C, D;
+  uint64_t Length;
+  uint8_t Buffer[64];
+
+  void processBlock(const uint8_t *Block);
+
+public:
+  typedef uint8_t MD5Result[16];
+
+  MD5();
+
+  /// update - Add Data to the bytes digested.
+  void update(ArrayRef<uint8_t> Data);
+  void update(StringRef Str);
+
+  /// final - Finish the digest and store it in Result.  The object can't be
+  /// updated afterwards.
+  void final(MD5Result &Result);
+
+  /// stringifyResult - Write Result to Str as 32 lowercase hex digits.
+  static void stringifyResult(const MD5Result &Result, SmallString<32> &Str);
+};
+
+} // End llvm namespace
+
+#endif
@@ -0,0 +1,38 @@
+//===-- CanTM.h - CanTM transactional memory instrumentation ----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This header file defines the accessor for the CanTM pass, for tools that
+// link lib/Transforms/CanTM in instead of loading it as a plugin.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_CANTM_H
+#define LLVM_TRANSFORMS_CANTM_H
+
+namespace llvm {
+class Function;
+class ModulePass;
+
+//===----------------------------------------------------------------------===//
+//
+// createCanTMPass - Instrument the transactions of a module with reservations
+// for the CanTM runtime.
+//
+ModulePass *createCanTMPass();
+
+//===----------------------------------------------------------------------===//
+//
+// isCanTMTransaction - Whether the pass treats F as a transaction: until the
+// front end marks them, those are the *foo*() and *tx*() functions.
+//
+bool isCanTMTransaction(const Function *F);
+
+} // End llvm namespace
+
+#endif
@@ -80,7 +80,12 @@ public:
     /// EP_EnabledOnOptLevel0 - This extension point allows adding passes that
     /// should not be disabled by O0 optimization level. The passes will be
     /// inserted after the inlining pass.
-    EP_EnabledOnOptLevel0
+    EP_EnabledOnOptLevel0,
+
+    /// EP_LinkTimeOptimizerLast - This extension point allows adding passes
+    /// that run on the whole program at the end of the link-time pipeline
+    /// built by populateLTOPassManager.
+    EP_LinkTimeOptimizerLast
   };
 
   /// The Optimization Level - Specify the basic optimization level.
@@ -1318,7 +1318,20 @@ bool BitcodeReader::ParseConstants() {
       Function *Fn =
         dyn_cast_or_null<Function>(ValueList.getConstantFwdRef(Record[1],FnTy));
       if (Fn == 0) return Error("Invalid CE_BLOCKADDRESS record");
-      
+
+      // A lazily read function may be dropped and read again after its target
+      // has been read, so refer to the block directly when it already exists.
+      if (!Fn->empty()) {
+        Function::iterator BBI = Fn->begin(), BBE = Fn->end();
+        for (uint64_t I = 0, E = Record[2]; I != E; ++I) {
+          if (BBI == BBE) return Error("Invalid CE_BLOCKADDRESS record");
+          ++BBI;
+        }
+        if (BBI == BBE) return Error("Invalid CE_BLOCKADDRESS record");
+        V = BlockAddress::get(Fn, BBI);
+        break;
+      }
+
       GlobalVariable *FwdRef = new GlobalVariable(*Fn->getParent(),
                                                   Type::getInt8Ty(Context),
                                             false, GlobalValue::InternalLinkage,
@@ -1410,6 +1423,78 @@ bool BitcodeReader::RememberAndSkipFunctionBody() {
   return false;
 }
 
+/// ParseFunctionIndex - Having reached the first function block, read where
+/// all of the function blocks are from the FUNCTION_INDEX_BLOCK instead of
+/// skipping over each of them.  This leaves the stream after the index, which
+/// follows the last function block.
+bool BitcodeReader::ParseFunctionIndex() {
+  // The index gives the bit at which each ENTER_SUBBLOCK starts, but bodies
+  // are remembered from just after the block ID, as RememberAndSkipFunctionBody
+  // does.  FUNCTION_BLOCK_ID fits in a single VBR chunk.
+  uint64_t BodyOffset = Stream.getAbbrevIDWidth() + bitc::BlockIDWidth;
+
+  if (!Stream.canSkipToPos(FunctionIndexBit / 8))
+    return Error("Malformed function index");
+  Stream.JumpToBit(FunctionIndexBit);
+  if (Stream.ReadCode() != bitc::ENTER_SUBBLOCK ||
+      Stream.ReadSubBlockID() != bitc::FUNCTION_INDEX_BLOCK_ID ||
+      Stream.EnterSubBlock(bitc::FUNCTION_INDEX_BLOCK_ID))
+    return Error("Malformed function index");
+
+  SmallVector<uint64_t, 2> Record;
+  while (true) {
+    if (Stream.AtEndOfStream())
+      return Error("Premature end of bitstream");
+
+    unsigned Code = Stream.ReadCode();
+    if (Code == bitc::END_BLOCK) {
+      if (Stream.ReadBlockEnd())
+        return Error("Error at end of function index block");
+      break;
+    }
+
+    if (Code == bitc::ENTER_SUBBLOCK) {
+      // No known subblocks, always skip them.
+      Stream.ReadSubBlockID();
+      if (Stream.SkipBlock())
+        return Error("Malformed block record");
+      continue;
+    }
+
+    if (Code == bitc::DEFINE_ABBREV) {
+      Stream.ReadAbbrevRecord();
+      continue;
+    }
+
+    // Read a record.
+    Record.clear();
+    switch (Stream.ReadRecord(Code, Record)) {
+    default: break;  // Default behavior, ignore unknown content.
+    case bitc::FNINDEX_CODE_ENTRY: { // ENTRY: [valueid, offset]
+      if (Record.size() < 2)
+        return Error("Invalid FNINDEX_CODE_ENTRY record");
+      Function *F = 0;
+      if (Record[0] < ValueList.size())
+        F = dyn_cast_or_null<Function>(ValueList[Record[0]]);
+      if (!F || !Stream.canSkipToPos(Record[1] / 8))
+        return Error("Invalid FNINDEX_CODE_ENTRY record");
+      DeferredFunctionInfo[F] = Record[1] + BodyOffset;
+      break;
+    }
+    }
+  }
+
+  // Every function with a body must be in the index.
+  for (unsigned i = 0, e = FunctionsWithBodies.size(); i != e; ++i) {
+    DenseMap<Function*, uint64_t>::iterator I =
+      DeferredFunctionInfo.find(FunctionsWithBodies[i]);
+    if (I == DeferredFunctionInfo.end() || I->second == 0)
+      return Error("Malformed function index");
+  }
+  std::vector<Function*>().swap(FunctionsWithBodies);
+  return false;
+}
+
 bool BitcodeReader::GlobalCleanup() {
   // Patch the initializers for globals and aliases up.
   ResolveGlobalAndAliasInits();
@@ -1495,6 +1580,13 @@ bool BitcodeReader::ParseModule(bool Resume) {
           if (GlobalCleanup())
             return true;
           SeenFirstFunctionBody = true;
+
+          // With an index, the bodies need not be scanned to find them.
+          if (FunctionIndexBit && !LazyStreamer) {
+            if (ParseFunctionIndex())
+              return true;
+            break;
+          }
         }
 
         if (RememberAndSkipFunctionBody())
@@ -1692,6 +1784,12 @@ bool BitcodeReader::ParseModule(bool Resume) {
       AliasInits.push_back(std::make_pair(NewGA, Record[1]));
       break;
     }
+    /// MODULE_CODE_FNINDEX: [offset]
+    case bitc::MODULE_CODE_FNINDEX:
+      if (Record.size() < 1)
+        return Error("Invalid MODULE_CODE_FNINDEX record");
+      FunctionIndexBit = Record[0] * 32;
+      break;
     /// MODULE_CODE_PURGEVALS: [numvals]
     case bitc::MODULE_CODE_PURGEVALS:
       // Trim down the value list to the specified size.
@@ -2755,6 +2853,10 @@ bool BitcodeReader::Materialize(GlobalValue *GV, std::string *ErrInfo) {
     }
   }
 
+  // Read the functions whose blockaddresses this body took, so that no
+  // forward reference outlives the body if it is dropped again.
+  materializeForwardReferencedFunctions();
+
   return false;
 }
 
@@ -2762,6 +2864,11 @@ bool BitcodeReader::isDematerializable(const GlobalValue *GV) const {
   const Function *F = dyn_cast<Function>(GV);
   if (!F || F->isDeclaration())
     return false;
+  // Dropping the body would replace the uses of its blockaddresses, which are
+  // only resolved once, when the body is first read.
+  for (Function::const_iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+    if (BB->hasAddressTaken())
+      return false;
   return DeferredFunctionInfo.count(const_cast<Function*>(F));
 }
 
@@ -2773,8 +2880,16 @@ void BitcodeReader::Dematerialize(GlobalValue *GV) {
 
   assert(DeferredFunctionInfo.count(F) && "No info to read function later?");
 
-  // Just forget the function body, we can remat it later.
+  // Just forget the function body, we can remat it later.  deleteBody makes
+  // it an external declaration, but it is still the function that was read.
+  GlobalValue::LinkageTypes Linkage = F->getLinkage();
   F->deleteBody();
+  F->setLinkage(Linkage);
+}
+
+void BitcodeReader::Discard(GlobalValue *GV) {
+  if (Function *F = dyn_cast<Function>(GV))
+    DeferredFunctionInfo.erase(F);
 }
 
 
@@ -173,6 +173,10 @@ class BitcodeReader : public GVMaterializer {
   /// map contains info about where to find deferred function body in the
   /// stream.
   DenseMap<Function*, uint64_t> DeferredFunctionInfo;
+
+  /// FunctionIndexBit - The bit at which the FUNCTION_INDEX_BLOCK starts, or
+  /// zero if the module has no function index.
+  uint64_t FunctionIndexBit;
   
   /// BlockAddrFwdRefs - These are blockaddr references to basic blocks.  These
   /// are resolved lazily when functions are loaded.
@@ -184,13 +188,13 @@ public:
     : Context(C), TheModule(0), Buffer(buffer), BufferOwned(false),
       LazyStreamer(0), NextUnreadBit(0), SeenValueSymbolTable(false),
       ErrorString(0), ValueList(C), MDValueList(C),
-      SeenFirstFunctionBody(false) {
+      SeenFirstFunctionBody(false), FunctionIndexBit(0) {
   }
   explicit BitcodeReader(DataStreamer *streamer, LLVMContext &C)
     : Context(C), TheModule(0), Buffer(0), BufferOwned(false),
       LazyStreamer(streamer), NextUnreadBit(0), SeenValueSymbolTable(false),
       ErrorString(0), ValueList(C), MDValueList(C),
-      SeenFirstFunctionBody(false) {
+      SeenFirstFunctionBody(false), FunctionIndexBit(0) {
   }
   ~BitcodeReader() {
     FreeState();
@@ -209,6 +213,7 @@ public:
   virtual bool Materialize(GlobalValue *GV, std::string *ErrInfo = 0);
   virtual bool MaterializeModule(Module *M, std::string *ErrInfo = 0);
   virtual void Dematerialize(GlobalValue *GV);
+  virtual void Discard(GlobalValue *GV);
 
   bool Error(const char *Str) {
     ErrorString = Str;
@@ -277,6 +282,7 @@ private:
   bool ParseValueSymbolTable();
   bool ParseConstants();
   bool RememberAndSkipFunctionBody();
+  bool ParseFunctionIndex();
   bool ParseFunctionBody(Function *F);
   bool GlobalCleanup();
   bool ResolveGlobalAndAliasInits();
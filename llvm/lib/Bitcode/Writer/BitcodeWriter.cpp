@@ -23,6 +23,8 @@
 #include "llvm/Operator.h"
 #include "llvm/ValueSymbolTable.h"
 #include "llvm/ADT/Triple.h"
+#include "llvm/Config/config.h"
+#include "llvm/Support/Atomic.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/MathExtras.h"
@@ -30,6 +32,9 @@
 #include "llvm/Support/Program.h"
 #include <cctype>
 #include <map>
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 using namespace llvm;
 
 static cl::opt<bool>
@@ -38,6 +43,17 @@ EnablePreserveUseListOrdering("enable-bc-uselist-preserve",
                                        "use-list order preservation."),
                               cl::init(false), cl::Hidden);
 
+static cl::opt<unsigned>
+WriterThreads("bitcode-writer-threads",
+              cl::desc("Encode function bodies on this many threads"),
+              cl::init(1), cl::Hidden);
+
+static cl::opt<bool>
+EnableFunctionIndex("bitcode-function-index",
+                    cl::desc("Write an index of function bodies, so that a "
+                             "reader can find them without scanning"),
+                    cl::init(false), cl::Hidden);
+
 /// These are manifest constants used by the bitcode writer. They do not need to
 /// be kept in sync with the reader, but need to be consistent within this file.
 enum {
@@ -511,7 +527,7 @@ static void WriteModuleInfo(const Module *M, const ValueEnumerator &VE,
     //             section, visibility, gc, unnamed_addr]
     Vals.push_back(VE.getTypeID(F->getType()));
     Vals.push_back(F->getCallingConv());
-    Vals.push_back(F->isDeclaration());
+    Vals.push_back(F->isDeclaration() && !F->isMaterializable());
     Vals.push_back(getEncodedLinkage(F));
     Vals.push_back(VE.getAttributeID(F->getAttributes()));
     Vals.push_back(Log2_32(F->getAlignment())+1);
@@ -1706,8 +1722,146 @@ static void WriteModuleUseLists(const Module *M, ValueEnumerator &VE,
   Stream.ExitBlock();
 }
 
-/// WriteModule - Emit the specified module to the bitstream.
-static void WriteModule(const Module *M, BitstreamWriter &Stream) {
+namespace {
+  /// FunctionBlockWriter - The state shared by the threads encoding function
+  /// blocks.  Each thread takes the next function to write from NextFunction
+  /// and stores the body of its block in Blocks.
+  struct FunctionBlockWriter {
+    const std::vector<const Function*> *Functions;
+    const ValueEnumerator *ModuleVE;
+    std::vector<std::string> Blocks;
+    volatile sys::cas_flag NextFunction;
+  };
+}
+
+static void *WriteFunctionBlocks(void *Arg) {
+  FunctionBlockWriter &W = *static_cast<FunctionBlockWriter*>(Arg);
+
+  // Function blocks refer to the abbrevs from the blockinfo block, so this
+  // stream needs them too.  The blockinfo block itself is never copied out.
+  ValueEnumerator VE(*W.ModuleVE);
+  SmallVector<char, 0> Buffer;
+  BitstreamWriter Stream(Buffer);
+  WriteBlockInfo(VE, Stream);
+  unsigned BlockStart = Buffer.size();
+
+  while (true) {
+    unsigned i = sys::AtomicIncrement(&W.NextFunction) - 1;
+    if (i >= W.Functions->size())
+      break;
+    WriteFunction(*(*W.Functions)[i], VE, Stream);
+
+    // At the top level of this stream the block starts with one word holding
+    // ENTER_SUBBLOCK, the block ID and the abbrev width, then its size word.
+    unsigned BodyStart = BlockStart + 8;
+#ifndef NDEBUG
+    unsigned SizeInWords = 0;
+    for (unsigned b = 0; b != 4; ++b)
+      SizeInWords |= (unsigned char)Buffer[BodyStart - 4 + b] << (8 * b);
+    assert(Buffer.size() - BodyStart == SizeInWords * 4 &&
+           "Unexpected function block header!");
+#endif
+    W.Blocks[i].assign(Buffer.begin() + BodyStart, Buffer.end());
+
+    // Nothing refers back into the block once it is closed, so its bytes can
+    // be reused for the next one.
+    Buffer.resize(BlockStart);
+  }
+  return 0;
+}
+
+/// WriteFunctionsInParallel - Encode the blocks of Functions on up to
+/// -bitcode-writer-threads threads and emit them in order.  Each thread
+/// numbers function-local values in a copy of VE, so the result is the same
+/// as writing the functions one after another.
+/// The bit at which each block starts is added to BlockBits.
+static void WriteFunctionsInParallel(const std::vector<const Function*> &Functions,
+                                     const ValueEnumerator &VE,
+                                     BitstreamWriter &Stream,
+                                     std::vector<uint64_t> &BlockBits) {
+  FunctionBlockWriter W;
+  W.Functions = &Functions;
+  W.ModuleVE = &VE;
+  W.Blocks.resize(Functions.size());
+  W.NextFunction = 0;
+
+  unsigned Threads = std::min<unsigned>(WriterThreads, Functions.size());
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  // The calling thread is one of the writers.
+  std::vector<pthread_t> Workers(Threads);
+  std::vector<bool> Started(Threads);
+  for (unsigned i = 1; i != Threads; ++i)
+    Started[i] = ::pthread_create(&Workers[i], 0, WriteFunctionBlocks, &W) == 0;
+  WriteFunctionBlocks(&W);
+  for (unsigned i = 1; i != Threads; ++i)
+    if (Started[i])
+      ::pthread_join(Workers[i], 0);
+#else
+  (void)Threads;
+  WriteFunctionBlocks(&W);
+#endif
+
+  for (unsigned i = 0, e = Functions.size(); i != e; ++i) {
+    BlockBits.push_back(Stream.GetCurrentBitNo());
+    Stream.EmitSubblock(bitc::FUNCTION_BLOCK_ID, 4, W.Blocks[i]);
+  }
+}
+
+/// WriteFunctionIndexOffset - Emit a MODULE_CODE_FNINDEX record whose offset
+/// is filled in once the index has been written, and return the bit where
+/// the offset field starts.
+static uint64_t WriteFunctionIndexOffset(BitstreamWriter &Stream) {
+  // A fixed width field, so that it can be backpatched.
+  BitCodeAbbrev *Abbv = new BitCodeAbbrev();
+  Abbv->Add(BitCodeAbbrevOp(bitc::MODULE_CODE_FNINDEX));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Fixed, 32));
+  unsigned FnIndexAbbrev = Stream.EmitAbbrev(Abbv);
+
+  SmallVector<unsigned, 2> Vals;
+  Vals.push_back(bitc::MODULE_CODE_FNINDEX);
+  Vals.push_back(0);
+  Stream.EmitRecordWithAbbrev(FnIndexAbbrev, Vals);
+  return Stream.GetCurrentBitNo() - 32;
+}
+
+/// WriteFunctionIndex - Emit the function index block, which gives the bit
+/// at which the block of each function in Functions starts, and point the
+/// MODULE_CODE_FNINDEX record at OffsetBit to it.  Offsets are relative to
+/// BitcodeStart, the start of the bitcode magic number.
+static void WriteFunctionIndex(const std::vector<const Function*> &Functions,
+                               const std::vector<uint64_t> &BlockBits,
+                               uint64_t BitcodeStart, uint64_t OffsetBit,
+                               const ValueEnumerator &VE,
+                               BitstreamWriter &Stream) {
+  // The last function block ends on a word boundary.
+  uint64_t IndexBit = Stream.GetCurrentBitNo() - BitcodeStart;
+  assert(IndexBit % 32 == 0 && "Function index is not word aligned!");
+  assert(IndexBit / 32 <= ~0U && "Function index offset doesn't fit!");
+  Stream.BackpatchField(OffsetBit, unsigned(IndexBit / 32));
+
+  Stream.EnterSubblock(bitc::FUNCTION_INDEX_BLOCK_ID, 3);
+
+  BitCodeAbbrev *Abbv = new BitCodeAbbrev();
+  Abbv->Add(BitCodeAbbrevOp(bitc::FNINDEX_CODE_ENTRY));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::VBR, 8));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::VBR, 16));
+  unsigned EntryAbbrev = Stream.EmitAbbrev(Abbv);
+
+  SmallVector<uint64_t, 2> Vals;
+  for (unsigned i = 0, e = Functions.size(); i != e; ++i) {
+    Vals.push_back(VE.getValueID(Functions[i]));
+    Vals.push_back(BlockBits[i] - BitcodeStart);
+    Stream.EmitRecord(bitc::FNINDEX_CODE_ENTRY, Vals, EntryAbbrev);
+    Vals.clear();
+  }
+
+  Stream.ExitBlock();
+}
+
+/// WriteModule - Emit the specified module to the bitstream.  BitcodeStart is
+/// the bit at which the bitcode magic number starts.
+static void WriteModule(const Module *M, BitstreamWriter &Stream,
+                        uint64_t BitcodeStart) {
   Stream.EnterSubblock(bitc::MODULE_BLOCK_ID, 3);
 
   // Emit the version number if it is non-zero.
@@ -1749,10 +1903,39 @@ static void WriteModule(const Module *M, BitstreamWriter &Stream) {
   if (EnablePreserveUseListOrdering)
     WriteModuleUseLists(M, VE, Stream);
 
-  // Emit function bodies.
-  for (Module::const_iterator F = M->begin(), E = M->end(); F != E; ++F)
-    if (!F->isDeclaration())
-      WriteFunction(*F, VE, Stream);
+  // Emit function bodies.  Reading lazily loaded bodies from the bitcode
+  // isn't thread safe, so those are written one at a time.
+  std::vector<const Function*> Bodies;
+  bool Materializable = false;
+  for (Module::const_iterator F = M->begin(), E = M->end(); F != E; ++F) {
+    Materializable |= F->isMaterializable();
+    if (!F->isDeclaration() || F->isMaterializable())
+      Bodies.push_back(F);
+  }
+
+  uint64_t IndexOffsetBit = 0;
+  if (EnableFunctionIndex && !Bodies.empty())
+    IndexOffsetBit = WriteFunctionIndexOffset(Stream);
+
+  std::vector<uint64_t> BlockBits;
+  if (WriterThreads > 1 && Bodies.size() > 1 && !Materializable) {
+    WriteFunctionsInParallel(Bodies, VE, Stream, BlockBits);
+  } else {
+    for (unsigned i = 0, e = Bodies.size(); i != e; ++i) {
+      const Function &F = *Bodies[i];
+      bool Materialized = ValueEnumerator::materialize(F);
+      BlockBits.push_back(Stream.GetCurrentBitNo());
+      WriteFunction(F, VE, Stream);
+      if (Materialized)
+        const_cast<Function&>(F).Dematerialize();
+    }
+  }
+
+  // Emit the index of function blocks after them, now that their offsets are
+  // known.
+  if (IndexOffsetBit)
+    WriteFunctionIndex(Bodies, BlockBits, BitcodeStart, IndexOffsetBit, VE,
+                       Stream);
 
   Stream.ExitBlock();
 }
@@ -1845,6 +2028,7 @@ void llvm::WriteBitcodeToFile(const Module *M, raw_ostream &Out) {
   // Emit the module into the buffer.
   {
     BitstreamWriter Stream(Buffer);
+    uint64_t BitcodeStart = Stream.GetCurrentBitNo();
 
     // Emit the file header.
     Stream.Emit((unsigned)'B', 8);
@@ -1855,7 +2039,7 @@ void llvm::WriteBitcodeToFile(const Module *M, raw_ostream &Out) {
     Stream.Emit(0xD, 4);
 
     // Emit the module.
-    WriteModule(M, Stream);
+    WriteModule(M, Stream, BitcodeStart);
   }
 
   if (TT.isOSDarwin())
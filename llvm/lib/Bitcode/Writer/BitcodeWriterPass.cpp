@@ -24,6 +24,9 @@ namespace {
       : ModulePass(ID), OS(o) {}
     
     const char *getPassName() const { return "Bitcode Writer"; }
+
+    // The writer reads and drops lazily loaded bodies one at a time.
+    bool materializesFunctions() const { return true; }
     
     bool runOnModule(Module &M) {
       WriteBitcodeToFile(&M, OS);
@@ -20,6 +20,7 @@
 #include "llvm/ValueSymbolTable.h"
 #include "llvm/Instructions.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
 using namespace llvm;
@@ -69,6 +70,7 @@ ValueEnumerator::ValueEnumerator(const Module *M) {
 
   // Enumerate types used by function bodies and argument lists.
   for (Module::const_iterator F = M->begin(), E = M->end(); F != E; ++F) {
+    bool Materialized = materialize(*F);
 
     for (Function::const_arg_iterator I = F->arg_begin(), E = F->arg_end();
          I != E; ++I)
@@ -103,12 +105,37 @@ ValueEnumerator::ValueEnumerator(const Module *M) {
           if (IA) EnumerateMetadata(IA);
         }
       }
+
+    if (Materialized)
+      const_cast<Function&>(*F).Dematerialize();
   }
 
   // Optimize constant ordering.
   OptimizeConstants(FirstConstant, Values.size());
 }
 
+ValueEnumerator::ValueEnumerator(const ValueEnumerator &VE)
+  : TypeMap(VE.TypeMap), Types(VE.Types), ValueMap(VE.ValueMap),
+    Values(VE.Values), MDValues(VE.MDValues), MDValueMap(VE.MDValueMap),
+    AttributeMap(VE.AttributeMap), Attributes(VE.Attributes),
+    InstructionCount(0), NumModuleValues(VE.NumModuleValues),
+    NumModuleMDValues(VE.NumModuleMDValues),
+    FirstFuncConstantID(VE.FirstFuncConstantID), FirstInstID(VE.FirstInstID) {
+  assert(VE.BasicBlocks.empty() && VE.FunctionLocalMDs.empty() &&
+         "Copying a ValueEnumerator with a function incorporated!");
+}
+
+bool ValueEnumerator::materialize(const Function &F) {
+  if (!F.isMaterializable())
+    return false;
+
+  // Reading the body back doesn't change the module being written.
+  std::string ErrInfo;
+  if (const_cast<Function&>(F).Materialize(&ErrInfo))
+    report_fatal_error("Error reading bitcode file: " + Twine(ErrInfo));
+  return true;
+}
+
 unsigned ValueEnumerator::getInstructionID(const Instruction *Inst) const {
   InstructionMapType::const_iterator I = InstructionMap.find(Inst);
   assert(I != InstructionMap.end() && "Instruction is not mapped!");
@@ -79,11 +79,21 @@ private:
   unsigned FirstFuncConstantID;
   unsigned FirstInstID;
   
-  ValueEnumerator(const ValueEnumerator &);  // DO NOT IMPLEMENT
   void operator=(const ValueEnumerator &);   // DO NOT IMPLEMENT
 public:
   ValueEnumerator(const Module *M);
 
+  /// ValueEnumerator - Copy the module-level numbering of VE, which must not
+  /// have a function incorporated.  Function state lives in the copy, so
+  /// functions can be incorporated into copies on several threads at once.
+  ValueEnumerator(const ValueEnumerator &VE);
+
+  /// materialize - Read the body of F if it is still in the bitcode the module
+  /// was lazily loaded from.  If it was, return true: the caller drops the
+  /// body again with Dematerialize when done with it, so that a lazily loaded
+  /// module is never read in full.
+  static bool materialize(const Function &F);
+
   void dump() const;
   void print(raw_ostream &OS, const ValueMapType &Map, const char *Name) const;
 
@@ -24,11 +24,13 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/MathExtras.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include <algorithm>
 #include <cmath>
 using namespace llvm;
 
 STATISTIC(NumDynamicInsts, "Number of dynamic instructions executed");
+STATISTIC(NumNativeCalls, "Number of calls to native code when tiered");
 
 static cl::opt<bool> PrintVolatile("interpreter-print-volatile", cl::Hidden,
           cl::desc("make the interpreter print every volatile load and store"));
@@ -574,6 +576,10 @@ void Interpreter::exitCalled(GenericValue GV) {
   // the stack before interpreting atexit handlers.
   ECStack.clear();
   runAtExitHandlers();
+  // Nothing runs natively from here on, and a tier-up that compiles on
+  // another thread must stop before exit() destroys what it uses.
+  delete TierUp;
+  TierUp = 0;
   exit(GV.IntVal.zextOrTrunc(32).getZExtValue());
 }
 
@@ -590,15 +596,9 @@ void Interpreter::popStackAndReturnValueToCaller(Type *RetTy,
   // Pop the current stack frame.
   ECStack.pop_back();
 
-  if (ECStack.empty()) {  // Finished main.  Put result into exit code...
-    if (RetTy && !RetTy->isVoidTy()) {          // Nonvoid return type?
-      ExitValue = Result;   // Capture the exit value of the program
-    } else {
-      memset(&ExitValue.Untyped, 0, sizeof(ExitValue.Untyped));
-    }
-  } else {
-    // If we have a previous stack frame, and we have a previous call,
-    // fill in the return value...
+  // If we have a previous stack frame, and we have a previous call,
+  // fill in the return value...
+  if (!ECStack.empty()) {
     ExecutionContext &CallingSF = ECStack.back();
     if (Instruction *I = CallingSF.Caller.getInstruction()) {
       // Save result...
@@ -607,8 +607,17 @@ void Interpreter::popStackAndReturnValueToCaller(Type *RetTy,
       if (InvokeInst *II = dyn_cast<InvokeInst> (I))
         SwitchToNewBasicBlock (II->getNormalDest (), CallingSF);
       CallingSF.Caller = CallSite();          // We returned from the call...
+      return;
     }
   }
+
+  // Finished main, or a call made by threaded code.  Put result into exit
+  // code...
+  if (RetTy && !RetTy->isVoidTy()) {          // Nonvoid return type?
+    ExitValue = Result;   // Capture the exit value of the program
+  } else {
+    memset(&ExitValue.Untyped, 0, sizeof(ExitValue.Untyped));
+  }
 }
 
 void Interpreter::visitReturnInst(ReturnInst &I) {
@@ -679,6 +688,10 @@ void Interpreter::visitIndirectBrInst(IndirectBrInst &I) {
 // results can happen.  Thus we use a two phase approach.
 //
 void Interpreter::SwitchToNewBasicBlock(BasicBlock *Dest, ExecutionContext &SF){
+  // Going around a loop counts towards compiling the function.
+  if (SF.Tier && SF.Tier->Counting && SF.Tier->LoopHeaders.count(Dest))
+    countExecution(SF.CurFunction, *SF.Tier);
+
   BasicBlock *PrevBB = SF.CurBB;      // Remember where we came from...
   SF.CurBB   = Dest;                  // Update CurBB to branch destination
   SF.CurInst = SF.CurBB->begin();     // Update new instruction ptr...
@@ -1266,6 +1279,7 @@ void Interpreter::callFunction(Function *F,
   ECStack.push_back(ExecutionContext());
   ExecutionContext &StackFrame = ECStack.back();
   StackFrame.CurFunction = F;
+  StackFrame.Tier = 0;
 
   // Special handling for external functions.
   if (F->isDeclaration()) {
@@ -1275,6 +1289,29 @@ void Interpreter::callFunction(Function *F,
     return;
   }
 
+  // When tiered, a function with native code runs it the same way.
+  if (TierUp) {
+    FunctionTier *Tier = getFunctionTier(F);
+    if (Tier->Counting)
+      countExecution(F, *Tier);
+    if (Tier->Entry) {
+      GenericValue Result = callNativeEntry(Tier->Entry, F, ArgVals);
+      popStackAndReturnValueToCaller(F->getReturnType(), Result);
+      return;
+    }
+    StackFrame.Tier = Tier;
+  }
+
+  // Functions that translate into threaded code run to completion in it,
+  // unless too many threaded calls are in progress already.
+  if (!PrintVolatile && ThreadedDepth < MaxThreadedDepth)
+    if (ThreadedFunction *TF = getThreadedFunction(F)) {
+      GenericValue Result = callThreadedFunction(*TF, ArgVals,
+                                                 StackFrame.Tier);
+      popStackAndReturnValueToCaller(F->getReturnType(), Result);
+      return;
+    }
+
   // Get pointers to first LLVM BB & Instruction in function.
   StackFrame.CurBB     = F->begin();
   StackFrame.CurInst   = StackFrame.CurBB->begin();
@@ -1294,9 +1331,93 @@ void Interpreter::callFunction(Function *F,
   StackFrame.VarArgs.assign(ArgVals.begin()+i, ArgVals.end());
 }
 
+//===----------------------------------------------------------------------===//
+// getFunctionTier - Return how hot F is, picking up any native code that has
+// become available first.
+//
+FunctionTier *Interpreter::getFunctionTier(Function *F) {
+  if (NumInstalled != TierUp->getNumCompiled()) {
+    NumInstalled = TierUp->getNumCompiled();
+    std::vector<std::pair<Function*, InterpreterTierUp::NativeEntry> > Compiled;
+    TierUp->takeCompiled(Compiled);
+    for (unsigned i = 0, e = Compiled.size(); i != e; ++i) {
+      FunctionTier *&Tier = Tiers[Compiled[i].first];
+      if (!Tier)
+        Tier = new FunctionTier();
+      Tier->Counting = false;
+      Tier->Entry = Compiled[i].second;
+    }
+  }
+
+  FunctionTier *&Tier = Tiers[F];
+  if (!Tier) {
+    Tier = new FunctionTier();
+    SmallVector<std::pair<const BasicBlock*, const BasicBlock*>, 8> Edges;
+    FindFunctionBackedges(*F, Edges);
+    for (unsigned i = 0, e = Edges.size(); i != e; ++i)
+      Tier->LoopHeaders.insert(Edges[i].second);
+  }
+  return Tier;
+}
+
+// countExecution - Count a call to F or a back-edge in it.  Functions are
+// handed to TierUp once, and are interpreted until their native code is
+// available; a call that is already running is never moved to native code.
+//
+void Interpreter::countExecution(Function *F, FunctionTier &Tier) {
+  if (++Tier.Count < TierUpThreshold)
+    return;
+  Tier.Counting = false;
+  Tier.LoopHeaders.clear();
+  TierUp->functionIsHot(F);
+}
+
+// callNativeEntry - Call the native code of F, passing the arguments and the
+// result through memory.
+//
+GenericValue
+Interpreter::callNativeEntry(InterpreterTierUp::NativeEntry Entry, Function *F,
+                             const std::vector<GenericValue> &ArgVals) {
+  ++NumNativeCalls;
+  FunctionType *FTy = F->getFunctionType();
+  Type *RetTy = FTy->getReturnType();
+
+  // Each value gets whole 64-bit words of its own.
+  SmallVector<unsigned, 8> Offsets;
+  unsigned Words = 0;
+  for (unsigned i = 0, e = FTy->getNumParams(); i != e; ++i) {
+    Offsets.push_back(Words);
+    Words += (TD.getTypeAllocSize(FTy->getParamType(i)) + 7) / 8;
+  }
+  unsigned ResultOffset = Words;
+  if (!RetTy->isVoidTy())
+    Words += (TD.getTypeAllocSize(RetTy) + 7) / 8;
+
+  SmallVector<uint64_t, 16> Memory(Words);
+  SmallVector<void*, 8> Args;
+  for (unsigned i = 0, e = Offsets.size(); i != e; ++i) {
+    Args.push_back(Memory.data() + Offsets[i]);
+    StoreValueToMemory(ArgVals[i], (GenericValue*)Args.back(),
+                       FTy->getParamType(i));
+  }
+
+  Entry(Args.data(), Memory.data() + ResultOffset);
+
+  GenericValue Result;
+  if (!RetTy->isVoidTy())
+    LoadValueFromMemory(Result, (GenericValue*)(Memory.data() + ResultOffset),
+                        RetTy);
+  return Result;
+}
 
 void Interpreter::run() {
-  while (!ECStack.empty()) {
+  runUntilDepth(0);
+}
+
+// runUntilDepth - Execute instructions until the stack is back to Depth frames.
+//
+void Interpreter::runUntilDepth(unsigned Depth) {
+  while (ECStack.size() > Depth) {
     // Interpret a single instruction & increment the "PC".
     ExecutionContext &SF = ECStack.back();  // Current stack frame
     Instruction &I = *SF.CurInst++;         // Increment before execute
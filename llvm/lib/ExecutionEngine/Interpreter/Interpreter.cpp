@@ -17,6 +17,7 @@
 #include "llvm/CodeGen/IntrinsicLowering.h"
 #include "llvm/DerivedTypes.h"
 #include "llvm/Module.h"
+#include "llvm/ADT/STLExtras.h"
 #include <cstring>
 using namespace llvm;
 
@@ -45,7 +46,8 @@ ExecutionEngine *Interpreter::create(Module *M, std::string* ErrStr) {
 // Interpreter ctor - Initialize stuff
 //
 Interpreter::Interpreter(Module *M)
-  : ExecutionEngine(M), TD(M) {
+  : ExecutionEngine(M), TD(M), TierUp(0), TierUpThreshold(0), NumInstalled(0),
+    ThreadedDepth(0) {
       
   memset(&ExitValue.Untyped, 0, sizeof(ExitValue.Untyped));
   setTargetData(&TD);
@@ -59,6 +61,22 @@ Interpreter::Interpreter(Module *M)
 
 Interpreter::~Interpreter() {
   delete IL;
+  delete TierUp;
+  DeleteContainerSeconds(Tiers);
+  deleteThreadedFunctions();
+}
+
+InterpreterTierUp::~InterpreterTierUp() {}
+
+void Interpreter::setTierUp(InterpreterTierUp *TU, unsigned Threshold) {
+  assert(!TierUp && "Tiered execution was already set up!");
+  TierUp = TU;
+  TierUpThreshold = Threshold;
+}
+
+void llvm::setInterpreterTierUp(ExecutionEngine *EE, InterpreterTierUp *TierUp,
+                                unsigned Threshold) {
+  static_cast<Interpreter*>(EE)->setTierUp(TierUp, Threshold);
 }
 
 void Interpreter::runAtExitHandlers () {
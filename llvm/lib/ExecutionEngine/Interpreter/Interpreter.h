@@ -17,6 +17,9 @@
 #include "llvm/Function.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/ExecutionEngine/Interpreter.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/Support/CallSite.h"
 #include "llvm/Support/DataTypes.h"
@@ -27,6 +30,7 @@ namespace llvm {
 
 class IntrinsicLowering;
 struct FunctionInfo;
+struct ThreadedFunction;
 template<typename T> class generic_gep_type_iterator;
 class ConstantExpr;
 typedef generic_gep_type_iterator<User::const_op_iterator> gep_type_iterator;
@@ -64,6 +68,33 @@ public:
 
 typedef std::vector<GenericValue> ValuePlaneTy;
 
+// ThreadedSlot - A register of threaded code.  Integers and pointers are kept
+// in I, zero-extended from their width.
+//
+union ThreadedSlot {
+  uint64_t I;
+  float F;
+  double D;
+};
+
+// MaxThreadedDepth - How many calls of threaded code may be in progress at
+// once.  Each takes a frame of the C stack, which the deep recursion of an
+// interpreted program could otherwise overflow.
+//
+static const unsigned MaxThreadedDepth = 256;
+
+// FunctionTier - How hot a function has been in tiered execution, and its
+// native code once that is available.
+//
+struct FunctionTier {
+  unsigned Count;                       // Calls and back-edges so far
+  bool Counting;                        // False once it was found hot
+  InterpreterTierUp::NativeEntry Entry; // Native code, or null
+  SmallPtrSet<const BasicBlock*, 4> LoopHeaders; // Targets of back-edges
+
+  FunctionTier() : Count(0), Counting(true), Entry(0) {}
+};
+
 // ExecutionContext struct - This struct represents one stack frame currently
 // executing.
 //
@@ -76,6 +107,7 @@ struct ExecutionContext {
   CallSite             Caller;     // Holds the call that called subframes.
                                    // NULL if main func or debugger invoked fn
   AllocaHolderHandle    Allocas;    // Track memory allocated by alloca
+  FunctionTier         *Tier;      // Hotness of CurFunction, if tiered
 };
 
 // Interpreter - This class represents the entirety of the interpreter.
@@ -93,6 +125,21 @@ class Interpreter : public ExecutionEngine, public InstVisitor<Interpreter> {
   // registered with the atexit() library function.
   std::vector<Function*> AtExitHandlers;
 
+  // Tiered execution: TierUp gets the functions that reach TierUpThreshold,
+  // and supplies native code for them later.  The FunctionTier of a function
+  // is where every call to it checks for that code.
+  InterpreterTierUp *TierUp;
+  unsigned TierUpThreshold;
+  sys::cas_flag NumInstalled;
+  DenseMap<Function*, FunctionTier*> Tiers;
+
+  // Threaded code: functions translated into arrays of ops on numbered slots,
+  // or null for the functions that are interpreted from their IR.  Threaded
+  // code runs on the C stack, so ThreadedDepth counts the threaded calls in
+  // progress, and deeper calls are interpreted from their IR instead.
+  DenseMap<Function*, ThreadedFunction*> Threaded;
+  unsigned ThreadedDepth;
+
 public:
   explicit Interpreter(Module *M);
   ~Interpreter();
@@ -102,6 +149,11 @@ public:
   ///
   void runAtExitHandlers();
 
+  /// setTierUp - Start counting how hot functions are.  See
+  /// setInterpreterTierUp.
+  ///
+  void setTierUp(InterpreterTierUp *TU, unsigned Threshold);
+
   static void Register() {
     InterpCtor = create;
   }
@@ -205,6 +257,27 @@ private:  // Helper functions
   //
   void SwitchToNewBasicBlock(BasicBlock *Dest, ExecutionContext &SF);
 
+  // Tiered execution.
+  FunctionTier *getFunctionTier(Function *F);
+  void countExecution(Function *F, FunctionTier &Tier);
+  GenericValue callNativeEntry(InterpreterTierUp::NativeEntry Entry,
+                               Function *F,
+                               const std::vector<GenericValue> &ArgVals);
+
+  // Threaded code.
+  ThreadedFunction *getThreadedFunction(Function *F);
+  ThreadedFunction *translateFunction(Function *F);
+  void deleteThreadedFunctions();
+  GenericValue callThreadedFunction(ThreadedFunction &TF,
+                                    const std::vector<GenericValue> &ArgVals,
+                                    FunctionTier *Tier);
+  ThreadedSlot runThreadedFunction(ThreadedFunction &TF,
+                                   const ThreadedSlot *Args,
+                                   FunctionTier *Tier);
+  GenericValue callFromThreadedCode(Function *F,
+                                    const std::vector<GenericValue> &ArgVals);
+  void runUntilDepth(unsigned Depth);
+
   void *getPointerToFunction(Function *F) { return (void*)F; }
   void *getPointerToBasicBlock(BasicBlock *BB) { return (void*)BB; }
 
@@ -0,0 +1,1085 @@
+//===-- ThreadedCode.cpp - Pre-decoded execution of functions -------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file translates functions into threaded code for the interpreter: an
+// array of ops per function, whose operands and results are numbered slots in
+// a flat frame rather than GenericValues looked up by Value.  Each op jumps
+// straight to the code of the next one.  Only functions that use integers of
+// up to 64 bits, float, double and pointers are translated; the rest, and the
+// calls threaded code makes to them, go through the interpreter's GenericValue
+// calling convention as before.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "interpreter"
+#include "Interpreter.h"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/CodeGen/IntrinsicLowering.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/GetElementPtrTypeIterator.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+using namespace llvm;
+
+STATISTIC(NumThreaded, "Number of functions translated to threaded code");
+STATISTIC(NumThreadedOps, "Number of ops executed in threaded code");
+
+static cl::opt<bool> UseThreadedCode("interpreter-threaded-code", cl::Hidden,
+          cl::init(true),
+          cl::desc("Translate functions into threaded code before running "
+                   "them in the interpreter"));
+
+// Computed goto is a GNU extension; elsewhere the ops are dispatched through
+// a switch.
+#ifdef __GNUC__
+#define THREADED_DISPATCH 1
+#endif
+
+// The ops of threaded code.  Integer ops take the width of their operands as
+// the mask of its bits in Imm, and the shift that sign-extends them to 64 bits
+// in C.  Memory ops with an N take the byte count in C.
+#define THREADED_OPS \
+  OP(Move) \
+  OP(Add) OP(Sub) OP(Mul) OP(UDiv) OP(SDiv) OP(URem) OP(SRem) \
+  OP(Shl) OP(LShr) OP(AShr) OP(And) OP(Or) OP(Xor) \
+  OP(FAddF) OP(FSubF) OP(FMulF) OP(FDivF) OP(FRemF) \
+  OP(FAddD) OP(FSubD) OP(FMulD) OP(FDivD) OP(FRemD) \
+  OP(ICmpEQ) OP(ICmpNE) OP(ICmpUGT) OP(ICmpUGE) OP(ICmpULT) OP(ICmpULE) \
+  OP(ICmpSGT) OP(ICmpSGE) OP(ICmpSLT) OP(ICmpSLE) \
+  OP(FCmpF) OP(FCmpD) \
+  OP(Trunc) OP(SExt) OP(FPTrunc) OP(FPExt) \
+  OP(UIToF) OP(SIToF) OP(UIToD) OP(SIToD) \
+  OP(FToUI) OP(FToSI) OP(DToUI) OP(DToSI) \
+  OP(FToBits) OP(BitsToF) \
+  OP(Select) OP(Alloca) OP(GEP) \
+  OP(Load1) OP(Load2) OP(Load4) OP(Load8) OP(LoadN) \
+  OP(Store1) OP(Store2) OP(Store4) OP(Store8) OP(StoreN) \
+  OP(Call) OP(Br) OP(CondBr) OP(Switch) OP(Ret) OP(RetVoid) OP(Unreachable)
+
+namespace {
+  enum ThreadedOpcode {
+#define OP(X) Op##X,
+    THREADED_OPS
+#undef OP
+    NumThreadedOpcodes
+  };
+}
+
+namespace llvm {
+
+// ThreadedOp - One op of threaded code.  Dest, A, B and C are slots, or
+// indices into the tables of the function for the ops that need more.
+//
+struct ThreadedOp {
+  const void *Handler;  // The code for Opcode, once the function has run
+  unsigned Opcode;
+  unsigned Dest, A, B, C;
+  uint64_t Imm;
+};
+
+// ThreadedEdge - A branch to the first op of a block, which first copies the
+// incoming values of the PHI nodes there.
+//
+struct ThreadedEdge {
+  unsigned Target;
+  unsigned MovesBegin, MovesEnd; // Range of (Dest, Src) pairs in Moves
+  bool Backedge;                 // Counted when tiered
+};
+
+// ThreadedIndex - A variable index of a getelementptr.
+//
+struct ThreadedIndex {
+  unsigned Slot;
+  unsigned Shift;                // Sign-extends the index to 64 bits
+  int64_t Scale;
+};
+
+// ThreadedCall - A call made by threaded code.  Target is the threaded code of
+// a direct callee, once resolved.
+//
+struct ThreadedCall {
+  CallSite CS;
+  Function *Callee;              // Null for indirect calls
+  FunctionType *FTy;
+  unsigned CalleeSlot;
+  unsigned ArgsBegin, ArgsEnd;   // Range of slots in CallArgs
+  ThreadedFunction *Target;
+  bool Resolved;
+};
+
+// ThreadedFunction - The threaded code of a function.  Its frame holds the
+// arguments, then the values of instructions, then the constants, then
+// scratch slots for copying the values of PHI nodes.
+//
+struct ThreadedFunction {
+  Function *F;
+  unsigned NumArgs, NumValues, ScratchBase, NumSlots;
+  std::vector<ThreadedSlot> Constants;
+  std::vector<ThreadedOp> Ops;
+  std::vector<ThreadedEdge> Edges;
+  std::vector<std::pair<unsigned, unsigned> > Moves;
+  std::vector<ThreadedIndex> Indices;
+  std::vector<ThreadedCall> Calls;
+  std::vector<unsigned> CallArgs;
+  std::vector<std::pair<uint64_t, unsigned> > Cases; // Value, edge
+  bool Threaded;                 // Whether Handler is set in Ops
+
+  explicit ThreadedFunction(Function *F)
+    : F(F), NumArgs(0), NumValues(0), ScratchBase(0), NumSlots(0),
+      Threaded(false) {}
+};
+
+} // End llvm namespace
+
+//===----------------------------------------------------------------------===//
+//                     Translation into Threaded Code
+//===----------------------------------------------------------------------===//
+
+static const unsigned NoSlot = ~0U;
+
+/// isThreadedType - Return true if values of type Ty fit in a ThreadedSlot.
+static bool isThreadedType(Type *Ty) {
+  if (IntegerType *ITy = dyn_cast<IntegerType>(Ty))
+    return ITy->getBitWidth() <= 64;
+  return Ty->isFloatTy() || Ty->isDoubleTy() || Ty->isPointerTy();
+}
+
+static uint64_t getWidthMask(unsigned Bits) {
+  return Bits >= 64 ? ~0ULL : (1ULL << Bits) - 1;
+}
+
+/// isLoweredIntrinsic - Return true if the interpreter's lowering turns calls
+/// to the intrinsic ID into plain instructions or library calls.
+static bool isLoweredIntrinsic(unsigned ID) {
+  switch (ID) {
+  default:
+    return false;
+  case Intrinsic::expect:
+  case Intrinsic::dbg_declare:
+  case Intrinsic::memcpy:
+  case Intrinsic::memmove:
+  case Intrinsic::memset:
+  case Intrinsic::ctpop:
+  case Intrinsic::ctlz:
+  case Intrinsic::cttz:
+  case Intrinsic::bswap:
+  case Intrinsic::sqrt:
+  case Intrinsic::log:
+  case Intrinsic::exp:
+  case Intrinsic::pow:
+  case Intrinsic::invariant_start:
+  case Intrinsic::invariant_end:
+  case Intrinsic::lifetime_start:
+  case Intrinsic::lifetime_end:
+    return true;
+  }
+}
+
+namespace {
+
+/// ThreadedCodeBuilder - Translate the instructions of a function into ops.
+/// Constants are only collected; the interpreter evaluates them.
+class ThreadedCodeBuilder {
+  const TargetData &TD;
+  ThreadedFunction &TF;
+  DenseMap<Value*, unsigned> Slots;
+  std::vector<Constant*> Constants;
+  DenseMap<BasicBlock*, unsigned> BlockStarts;
+  std::vector<std::pair<unsigned, BasicBlock*> > EdgeTargets;
+  SmallVector<std::pair<const BasicBlock*, const BasicBlock*>, 8> Backedges;
+  unsigned MaxMoves;
+
+public:
+  ThreadedCodeBuilder(const TargetData &TD, ThreadedFunction &TF)
+    : TD(TD), TF(TF), MaxMoves(0) {}
+
+  /// build - Translate the function, and return false if it uses anything
+  /// that threaded code does not support.
+  bool build();
+
+  const std::vector<Constant*> &getConstants() const { return Constants; }
+
+private:
+  bool canTranslate(Instruction &I, std::string &Why);
+  bool translate(Instruction &I);
+  unsigned getSlot(Value *V);
+  unsigned getEdge(BasicBlock *From, BasicBlock *To);
+  unsigned getBits(Type *Ty) {
+    return Ty->isPointerTy() ? TD.getPointerSizeInBits()
+                             : cast<IntegerType>(Ty)->getBitWidth();
+  }
+  void emit(unsigned Opcode, unsigned Dest, unsigned A = 0, unsigned B = 0,
+            unsigned C = 0, uint64_t Imm = 0) {
+    ThreadedOp Op = { 0, Opcode, Dest, A, B, C, Imm };
+    TF.Ops.push_back(Op);
+  }
+  void emitInt(unsigned Opcode, Instruction &I, Type *Ty) {
+    unsigned Bits = getBits(Ty);
+    emit(Opcode, getSlot(&I), getSlot(I.getOperand(0)),
+         I.getNumOperands() > 1 ? getSlot(I.getOperand(1)) : 0, 64 - Bits,
+         getWidthMask(Bits));
+  }
+  void emitFP(unsigned FloatOp, unsigned DoubleOp, Instruction &I) {
+    emit(I.getType()->isFloatTy() ? FloatOp : DoubleOp, getSlot(&I),
+         getSlot(I.getOperand(0)), getSlot(I.getOperand(1)));
+  }
+};
+
+} // end anonymous namespace
+
+unsigned ThreadedCodeBuilder::getSlot(Value *V) {
+  DenseMap<Value*, unsigned>::iterator I = Slots.find(V);
+  if (I != Slots.end())
+    return I->second;
+  // Constants go after the values of the instructions.
+  unsigned Slot = TF.NumArgs + TF.NumValues + Constants.size();
+  Constants.push_back(cast<Constant>(V));
+  Slots[V] = Slot;
+  return Slot;
+}
+
+unsigned ThreadedCodeBuilder::getEdge(BasicBlock *From, BasicBlock *To) {
+  ThreadedEdge Edge;
+  Edge.Target = 0;
+  Edge.MovesBegin = TF.Moves.size();
+  for (BasicBlock::iterator I = To->begin(); PHINode *PN = dyn_cast<PHINode>(I);
+       ++I) {
+    unsigned Dest = getSlot(PN);
+    unsigned Src = getSlot(PN->getIncomingValueForBlock(From));
+    if (Dest != Src)
+      TF.Moves.push_back(std::make_pair(Dest, Src));
+  }
+  Edge.MovesEnd = TF.Moves.size();
+  MaxMoves = std::max(MaxMoves, Edge.MovesEnd - Edge.MovesBegin);
+  Edge.Backedge = std::find(Backedges.begin(), Backedges.end(),
+                            std::make_pair((const BasicBlock*)From,
+                                           (const BasicBlock*)To)) !=
+                  Backedges.end();
+
+  EdgeTargets.push_back(std::make_pair(unsigned(TF.Edges.size()), To));
+  TF.Edges.push_back(Edge);
+  return TF.Edges.size() - 1;
+}
+
+bool ThreadedCodeBuilder::canTranslate(Instruction &I, std::string &Why) {
+  if (!I.getType()->isVoidTy() && !isThreadedType(I.getType())) {
+    Why = "type of result";
+    return false;
+  }
+  for (unsigned i = 0, e = I.getNumOperands(); i != e; ++i) {
+    Value *Op = I.getOperand(i);
+    if (!isa<BasicBlock>(Op) && !isThreadedType(Op->getType())) {
+      Why = "type of operand";
+      return false;
+    }
+  }
+
+  switch (I.getOpcode()) {
+  default:
+    if (I.isBinaryOp())
+      return true;
+    Why = "instruction";
+    return false;
+  case Instruction::Ret:
+  case Instruction::Br:
+  case Instruction::Switch:
+  case Instruction::Unreachable:
+  case Instruction::Alloca:
+  case Instruction::Load:
+  case Instruction::Store:
+  case Instruction::GetElementPtr:
+  case Instruction::PHI:
+  case Instruction::Select:
+  case Instruction::ICmp:
+  case Instruction::FCmp:
+    return true;
+  case Instruction::Call: {
+    CallInst &CI = cast<CallInst>(I);
+    if (CI.isInlineAsm()) {
+      Why = "inline asm";
+      return false;
+    }
+    Function *Callee = CI.getCalledFunction();
+    if (Callee && Callee->isIntrinsic()) {
+      Why = "intrinsic";
+      return false;
+    }
+    return true;
+  }
+  case Instruction::Trunc:
+  case Instruction::ZExt:
+  case Instruction::SExt:
+  case Instruction::UIToFP:
+  case Instruction::SIToFP:
+  case Instruction::FPToUI:
+  case Instruction::FPToSI:
+  case Instruction::PtrToInt:
+  case Instruction::IntToPtr:
+  case Instruction::FPTrunc:
+  case Instruction::FPExt:
+  case Instruction::BitCast:
+    return true;
+  }
+}
+
+bool ThreadedCodeBuilder::build() {
+  Function &F = *TF.F;
+
+  FindFunctionBackedges(F, Backedges);
+
+  // Number the arguments and the instructions first, so that the constants
+  // can follow them.
+  for (Function::arg_iterator AI = F.arg_begin(), E = F.arg_end(); AI != E;
+       ++AI)
+    Slots[AI] = TF.NumArgs++;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
+      std::string Why;
+      if (!canTranslate(*I, Why)) {
+        DEBUG(dbgs() << "No threaded code for " << F.getName() << ", "
+                     << Why << ": " << *I << "\n");
+        return false;
+      }
+      if (!I->getType()->isVoidTy())
+        Slots[I] = TF.NumArgs + TF.NumValues++;
+    }
+
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    BlockStarts[BB] = TF.Ops.size();
+    for (BasicBlock::iterator I = BB->getFirstNonPHI(), E = BB->end(); I != E;
+         ++I)
+      if (!translate(*I))
+        return false;
+  }
+
+  for (unsigned i = 0, e = EdgeTargets.size(); i != e; ++i)
+    TF.Edges[EdgeTargets[i].first].Target = BlockStarts[EdgeTargets[i].second];
+  TF.ScratchBase = TF.NumArgs + TF.NumValues + Constants.size();
+  TF.NumSlots = TF.ScratchBase + MaxMoves;
+  return true;
+}
+
+bool ThreadedCodeBuilder::translate(Instruction &I) {
+  switch (I.getOpcode()) {
+  default:
+    llvm_unreachable("Instruction not translated!");
+
+  case Instruction::Add:  emitInt(OpAdd, I, I.getType()); break;
+  case Instruction::Sub:  emitInt(OpSub, I, I.getType()); break;
+  case Instruction::Mul:  emitInt(OpMul, I, I.getType()); break;
+  case Instruction::UDiv: emitInt(OpUDiv, I, I.getType()); break;
+  case Instruction::SDiv: emitInt(OpSDiv, I, I.getType()); break;
+  case Instruction::URem: emitInt(OpURem, I, I.getType()); break;
+  case Instruction::SRem: emitInt(OpSRem, I, I.getType()); break;
+  case Instruction::Shl:  emitInt(OpShl, I, I.getType()); break;
+  case Instruction::LShr: emitInt(OpLShr, I, I.getType()); break;
+  case Instruction::AShr: emitInt(OpAShr, I, I.getType()); break;
+  case Instruction::And:  emitInt(OpAnd, I, I.getType()); break;
+  case Instruction::Or:   emitInt(OpOr, I, I.getType()); break;
+  case Instruction::Xor:  emitInt(OpXor, I, I.getType()); break;
+  case Instruction::FAdd: emitFP(OpFAddF, OpFAddD, I); break;
+  case Instruction::FSub: emitFP(OpFSubF, OpFSubD, I); break;
+  case Instruction::FMul: emitFP(OpFMulF, OpFMulD, I); break;
+  case Instruction::FDiv: emitFP(OpFDivF, OpFDivD, I); break;
+  case Instruction::FRem: emitFP(OpFRemF, OpFRemD, I); break;
+
+  case Instruction::ICmp: {
+    unsigned Opcode;
+    switch (cast<ICmpInst>(I).getPredicate()) {
+    default: llvm_unreachable("Invalid icmp predicate!");
+    case ICmpInst::ICMP_EQ:  Opcode = OpICmpEQ; break;
+    case ICmpInst::ICMP_NE:  Opcode = OpICmpNE; break;
+    case ICmpInst::ICMP_UGT: Opcode = OpICmpUGT; break;
+    case ICmpInst::ICMP_UGE: Opcode = OpICmpUGE; break;
+    case ICmpInst::ICMP_ULT: Opcode = OpICmpULT; break;
+    case ICmpInst::ICMP_ULE: Opcode = OpICmpULE; break;
+    case ICmpInst::ICMP_SGT: Opcode = OpICmpSGT; break;
+    case ICmpInst::ICMP_SGE: Opcode = OpICmpSGE; break;
+    case ICmpInst::ICMP_SLT: Opcode = OpICmpSLT; break;
+    case ICmpInst::ICMP_SLE: Opcode = OpICmpSLE; break;
+    }
+    emitInt(Opcode, I, I.getOperand(0)->getType());
+    break;
+  }
+  case Instruction::FCmp:
+    emit(I.getOperand(0)->getType()->isFloatTy() ? OpFCmpF : OpFCmpD,
+         getSlot(&I), getSlot(I.getOperand(0)), getSlot(I.getOperand(1)), 0,
+         cast<FCmpInst>(I).getPredicate());
+    break;
+
+  case Instruction::Trunc:
+  case Instruction::PtrToInt:
+  case Instruction::IntToPtr:
+    emit(OpTrunc, getSlot(&I), getSlot(I.getOperand(0)), 0, 0,
+         getWidthMask(getBits(I.getType())));
+    break;
+  case Instruction::ZExt:
+    emit(OpMove, getSlot(&I), getSlot(I.getOperand(0)));
+    break;
+  case Instruction::SExt:
+    emit(OpSExt, getSlot(&I), getSlot(I.getOperand(0)), 0,
+         64 - getBits(I.getOperand(0)->getType()),
+         getWidthMask(getBits(I.getType())));
+    break;
+  case Instruction::FPTrunc:
+    emit(OpFPTrunc, getSlot(&I), getSlot(I.getOperand(0)));
+    break;
+  case Instruction::FPExt:
+    emit(OpFPExt, getSlot(&I), getSlot(I.getOperand(0)));
+    break;
+  case Instruction::UIToFP:
+    emit(I.getType()->isFloatTy() ? OpUIToF : OpUIToD, getSlot(&I),
+         getSlot(I.getOperand(0)));
+    break;
+  case Instruction::SIToFP:
+    emit(I.getType()->isFloatTy() ? OpSIToF : OpSIToD, getSlot(&I),
+         getSlot(I.getOperand(0)), 0,
+         64 - getBits(I.getOperand(0)->getType()));
+    break;
+  case Instruction::FPToUI:
+    emit(I.getOperand(0)->getType()->isFloatTy() ? OpFToUI : OpDToUI,
+         getSlot(&I), getSlot(I.getOperand(0)), 0, 0,
+         getWidthMask(getBits(I.getType())));
+    break;
+  case Instruction::FPToSI:
+    emit(I.getOperand(0)->getType()->isFloatTy() ? OpFToSI : OpDToSI,
+         getSlot(&I), getSlot(I.getOperand(0)), 0, 0,
+         getWidthMask(getBits(I.getType())));
+    break;
+  case Instruction::BitCast: {
+    unsigned Opcode = OpMove;
+    if (I.getOperand(0)->getType()->isFloatTy() && !I.getType()->isFloatTy())
+      Opcode = OpFToBits;
+    else if (I.getType()->isFloatTy() &&
+             !I.getOperand(0)->getType()->isFloatTy())
+      Opcode = OpBitsToF;
+    emit(Opcode, getSlot(&I), getSlot(I.getOperand(0)));
+    break;
+  }
+
+  case Instruction::Select:
+    emit(OpSelect, getSlot(&I), getSlot(I.getOperand(0)),
+         getSlot(I.getOperand(1)), getSlot(I.getOperand(2)));
+    break;
+
+  case Instruction::Alloca: {
+    AllocaInst &AI = cast<AllocaInst>(I);
+    emit(OpAlloca, getSlot(&I), getSlot(AI.getArraySize()), 0, 0,
+         TD.getTypeAllocSize(AI.getAllocatedType()));
+    break;
+  }
+  case Instruction::Load: {
+    Type *Ty = I.getType();
+    unsigned Bytes = TD.getTypeStoreSize(Ty);
+    unsigned Opcode = OpLoadN;
+    // Integers that don't fill their bytes are masked.
+    if (!Ty->isIntegerTy() || getBits(Ty) == Bytes * 8)
+      switch (Bytes) {
+      case 1: Opcode = OpLoad1; break;
+      case 2: Opcode = OpLoad2; break;
+      case 4: Opcode = OpLoad4; break;
+      case 8: Opcode = OpLoad8; break;
+      }
+    emit(Opcode, getSlot(&I), getSlot(I.getOperand(0)), 0, Bytes,
+         Ty->isIntegerTy() ? getWidthMask(getBits(Ty)) : ~0ULL);
+    break;
+  }
+  case Instruction::Store: {
+    unsigned Bytes = TD.getTypeStoreSize(I.getOperand(0)->getType());
+    unsigned Opcode = OpStoreN;
+    switch (Bytes) {
+    case 1: Opcode = OpStore1; break;
+    case 2: Opcode = OpStore2; break;
+    case 4: Opcode = OpStore4; break;
+    case 8: Opcode = OpStore8; break;
+    }
+    emit(Opcode, NoSlot, getSlot(I.getOperand(0)), getSlot(I.getOperand(1)),
+         Bytes);
+    break;
+  }
+  case Instruction::GetElementPtr: {
+    int64_t Offset = 0;
+    unsigned IndicesBegin = TF.Indices.size();
+    for (gep_type_iterator GTI = gep_type_begin(I), E = gep_type_end(I);
+         GTI != E; ++GTI) {
+      if (StructType *STy = dyn_cast<StructType>(*GTI)) {
+        unsigned Field = cast<ConstantInt>(GTI.getOperand())->getZExtValue();
+        Offset += TD.getStructLayout(STy)->getElementOffset(Field);
+        continue;
+      }
+      int64_t Scale =
+        TD.getTypeAllocSize(cast<SequentialType>(*GTI)->getElementType());
+      if (ConstantInt *CI = dyn_cast<ConstantInt>(GTI.getOperand())) {
+        Offset += Scale * CI->getSExtValue();
+        continue;
+      }
+      ThreadedIndex Index = { getSlot(GTI.getOperand()),
+                              64 - getBits(GTI.getOperand()->getType()),
+                              Scale };
+      TF.Indices.push_back(Index);
+    }
+    emit(OpGEP, getSlot(&I), getSlot(I.getOperand(0)), IndicesBegin,
+         TF.Indices.size(), uint64_t(Offset));
+    break;
+  }
+
+  case Instruction::Call: {
+    CallSite CS(&I);
+    ThreadedCall Call;
+    Call.CS = CS;
+    Call.Callee = CS.getCalledFunction();
+    Call.FTy = cast<FunctionType>(
+      cast<PointerType>(CS.getCalledValue()->getType())->getElementType());
+    Call.CalleeSlot = Call.Callee ? NoSlot : getSlot(CS.getCalledValue());
+    Call.ArgsBegin = TF.CallArgs.size();
+    for (CallSite::arg_iterator AI = CS.arg_begin(), E = CS.arg_end();
+         AI != E; ++AI)
+      TF.CallArgs.push_back(getSlot(*AI));
+    Call.ArgsEnd = TF.CallArgs.size();
+    Call.Target = 0;
+    Call.Resolved = false;
+    TF.Calls.push_back(Call);
+    emit(OpCall, I.getType()->isVoidTy() ? NoSlot : getSlot(&I),
+         TF.Calls.size() - 1);
+    break;
+  }
+
+  case Instruction::Ret:
+    if (cast<ReturnInst>(I).getNumOperands())
+      emit(OpRet, NoSlot, getSlot(I.getOperand(0)));
+    else
+      emit(OpRetVoid, NoSlot);
+    break;
+  case Instruction::Br: {
+    BranchInst &BI = cast<BranchInst>(I);
+    if (BI.isUnconditional())
+      emit(OpBr, NoSlot, getEdge(BI.getParent(), BI.getSuccessor(0)));
+    else
+      emit(OpCondBr, NoSlot, getSlot(BI.getCondition()),
+           getEdge(BI.getParent(), BI.getSuccessor(0)),
+           getEdge(BI.getParent(), BI.getSuccessor(1)));
+    break;
+  }
+  case Instruction::Switch: {
+    SwitchInst &SI = cast<SwitchInst>(I);
+    unsigned CasesBegin = TF.Cases.size();
+    for (SwitchInst::CaseIt i = SI.case_begin(), e = SI.case_end(); i != e;
+         ++i)
+      TF.Cases.push_back(std::make_pair(i.getCaseValue()->getZExtValue(),
+                                        getEdge(SI.getParent(),
+                                                i.getCaseSuccessor())));
+    emit(OpSwitch, NoSlot, getSlot(SI.getCondition()), CasesBegin,
+         TF.Cases.size(), getEdge(SI.getParent(), SI.getDefaultDest()));
+    break;
+  }
+  case Instruction::Unreachable:
+    emit(OpUnreachable, NoSlot);
+    break;
+  }
+  return true;
+}
+
+/// toThreadedSlot - Convert a GenericValue of type Ty into a slot.
+static ThreadedSlot toThreadedSlot(const GenericValue &Val, Type *Ty) {
+  ThreadedSlot Slot;
+  Slot.I = 0;
+  switch (Ty->getTypeID()) {
+  default: llvm_unreachable("Type not supported by threaded code!");
+  case Type::IntegerTyID:
+    Slot.I = Val.IntVal.getZExtValue() &
+             getWidthMask(cast<IntegerType>(Ty)->getBitWidth());
+    break;
+  case Type::FloatTyID:   Slot.F = Val.FloatVal; break;
+  case Type::DoubleTyID:  Slot.D = Val.DoubleVal; break;
+  case Type::PointerTyID: Slot.I = uintptr_t(Val.PointerVal); break;
+  }
+  return Slot;
+}
+
+/// toGenericValue - Convert a slot holding a value of type Ty into a
+/// GenericValue.
+static GenericValue toGenericValue(ThreadedSlot Slot, Type *Ty) {
+  GenericValue Val;
+  switch (Ty->getTypeID()) {
+  default: llvm_unreachable("Type not supported by threaded code!");
+  case Type::IntegerTyID:
+    Val.IntVal = APInt(cast<IntegerType>(Ty)->getBitWidth(), Slot.I);
+    break;
+  case Type::FloatTyID:   Val.FloatVal = Slot.F; break;
+  case Type::DoubleTyID:  Val.DoubleVal = Slot.D; break;
+  case Type::PointerTyID: Val.PointerVal = (void*)uintptr_t(Slot.I); break;
+  }
+  return Val;
+}
+
+// getThreadedFunction - Return the threaded code of F, translating it on the
+// first call, or null if F is only interpreted from its IR.
+//
+ThreadedFunction *Interpreter::getThreadedFunction(Function *F) {
+  if (!UseThreadedCode || F->isDeclaration())
+    return 0;
+  DenseMap<Function*, ThreadedFunction*>::iterator I = Threaded.find(F);
+  if (I != Threaded.end())
+    return I->second;
+  ThreadedFunction *TF = translateFunction(F);
+  Threaded[F] = TF;
+  return TF;
+}
+
+// translateFunction - Translate F into threaded code, or return null if it
+// can't be.
+//
+ThreadedFunction *Interpreter::translateFunction(Function *F) {
+  // Slots are read from and written to memory in the host's layout.
+  if (!sys::isLittleEndianHost() || !TD.isLittleEndian() ||
+      TD.getPointerSize() != sizeof(void*))
+    return 0;
+
+  FunctionType *FTy = F->getFunctionType();
+  if (FTy->isVarArg() || (!FTy->getReturnType()->isVoidTy() &&
+                          !isThreadedType(FTy->getReturnType())))
+    return 0;
+  for (unsigned i = 0, e = FTy->getNumParams(); i != e; ++i)
+    if (!isThreadedType(FTy->getParamType(i)))
+      return 0;
+
+  // Lower the intrinsics now that the interpreter would lower when it got to
+  // them.
+  SmallVector<CallInst*, 8> Intrinsics;
+  for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+    for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I)
+      if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(I))
+        if (isLoweredIntrinsic(II->getIntrinsicID()))
+          Intrinsics.push_back(II);
+  for (unsigned i = 0, e = Intrinsics.size(); i != e; ++i)
+    IL->LowerIntrinsicCall(Intrinsics[i]);
+
+  OwningPtr<ThreadedFunction> TF(new ThreadedFunction(F));
+  ThreadedCodeBuilder Builder(TD, *TF);
+  if (!Builder.build())
+    return 0;
+
+  // Constants don't depend on the frame they're evaluated in.
+  ExecutionContext SF;
+  const std::vector<Constant*> &Constants = Builder.getConstants();
+  for (unsigned i = 0, e = Constants.size(); i != e; ++i)
+    TF->Constants.push_back(toThreadedSlot(getOperandValue(Constants[i], SF),
+                                           Constants[i]->getType()));
+
+  ++NumThreaded;
+  DEBUG(dbgs() << "Threaded code for " << F->getName() << ": "
+               << TF->Ops.size() << " ops, " << TF->NumSlots << " slots\n");
+  return TF.take();
+}
+
+void Interpreter::deleteThreadedFunctions() {
+  DeleteContainerSeconds(Threaded);
+}
+
+//===----------------------------------------------------------------------===//
+//                     Execution of Threaded Code
+//===----------------------------------------------------------------------===//
+
+// callThreadedFunction - Run the threaded code of a function on the arguments
+// the interpreter passes it.
+//
+GenericValue
+Interpreter::callThreadedFunction(ThreadedFunction &TF,
+                                  const std::vector<GenericValue> &ArgVals,
+                                  FunctionTier *Tier) {
+  FunctionType *FTy = TF.F->getFunctionType();
+  SmallVector<ThreadedSlot, 8> Args;
+  for (unsigned i = 0, e = TF.NumArgs; i != e; ++i)
+    Args.push_back(toThreadedSlot(ArgVals[i], FTy->getParamType(i)));
+  ThreadedSlot Result = runThreadedFunction(TF, Args.data(), Tier);
+  if (FTy->getReturnType()->isVoidTy())
+    return GenericValue();
+  return toGenericValue(Result, FTy->getReturnType());
+}
+
+// callFromThreadedCode - Call a function that has no threaded code, and run it
+// in the interpreter until it returns.
+//
+GenericValue
+Interpreter::callFromThreadedCode(Function *F,
+                                  const std::vector<GenericValue> &ArgVals) {
+  unsigned Depth = ECStack.size();
+  callFunction(F, ArgVals);
+  runUntilDepth(Depth);
+  return ExitValue;
+}
+
+static inline int64_t signExtend(uint64_t Val, unsigned Shift) {
+  return int64_t(Val << Shift) >> Shift;
+}
+
+static inline void *toPointer(ThreadedSlot Slot) {
+  return (void*)uintptr_t(Slot.I);
+}
+
+static bool executeFCmp(unsigned Predicate, double X, double Y) {
+  bool Unordered = X != X || Y != Y;
+  switch (Predicate) {
+  default: llvm_unreachable("Invalid fcmp predicate!");
+  case FCmpInst::FCMP_FALSE: return false;
+  case FCmpInst::FCMP_TRUE:  return true;
+  case FCmpInst::FCMP_ORD:   return !Unordered;
+  case FCmpInst::FCMP_UNO:   return Unordered;
+  case FCmpInst::FCMP_OEQ:   return X == Y;
+  case FCmpInst::FCMP_ONE:   return X != Y;
+  case FCmpInst::FCMP_OGT:   return X > Y;
+  case FCmpInst::FCMP_OGE:   return X >= Y;
+  case FCmpInst::FCMP_OLT:   return X < Y;
+  case FCmpInst::FCMP_OLE:   return X <= Y;
+  case FCmpInst::FCMP_UEQ:   return Unordered || X == Y;
+  case FCmpInst::FCMP_UNE:   return Unordered || X != Y;
+  case FCmpInst::FCMP_UGT:   return Unordered || X > Y;
+  case FCmpInst::FCMP_UGE:   return Unordered || X >= Y;
+  case FCmpInst::FCMP_ULT:   return Unordered || X < Y;
+  case FCmpInst::FCMP_ULE:   return Unordered || X <= Y;
+  }
+}
+
+// runThreadedFunction - Run the threaded code of a function to completion, and
+// return its result.  Calls to functions that have threaded code too are run
+// directly, unless tiered, when every call goes through callFunction.  Past
+// MaxThreadedDepth calls go through callFunction as well, which then
+// interprets the IR on the interpreter's own stack.
+//
+ThreadedSlot Interpreter::runThreadedFunction(ThreadedFunction &TF,
+                                              const ThreadedSlot *Args,
+                                              FunctionTier *Tier) {
+#ifdef THREADED_DISPATCH
+  static const void *const Handlers[] = {
+#define OP(X) LLVM_EXTENSION &&Do##X,
+    THREADED_OPS
+#undef OP
+  };
+  if (!TF.Threaded) {
+    for (unsigned i = 0, e = TF.Ops.size(); i != e; ++i)
+      TF.Ops[i].Handler = Handlers[TF.Ops[i].Opcode];
+    TF.Threaded = true;
+  }
+#define DISPATCH() LLVM_EXTENSION ({ goto *PC->Handler; })
+#define OPCODE(X) Do##X:
+#else
+#define DISPATCH() goto Dispatch
+#define OPCODE(X) case Op##X:
+#endif
+#define NEXT() do { ++PC; ++NumOps; DISPATCH(); } while (0)
+#define JUMP(EdgeIndex) do { \
+    const ThreadedEdge &Edge = TF.Edges[EdgeIndex]; \
+    for (unsigned i = Edge.MovesBegin; i != Edge.MovesEnd; ++i) \
+      Scratch[i - Edge.MovesBegin] = R[TF.Moves[i].second]; \
+    for (unsigned i = Edge.MovesBegin; i != Edge.MovesEnd; ++i) \
+      R[TF.Moves[i].first] = Scratch[i - Edge.MovesBegin]; \
+    if (Edge.Backedge && Tier && Tier->Counting) \
+      countExecution(TF.F, *Tier); \
+    PC = &TF.Ops[Edge.Target]; \
+    ++NumOps; \
+    DISPATCH(); \
+  } while (0)
+
+  SmallVector<ThreadedSlot, 32> Frame(Args, Args + TF.NumArgs);
+  Frame.resize(TF.NumArgs + TF.NumValues);
+  Frame.append(TF.Constants.begin(), TF.Constants.end());
+  Frame.resize(TF.NumSlots);
+  ThreadedSlot *R = Frame.data();
+  ThreadedSlot *Scratch = R + TF.ScratchBase;
+  SmallVector<void*, 4> Allocas;
+  ThreadedSlot Result;
+  Result.I = 0;
+  unsigned NumOps = 0;
+
+  const ThreadedOp *PC = &TF.Ops[0];
+  ++ThreadedDepth;
+  DISPATCH();
+
+#ifndef THREADED_DISPATCH
+Dispatch:
+  switch (PC->Opcode) {
+  default: llvm_unreachable("Invalid threaded op!");
+#endif
+  OPCODE(Move)  R[PC->Dest] = R[PC->A]; NEXT();
+
+  OPCODE(Add) R[PC->Dest].I = (R[PC->A].I + R[PC->B].I) & PC->Imm; NEXT();
+  OPCODE(Sub) R[PC->Dest].I = (R[PC->A].I - R[PC->B].I) & PC->Imm; NEXT();
+  OPCODE(Mul) R[PC->Dest].I = (R[PC->A].I * R[PC->B].I) & PC->Imm; NEXT();
+  OPCODE(UDiv) R[PC->Dest].I = R[PC->A].I / R[PC->B].I; NEXT();
+  // INT64_MIN / -1 traps on the host, so division by -1 negates instead, as
+  // APInt does.
+  OPCODE(SDiv) {
+    int64_t Divisor = signExtend(R[PC->B].I, PC->C);
+    if (Divisor == -1)
+      R[PC->Dest].I = (0 - R[PC->A].I) & PC->Imm;
+    else
+      R[PC->Dest].I =
+        uint64_t(signExtend(R[PC->A].I, PC->C) / Divisor) & PC->Imm;
+    NEXT();
+  }
+  OPCODE(URem) R[PC->Dest].I = R[PC->A].I % R[PC->B].I; NEXT();
+  OPCODE(SRem) {
+    int64_t Divisor = signExtend(R[PC->B].I, PC->C);
+    if (Divisor == -1)
+      R[PC->Dest].I = 0;
+    else
+      R[PC->Dest].I =
+        uint64_t(signExtend(R[PC->A].I, PC->C) % Divisor) & PC->Imm;
+    NEXT();
+  }
+  // Shifts by the width or more leave the value as it is.
+  OPCODE(Shl)
+    if (R[PC->B].I < 64 - PC->C)
+      R[PC->Dest].I = (R[PC->A].I << R[PC->B].I) & PC->Imm;
+    else
+      R[PC->Dest] = R[PC->A];
+    NEXT();
+  OPCODE(LShr)
+    if (R[PC->B].I < 64 - PC->C)
+      R[PC->Dest].I = R[PC->A].I >> R[PC->B].I;
+    else
+      R[PC->Dest] = R[PC->A];
+    NEXT();
+  OPCODE(AShr)
+    if (R[PC->B].I < 64 - PC->C)
+      R[PC->Dest].I =
+        uint64_t(signExtend(R[PC->A].I, PC->C) >> R[PC->B].I) & PC->Imm;
+    else
+      R[PC->Dest] = R[PC->A];
+    NEXT();
+  OPCODE(And) R[PC->Dest].I = R[PC->A].I & R[PC->B].I; NEXT();
+  OPCODE(Or)  R[PC->Dest].I = R[PC->A].I | R[PC->B].I; NEXT();
+  OPCODE(Xor) R[PC->Dest].I = R[PC->A].I ^ R[PC->B].I; NEXT();
+
+  OPCODE(FAddF) R[PC->Dest].F = R[PC->A].F + R[PC->B].F; NEXT();
+  OPCODE(FSubF) R[PC->Dest].F = R[PC->A].F - R[PC->B].F; NEXT();
+  OPCODE(FMulF) R[PC->Dest].F = R[PC->A].F * R[PC->B].F; NEXT();
+  OPCODE(FDivF) R[PC->Dest].F = R[PC->A].F / R[PC->B].F; NEXT();
+  OPCODE(FRemF) R[PC->Dest].F = fmod(R[PC->A].F, R[PC->B].F); NEXT();
+  OPCODE(FAddD) R[PC->Dest].D = R[PC->A].D + R[PC->B].D; NEXT();
+  OPCODE(FSubD) R[PC->Dest].D = R[PC->A].D - R[PC->B].D; NEXT();
+  OPCODE(FMulD) R[PC->Dest].D = R[PC->A].D * R[PC->B].D; NEXT();
+  OPCODE(FDivD) R[PC->Dest].D = R[PC->A].D / R[PC->B].D; NEXT();
+  OPCODE(FRemD) R[PC->Dest].D = fmod(R[PC->A].D, R[PC->B].D); NEXT();
+
+  OPCODE(ICmpEQ)  R[PC->Dest].I = R[PC->A].I == R[PC->B].I; NEXT();
+  OPCODE(ICmpNE)  R[PC->Dest].I = R[PC->A].I != R[PC->B].I; NEXT();
+  OPCODE(ICmpUGT) R[PC->Dest].I = R[PC->A].I >  R[PC->B].I; NEXT();
+  OPCODE(ICmpUGE) R[PC->Dest].I = R[PC->A].I >= R[PC->B].I; NEXT();
+  OPCODE(ICmpULT) R[PC->Dest].I = R[PC->A].I <  R[PC->B].I; NEXT();
+  OPCODE(ICmpULE) R[PC->Dest].I = R[PC->A].I <= R[PC->B].I; NEXT();
+  OPCODE(ICmpSGT)
+    R[PC->Dest].I = signExtend(R[PC->A].I, PC->C) >
+                    signExtend(R[PC->B].I, PC->C);
+    NEXT();
+  OPCODE(ICmpSGE)
+    R[PC->Dest].I = signExtend(R[PC->A].I, PC->C) >=
+                    signExtend(R[PC->B].I, PC->C);
+    NEXT();
+  OPCODE(ICmpSLT)
+    R[PC->Dest].I = signExtend(R[PC->A].I, PC->C) <
+                    signExtend(R[PC->B].I, PC->C);
+    NEXT();
+  OPCODE(ICmpSLE)
+    R[PC->Dest].I = signExtend(R[PC->A].I, PC->C) <=
+                    signExtend(R[PC->B].I, PC->C);
+    NEXT();
+  OPCODE(FCmpF)
+    R[PC->Dest].I = executeFCmp(PC->Imm, R[PC->A].F, R[PC->B].F);
+    NEXT();
+  OPCODE(FCmpD)
+    R[PC->Dest].I = executeFCmp(PC->Imm, R[PC->A].D, R[PC->B].D);
+    NEXT();
+
+  OPCODE(Trunc) R[PC->Dest].I = R[PC->A].I & PC->Imm; NEXT();
+  OPCODE(SExt)
+    R[PC->Dest].I = uint64_t(signExtend(R[PC->A].I, PC->C)) & PC->Imm;
+    NEXT();
+  OPCODE(FPTrunc) R[PC->Dest].F = float(R[PC->A].D); NEXT();
+  OPCODE(FPExt)   R[PC->Dest].D = double(R[PC->A].F); NEXT();
+  OPCODE(UIToF) R[PC->Dest].F = float(R[PC->A].I); NEXT();
+  OPCODE(SIToF) R[PC->Dest].F = float(signExtend(R[PC->A].I, PC->C)); NEXT();
+  OPCODE(UIToD) R[PC->Dest].D = double(R[PC->A].I); NEXT();
+  OPCODE(SIToD) R[PC->Dest].D = double(signExtend(R[PC->A].I, PC->C)); NEXT();
+  OPCODE(FToUI) R[PC->Dest].I = uint64_t(R[PC->A].F) & PC->Imm; NEXT();
+  OPCODE(FToSI)
+    R[PC->Dest].I = uint64_t(int64_t(R[PC->A].F)) & PC->Imm;
+    NEXT();
+  OPCODE(DToUI) R[PC->Dest].I = uint64_t(R[PC->A].D) & PC->Imm; NEXT();
+  OPCODE(DToSI)
+    R[PC->Dest].I = uint64_t(int64_t(R[PC->A].D)) & PC->Imm;
+    NEXT();
+  OPCODE(FToBits) {
+    uint32_t Bits;
+    memcpy(&Bits, &R[PC->A].F, sizeof(Bits));
+    R[PC->Dest].I = Bits;
+    NEXT();
+  }
+  OPCODE(BitsToF) {
+    uint32_t Bits = uint32_t(R[PC->A].I);
+    memcpy(&R[PC->Dest].F, &Bits, sizeof(Bits));
+    NEXT();
+  }
+
+  OPCODE(Select)
+    R[PC->Dest] = (R[PC->A].I & 1) ? R[PC->B] : R[PC->C];
+    NEXT();
+  OPCODE(Alloca) {
+    // Avoid malloc-ing zero bytes, use max()...
+    unsigned MemToAlloc = std::max(1U, unsigned(R[PC->A].I) *
+                                       unsigned(PC->Imm));
+    void *Memory = malloc(MemToAlloc);
+    assert(Memory && "Null pointer returned by malloc!");
+    Allocas.push_back(Memory);
+    R[PC->Dest].I = uintptr_t(Memory);
+    NEXT();
+  }
+  OPCODE(GEP) {
+    uint64_t Addr = R[PC->A].I + PC->Imm;
+    for (unsigned i = PC->B, e = PC->C; i != e; ++i) {
+      const ThreadedIndex &Index = TF.Indices[i];
+      Addr += uint64_t(signExtend(R[Index.Slot].I, Index.Shift) * Index.Scale);
+    }
+    R[PC->Dest].I = uintptr_t(Addr);
+    NEXT();
+  }
+
+  // Memory is accessed with memcpy, as it need not be aligned.  The low bytes
+  // of a slot hold its value.
+  OPCODE(Load1) {
+    uint8_t Val;
+    memcpy(&Val, toPointer(R[PC->A]), 1);
+    R[PC->Dest].I = Val;
+    NEXT();
+  }
+  OPCODE(Load2) {
+    uint16_t Val;
+    memcpy(&Val, toPointer(R[PC->A]), 2);
+    R[PC->Dest].I = Val;
+    NEXT();
+  }
+  OPCODE(Load4) {
+    uint32_t Val;
+    memcpy(&Val, toPointer(R[PC->A]), 4);
+    R[PC->Dest].I = Val;
+    NEXT();
+  }
+  OPCODE(Load8)
+    memcpy(&R[PC->Dest].I, toPointer(R[PC->A]), 8);
+    NEXT();
+  OPCODE(LoadN) {
+    uint64_t Val = 0;
+    memcpy(&Val, toPointer(R[PC->A]), PC->C);
+    R[PC->Dest].I = Val & PC->Imm;
+    NEXT();
+  }
+  OPCODE(Store1) {
+    uint8_t Val = uint8_t(R[PC->A].I);
+    memcpy(toPointer(R[PC->B]), &Val, 1);
+    NEXT();
+  }
+  OPCODE(Store2) {
+    uint16_t Val = uint16_t(R[PC->A].I);
+    memcpy(toPointer(R[PC->B]), &Val, 2);
+    NEXT();
+  }
+  OPCODE(Store4) {
+    uint32_t Val;
+    memcpy(&Val, &R[PC->A], 4);
+    memcpy(toPointer(R[PC->B]), &Val, 4);
+    NEXT();
+  }
+  OPCODE(Store8)
+    memcpy(toPointer(R[PC->B]), &R[PC->A].I, 8);
+    NEXT();
+  OPCODE(StoreN)
+    memcpy(toPointer(R[PC->B]), &R[PC->A].I, PC->C);
+    NEXT();
+
+  OPCODE(Call) {
+    ThreadedCall &Call = TF.Calls[PC->A];
+    Function *Callee = Call.Callee;
+    ThreadedFunction *Target = Call.Target;
+    if (!Callee) {
+      Callee = (Function*)toPointer(R[Call.CalleeSlot]);
+      Target = 0;
+      if (!TierUp && Callee->getFunctionType() == Call.FTy)
+        Target = getThreadedFunction(Callee);
+    } else if (!Call.Resolved) {
+      Call.Target = Target = TierUp ? 0 : getThreadedFunction(Callee);
+      Call.Resolved = true;
+    }
+
+    ThreadedSlot Value;
+    Value.I = 0;
+    if (Target && ThreadedDepth < MaxThreadedDepth) {
+      SmallVector<ThreadedSlot, 8> CallArgs;
+      for (unsigned i = Call.ArgsBegin, e = Call.ArgsEnd; i != e; ++i)
+        CallArgs.push_back(R[TF.CallArgs[i]]);
+      Value = runThreadedFunction(*Target, CallArgs.data(), 0);
+    } else {
+      // Anything else gets its arguments the way the interpreter passes them.
+      std::vector<GenericValue> ArgVals;
+      for (unsigned i = Call.ArgsBegin, e = Call.ArgsEnd; i != e; ++i) {
+        Type *Ty = Call.CS.getArgument(i - Call.ArgsBegin)->getType();
+        ArgVals.push_back(toGenericValue(R[TF.CallArgs[i]], Ty));
+      }
+      GenericValue Result = callFromThreadedCode(Callee, ArgVals);
+      if (PC->Dest != NoSlot)
+        Value = toThreadedSlot(Result, Call.CS.getType());
+    }
+    if (PC->Dest != NoSlot)
+      R[PC->Dest] = Value;
+    NEXT();
+  }
+
+  OPCODE(Br) JUMP(PC->A);
+  OPCODE(CondBr) JUMP((R[PC->A].I & 1) ? PC->B : PC->C);
+  OPCODE(Switch) {
+    uint64_t Cond = R[PC->A].I;
+    for (unsigned i = PC->B, e = PC->C; i != e; ++i)
+      if (TF.Cases[i].first == Cond)
+        JUMP(TF.Cases[i].second);
+    JUMP(PC->Imm);
+  }
+  OPCODE(Ret)
+    Result = R[PC->A];
+    goto Return;
+  OPCODE(RetVoid)
+    goto Return;
+  OPCODE(Unreachable)
+    report_fatal_error("Program executed an 'unreachable' instruction!");
+#ifndef THREADED_DISPATCH
+  }
+#endif
+
+#undef DISPATCH
+#undef OPCODE
+#undef NEXT
+#undef JUMP
+
+Return:
+  --ThreadedDepth;
+  for (unsigned i = 0, e = Allocas.size(); i != e; ++i)
+    free(Allocas[i]);
+  NumThreadedOps += NumOps + 1;
+  return Result;
+}
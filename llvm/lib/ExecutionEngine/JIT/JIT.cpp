@@ -568,6 +568,14 @@ void JIT::UnregisterJITEventListener(JITEventListener *L) {
     EventListeners.pop_back();
   }
 }
+
+void JIT::NotifyFunctionMaterialized(Function &F) {
+  MutexGuard locked(lock);
+  for (unsigned I = 0, S = EventListeners.size(); I < S; ++I) {
+    EventListeners[I]->NotifyFunctionMaterialized(F);
+  }
+}
+
 void JIT::NotifyFunctionEmitted(
     const Function &F,
     void *Code, size_t Size,
@@ -636,6 +644,9 @@ void JIT::runJITOnFunctionUnlocked(Function *F, const MutexGuard &locked) {
 }
 
 void JIT::jitTheFunction(Function *F, const MutexGuard &locked) {
+  // Listeners may still rewrite the function, or the rest of the module.
+  NotifyFunctionMaterialized(*F);
+
   isAlreadyCodeGenerating = true;
   jitstate->getPM(locked).run(*F);
   isAlreadyCodeGenerating = false;
@@ -0,0 +1,135 @@
+//===-- MD5.cpp - MD5 message digest --------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the MD5 message digest as described in RFC 1321.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Support/MD5.h"
+#include <cstring>
+using namespace llvm;
+
+/// The sines of 1 to 64, scaled by 2^32.
+static const uint32_t SineTable[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+/// The left rotation of each step, which repeats every four steps of a round.
+static const unsigned Shifts[4][4] = {
+  { 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 }
+};
+
+static inline uint32_t rotateLeft(uint32_t X, unsigned N) {
+  return (X << N) | (X >> (32 - N));
+}
+
+MD5::MD5()
+  : A(0x67452301), B(0xefcdab89), C(0x98badcfe), D(0x10325476), Length(0) {
+}
+
+void MD5::processBlock(const uint8_t *Block) {
+  uint32_t Words[16];
+  for (unsigned i = 0; i != 16; ++i)
+    Words[i] = uint32_t(Block[4 * i]) | uint32_t(Block[4 * i + 1]) << 8 |
+               uint32_t(Block[4 * i + 2]) << 16 |
+               uint32_t(Block[4 * i + 3]) << 24;
+
+  uint32_t a = A, b = B, c = C, d = D;
+  for (unsigned i = 0; i != 64; ++i) {
+    uint32_t F;
+    unsigned Word;
+    switch (i / 16) {
+    case 0: F = (b & c) | (~b & d); Word = i;                break;
+    case 1: F = (d & b) | (~d & c); Word = (5 * i + 1) % 16; break;
+    case 2: F = b ^ c ^ d;          Word = (3 * i + 5) % 16; break;
+    default: F = c ^ (b | ~d);      Word = (7 * i) % 16;     break;
+    }
+    uint32_t Next = b + rotateLeft(a + F + SineTable[i] + Words[Word],
+                                   Shifts[i / 16][i % 4]);
+    a = d;
+    d = c;
+    c = b;
+    b = Next;
+  }
+
+  A += a;
+  B += b;
+  C += c;
+  D += d;
+}
+
+void MD5::update(ArrayRef<uint8_t> Data) {
+  const uint8_t *Ptr = Data.begin();
+  size_t Size = Data.size();
+  unsigned Used = Length % 64;
+  Length += Size;
+
+  // Fill up a partial block first.
+  if (Used) {
+    unsigned Free = 64 - Used;
+    if (Size < Free) {
+      memcpy(Buffer + Used, Ptr, Size);
+      return;
+    }
+    memcpy(Buffer + Used, Ptr, Free);
+    processBlock(Buffer);
+    Ptr += Free;
+    Size -= Free;
+  }
+
+  for (; Size >= 64; Ptr += 64, Size -= 64)
+    processBlock(Ptr);
+  memcpy(Buffer, Ptr, Size);
+}
+
+void MD5::update(StringRef Str) {
+  update(ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(Str.data()),
+                           Str.size()));
+}
+
+void MD5::final(MD5Result &Result) {
+  // Pad with a one bit and zeros to 56 bytes mod 64, then append the length
+  // in bits.
+  uint64_t Bits = Length * 8;
+  uint8_t Padding[64] = { 0x80 };
+  unsigned Used = Length % 64;
+  update(ArrayRef<uint8_t>(Padding, Used < 56 ? 56 - Used : 120 - Used));
+  uint8_t Size[8];
+  for (unsigned i = 0; i != 8; ++i)
+    Size[i] = uint8_t(Bits >> (8 * i));
+  update(Size);
+
+  const uint32_t Words[4] = { A, B, C, D };
+  for (unsigned i = 0; i != 16; ++i)
+    Result[i] = uint8_t(Words[i / 4] >> (8 * (i % 4)));
+}
+
+void MD5::stringifyResult(const MD5Result &Result, SmallString<32> &Str) {
+  static const char Digits[] = "0123456789abcdef";
+  Str.clear();
+  for (unsigned i = 0; i != 16; ++i) {
+    Str.push_back(Digits[Result[i] >> 4]);
+    Str.push_back(Digits[Result[i] & 0xf]);
+  }
+}
@@ -14,15 +14,29 @@
 
 #define DEBUG_TYPE "CanTM"
 #include "llvm/Pass.h"
+#include "llvm/PassManager.h"
 #include "llvm/Module.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Triple.h"
 #include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
 #include "llvm/Constants.h"
 #include "llvm/Support/CFG.h"
+#include "llvm/Support/IRBuilder.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/AliasSetTracker.h"
+#include "llvm/Analysis/LibCallSemantics.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/LLVMContext.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Transforms/CanTM.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Scalar.h"
 #include <map>
 #include <queue>
 #include <vector>
@@ -51,12 +65,59 @@ STATISTIC(num_stores_compressed, "Number of Stores compressed");
 STATISTIC(aliased_total, "Number of Aliased values - Total");
 STATISTIC(aliased_to_escape, "Number of Aliased values - Escaped");
 STATISTIC(aliased_to_not_escape, "Number of Aliased values - Not escaped");
+STATISTIC(num_htm_transactions, "Number of transactions with an HTM fast path");
+STATISTIC(num_calls_pure, "Number of calls to pure library functions");
+STATISTIC(num_calls_irrevocable, "Number of calls making a transaction irrevocable");
+STATISTIC(num_calls_alloc, "Number of allocation calls rewritten");
+STATISTIC(num_calls_mem, "Number of memcpy, memmove and memset calls reserved as ranges");
+STATISTIC(num_loads_private, "Number of Loads from fresh allocations");
+STATISTIC(num_stores_private, "Number of Stores to fresh allocations");
+STATISTIC(num_redo_accesses, "Number of accesses routed through the redo log");
+STATISTIC(num_reservation_tables, "Number of reservations made from constant tables");
+STATISTIC(num_reservation_tables_partial, "Number of reservations made partly from constant tables");
+STATISTIC(num_reservation_sites_shared, "Number of reservations sharing another one's table");
+STATISTIC(num_globals_readonly, "Number of globals only read by the transaction");
+STATISTIC(num_globals_locked, "Number of globals guarded by the transaction lock");
+STATISTIC(num_snapshot_transactions, "Number of transactions reading from snapshots");
+STATISTIC(num_atomics_lowered, "Number of atomic operations subsumed by the transaction");
+STATISTIC(num_atomics_reserved, "Number of atomic read-modify-writes reserved as stores");
+
+static cl::opt<bool> EnableHTM("cantm-htm", cl::init(true),
+        cl::desc("Try small transactions as RTM hardware transactions first"));
+static cl::opt<unsigned> HTMMaxReservations("cantm-htm-max-reservations", cl::init(16),
+        cl::desc("Largest reservation count of a small transaction"));
+static cl::opt<bool> RedoLog("cantm-redo-log", cl::init(false),
+        cl::desc("Buffer transactional stores in a redo log until commit"));
+static cl::opt<unsigned> HTMRetries("cantm-htm-retries", cl::init(4),
+        cl::desc("Hardware attempts before falling back to reservations"));
+static cl::opt<bool> RunInPipeline("cantm-pipeline", cl::init(false),
+        cl::desc("Add CanTM to the end of the standard and link-time pipelines"));
+static cl::opt<bool> ReservationTables("cantm-reservation-tables", cl::init(true),
+        cl::desc("Reserve constant address sets from tables built at compile time"));
+static cl::opt<bool> Snapshots("cantm-snapshots", cl::init(true),
+        cl::desc("Begin read-only transactions as multi-version snapshot readers"));
+static cl::opt<bool> LowerAtomics("cantm-lower-atomics", cl::init(true),
+        cl::desc("Lower atomics in code only run by the transaction to plain accesses"));
+
+static const uint64_t CacheLineSize = 64;   // CANTM_LINE in the runtime
 
 namespace {
     void printVal(Value *v); 
     void printInst(Instruction *I, bool var = false); 
     void printUser(User *u); 
 
+    // The address an instruction writes to, for stores and atomic
+    // read-modify-writes
+    Value *getWrittenPointer(Instruction *I) {
+        if (StoreInst *si = dyn_cast<StoreInst>(I))
+            return si->getPointerOperand();
+        if (AtomicRMWInst *rmw = dyn_cast<AtomicRMWInst>(I))
+            return rmw->getPointerOperand();
+        if (AtomicCmpXchgInst *cx = dyn_cast<AtomicCmpXchgInst>(I))
+            return cx->getPointerOperand();
+        return 0;
+    }
+
     class LoadStore {
         private:
         std::set<Value*> loads;
@@ -234,10 +295,85 @@ namespace {
         }
     };
 
+    // Library functions that may be called inside a transaction without
+    // making it irrevocable. The math functions only write errno, which is
+    // private to the thread.
+    const LibCallFunctionInfo PureLibCalls[] = {
+        { "abs", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "labs", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "fabs", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "floor", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "ceil", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "sqrt", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "pow", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "exp", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "log", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "sin", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "cos", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "isdigit", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "isalpha", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "isspace", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "tolower", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "toupper", AliasAnalysis::NoModRef, LibCallFunctionInfo::DoesOnly, 0 },
+        { "atoi", AliasAnalysis::Ref, LibCallFunctionInfo::DoesOnly, 0 },
+        { "strlen", AliasAnalysis::Ref, LibCallFunctionInfo::DoesOnly, 0 },
+        { "strcmp", AliasAnalysis::Ref, LibCallFunctionInfo::DoesOnly, 0 },
+        { "strncmp", AliasAnalysis::Ref, LibCallFunctionInfo::DoesOnly, 0 },
+        { "strchr", AliasAnalysis::Ref, LibCallFunctionInfo::DoesOnly, 0 },
+        { "strrchr", AliasAnalysis::Ref, LibCallFunctionInfo::DoesOnly, 0 },
+        { "strstr", AliasAnalysis::Ref, LibCallFunctionInfo::DoesOnly, 0 },
+        { "memchr", AliasAnalysis::Ref, LibCallFunctionInfo::DoesOnly, 0 },
+        { "memcmp", AliasAnalysis::Ref, LibCallFunctionInfo::DoesOnly, 0 },
+        { 0, AliasAnalysis::ModRef, LibCallFunctionInfo::DoesOnly, 0 }
+    };
+
+    class CanTMLibCallInfo : public LibCallInfo {
+        public:
+        virtual const LibCallFunctionInfo *getFunctionInfoArray() const {
+            return PureLibCalls;
+        }
+    };
+
+    // Whether a call to a pure library function reads memory through its
+    // arguments (strlen, memcmp), rather than through the accessors
+    bool readsArgumentMemory(CallInst *ci) {
+        if (isa<IntrinsicInst>(ci))
+            return false;
+        for (unsigned arg_num = 0; arg_num < ci->getNumArgOperands(); ++arg_num) {
+            if (ci->getArgOperand(arg_num)->getType()->isPointerTy())
+                return true;
+        }
+        return false;
+    }
+
+    bool isAllocCall(StringRef name) {
+        return StringSwitch<bool>(name)
+            .Cases("malloc", "_Znwm", "_Znwj", "_Znam", "_Znaj", true)
+            .Case("stm_malloc", true)
+            .Default(false);
+    }
+
+    bool isFreeCall(StringRef name) {
+        return StringSwitch<bool>(name)
+            .Cases("free", "_ZdlPv", "_ZdaPv", "stm_free", true)
+            .Default(false);
+    }
+
+    bool isIOCall(StringRef name) {
+        return StringSwitch<bool>(name)
+            .Cases("printf", "fprintf", "vprintf", "vfprintf", "puts", true)
+            .Cases("fputs", "putchar", "putc", "fputc", "fwrite", true)
+            .Cases("scanf", "fscanf", "getchar", "getc", "fgetc", true)
+            .Cases("fgets", "fread", "fopen", "fclose", "fflush", true)
+            .Cases("open", "close", "read", "write", true)
+            .Default(false);
+    }
+
     // CanTM - The first implementation, without getAnalysisUsage.
     struct CanTM : public ModulePass {
         static char ID; // Pass identification, replacement for typeid
-        CanTM() : ModulePass(ID) {}
+        CanTM() : ModulePass(ID), fUnprocessedStores(false), fUnprocessedLoads(false),
+            fSharedStores(false), fPureReads(false), fTxLock(0), tx(0) {}
 
         void analyizeBB(BasicBlock *bb, AliasSetTracker* aliasTracker);
         void getLoadsStores(BasicBlock *bb, std::set<Value*> &loads, std::set<Value*> &stores);
@@ -246,6 +382,50 @@ namespace {
         bool computeEscape(Value *v);
         void updateEscapability(Value *v, bool escapable);
         bool insertAlias(Value *from, Value *to);
+        void insertTxBoundaries(Module &M, Function *f, unsigned num_reserved, bool lazy, bool snapshot);
+        unsigned redoAccessBits(Instruction *I);
+        bool rewriteAccesses(Module &M, std::vector<Instruction *> &accesses);
+        bool rewriteRedoAccesses(Module &M);
+        bool rewriteSnapshotReads(Module &M);
+        Constant *createReservationSite(Module &M, std::vector<Value *> &addrs, unsigned numLoads, unsigned numStores);
+        void sortReservationTable(Module &M, std::vector<Value *> &addrs);
+        std::map<Value *, unsigned> fGlobalOrder;
+        std::map<std::pair<unsigned, std::vector<Value *> >, Constant *> fSites;
+        std::vector<Instruction *> fRedoAccesses;
+        bool fUnprocessedStores;
+        bool fUnprocessedLoads;
+        bool fSharedStores;
+        bool fPureReads;
+
+        enum CallKind {
+            InternalCall,   // Body is in this module and gets instrumented
+            PureCall,       // Library function without side effects
+            ExternalCall,   // Body is elsewhere, effects unknown
+            IndirectCall,   // Callee unknown
+            IOCall,         // Effects can't be rolled back
+            AllocCall,      // malloc and operator new
+            FreeCall,       // free and operator delete
+            MemCall         // memcpy, memmove and memset intrinsics
+        };
+        CallKind classifyCall(CallInst *ci);
+        bool isFreshAllocation(Value *v);
+        void rewriteAllocations(Module &M);
+        std::vector<CallInst *> fAllocCalls;
+        bool isPrivateRange(Value *v);
+        void analyzeMemIntrinsic(MemIntrinsic *mi);
+        unsigned reserveRanges(Module &M);
+        std::vector<MemIntrinsic *> fRanges;
+        CanTMLibCallInfo LCI;
+        std::set<BasicBlock *> fIrrevocableBlocks;
+
+        void computeTxOnlyFunctions(Module &M);
+        void lowerAtomics();
+        bool isTxOnlyAccess(Value *v, bool &stored);
+        void analyzeGlobals(Module &M);
+        std::set<Function *> fTxOnly;
+        std::set<Value *> fReadOnlyGlobals;
+        std::set<Value *> fLockedGlobals;
+        GlobalVariable *fTxLock;
         std::map<BasicBlock *, LoadStore> bbMap;
         std::map<Function *, AliasSetTracker *> aliasMap;
         std::map<Value *, bool> fCanEscape;
@@ -261,9 +441,12 @@ namespace {
         }
 
 
-        Function *stm_reserve;
+        Constant *stm_reserve;
+        Constant *stm_reserve_site;
+        Constant *stm_reserve_partial;
         Function *tx;
         AliasAnalysis *AA;
+        TargetData *TD;
     };
 }
 
@@ -277,6 +460,33 @@ INITIALIZE_AG_DEPENDENCY(AliasAnalysis)
     INITIALIZE_PASS_END(CanTM, "CanTM", CanTM_name, false, false)
 #endif
 
+ModulePass *llvm::createCanTMPass() {
+    return new CanTM();
+}
+
+bool llvm::isCanTMTransaction(const Function *F) {
+    StringRef name = F->getName();
+    return name.find("foo") != StringRef::npos ||
+           name.find("tx") != StringRef::npos;
+}
+
+// With -cantm-pipeline, run CanTM at the end of the standard pipelines
+// (clang -O, opt -O, LTO) and clean up the inserted calls after it
+static void addCanTMPass(const PassManagerBuilder &Builder, PassManagerBase &PM) {
+    if (!RunInPipeline)
+        return;
+    PM.add(new CanTM());
+    if (Builder.OptLevel == 0)
+        return;
+    PM.add(createInstructionCombiningPass());
+    PM.add(createCFGSimplificationPass());
+    PM.add(createGVNPass());
+}
+
+static RegisterStandardPasses RegisterCanTM(PassManagerBuilder::EP_OptimizerLast, addCanTMPass);
+static RegisterStandardPasses RegisterCanTMO0(PassManagerBuilder::EP_EnabledOnOptLevel0, addCanTMPass);
+static RegisterStandardPasses RegisterCanTMLTO(PassManagerBuilder::EP_LinkTimeOptimizerLast, addCanTMPass);
+
     namespace {
         void printVal(Value *v) {
             errs() << "Defining (";
@@ -422,12 +632,21 @@ void CanTM::analyizeBB(BasicBlock *bb, AliasSetTracker* aliasTracker) {
             //if (!computeEscape(li->getPointerOperand())) {
             //}
             ++num_loads;
-            if (li->getPointerOperand()->hasName()) {
+            if (isFreshAllocation(li->getPointerOperand()) ||
+                fReadOnlyGlobals.count(li->getPointerOperand())) {
+                ++num_loads_private;
+            } else if (fLockedGlobals.count(li->getPointerOperand())) {
+                ++num_loads_private;
+                ls.insertStore(fTxLock);
+                fRedoAccesses.push_back(li);
+            } else if (li->getPointerOperand()->hasName()) {
                 if (!ls.insertLoad(li->getPointerOperand())) {
                     ++num_loads_skipped;
                 }
+                fRedoAccesses.push_back(li);
             } else {
                 ++num_loads_unprocessed;
+                fUnprocessedLoads = true;
             }
 
             AliasSet* as = aliasTracker->getAliasSetForPointerIfExists(li, AA->getTypeStoreSize(li->getType()), li->getMetadata(LLVMContext::MD_tbaa));
@@ -440,11 +659,18 @@ void CanTM::analyizeBB(BasicBlock *bb, AliasSetTracker* aliasTracker) {
                 printVal(li);
                 errs() << ") has NO alias set\n";
             }
-        } else if (StoreInst *si = dyn_cast<StoreInst>(&*instr_i)) {
+        } else if (Value *pointerOp = getWrittenPointer(&*instr_i)) {
+            // Read-modify-writes left in shared code stay atomic, but are
+            // reserved like stores, which also covers what they read
+            Instruction *si = &*instr_i;
             ++num_stores;
-            auto valueOp = si->getValueOperand();
-            auto pointerOp = si->getPointerOperand();
-            if (pointerOp->hasName()) {
+            if (!isa<StoreInst>(si))
+                ++num_atomics_reserved;
+            if (!isa<AllocaInst>(GetUnderlyingObject(pointerOp)))
+                fSharedStores = true;
+            if (isFreshAllocation(pointerOp)) {
+                ++num_stores_private;
+            } else if (pointerOp->hasName()) {
                 //if (!computeEscape(pointerOp)) {
                 //}
                 /*
@@ -452,17 +678,27 @@ void CanTM::analyizeBB(BasicBlock *bb, AliasSetTracker* aliasTracker) {
                    ls.insertAlias()
                    ++num_stores_aliased;
                    }*/
+                if (fLockedGlobals.count(pointerOp))
+                    ls.insertStore(fTxLock);
                 if (!ls.insertStore(pointerOp)) {
                     ++num_stores_skipped;
                 }
+                fRedoAccesses.push_back(si);
             } else {
                 ++num_stores_unprocessed;
+                fUnprocessedStores = true;
             }
         } else if (CallInst *ci = dyn_cast<CallInst>(&*instr_i)) {
             if (instr_i != bb->begin()) {
-                analyizeBB(bb->splitBasicBlock(instr_i), aliasTracker);
+                bb->splitBasicBlock(instr_i);
             } else {
+                CallKind kind = classifyCall(ci);
                 for (unsigned arg_num = 0; arg_num < ci->getNumArgOperands(); ++arg_num) {
+                    if (kind == AllocCall || kind == FreeCall || kind == MemCall)
+                        break;
+                    // Only pointers are addresses the callee may load from
+                    if (!ci->getArgOperand(arg_num)->getType()->isPointerTy())
+                        continue;
                     ++num_loads;
                     ++num_loads_from_function_call;
                     if (ci->getArgOperand(arg_num)->hasName()) {
@@ -473,16 +709,41 @@ void CanTM::analyizeBB(BasicBlock *bb, AliasSetTracker* aliasTracker) {
                         ++num_loads_unprocessed;
                     }
                 }
-                fFunctionBlocks.insert(bb);
                 Function* called = ci->getCalledFunction();
-                auto it = fAdded.find(called);
-                if (it == fAdded.end()) {
-                    fQueue.push(called);
-                    fAdded.insert(called);
+                switch (kind) {
+                case InternalCall: {
+                    fFunctionBlocks.insert(bb);
+                    auto it = fAdded.find(called);
+                    if (it == fAdded.end()) {
+                        fQueue.push(called);
+                        fAdded.insert(called);
+                    }
+                    break;
+                }
+                case PureCall:
+                    ++num_calls_pure;
+                    if (readsArgumentMemory(ci))
+                        fPureReads = true;
+                    break;
+                case ExternalCall:
+                case IndirectCall:
+                case IOCall:
+                    DEBUG(dbgs() << "Irrevocable call\n");
+                    ++num_calls_irrevocable;
+                    fIrrevocableBlocks.insert(bb);
+                    break;
+                case AllocCall:
+                case FreeCall:
+                    ++num_calls_alloc;
+                    fAllocCalls.push_back(ci);
+                    break;
+                case MemCall:
+                    analyzeMemIntrinsic(cast<MemIntrinsic>(ci));
+                    break;
                 }
                 ++instr_i;
                 if (instr_i != instr_e)
-                    analyizeBB(bb->splitBasicBlock(instr_i), aliasTracker);
+                    bb->splitBasicBlock(instr_i);
             }
             break;
         } else if (AllocaInst *ai = dyn_cast<AllocaInst>(&*instr_i)) {
@@ -498,7 +759,7 @@ void CanTM::analyizeBB(BasicBlock *bb, AliasSetTracker* aliasTracker) {
             }
             ++instr_i;
             if (instr_i != instr_e)
-                analyizeBB(bb->splitBasicBlock(instr_i), aliasTracker);
+                bb->splitBasicBlock(instr_i);
             break;
         }
         errs() << "\n";
@@ -511,6 +772,470 @@ void CanTM::analyizeBB(BasicBlock *bb, AliasSetTracker* aliasTracker) {
     }
 }
 
+CanTM::CallKind CanTM::classifyCall(CallInst *ci) {
+    Function *called = ci->getCalledFunction();
+    if (!called)
+        return IndirectCall;
+    if (isa<MemIntrinsic>(ci))
+        return MemCall;
+    // The remaining intrinsics (lifetime markers, debug info, arithmetic)
+    // are expanded inline by the code generator, not calls to unknown code
+    if (called->isIntrinsic())
+        return PureCall;
+    if (isIOCall(called->getName()))
+        return IOCall;
+    if (isAllocCall(called->getName()))
+        return AllocCall;
+    if (isFreeCall(called->getName()))
+        return FreeCall;
+    if (!called->isDeclaration())
+        return InternalCall;
+    if (const LibCallFunctionInfo *info = LCI.getFunctionInfo(called)) {
+        if (!(info->UniversalBehavior & AliasAnalysis::Mod))
+            return PureCall;
+    } else if (AA->onlyReadsMemory(called)) {
+        return PureCall;
+    }
+    return ExternalCall;
+}
+
+// Functions that only ever run inside the transaction: the root, and the
+// internal functions whose every use is a direct call from one of those
+void CanTM::computeTxOnlyFunctions(Module &M) {
+    fTxOnly.insert(tx);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto i = M.begin(), ie = M.end(); i != ie; ++i) {
+            Function *f = i;
+            if (fTxOnly.count(f) || f->isDeclaration() || !f->hasLocalLinkage())
+                continue;
+            bool txOnly = !f->use_empty();
+            for (auto ui = f->use_begin(), ue = f->use_end(); txOnly && ui != ue; ++ui) {
+                CallInst *ci = dyn_cast<CallInst>(*ui);
+                txOnly = ci && ci->getCalledValue() == f &&
+                    fTxOnly.count(ci->getParent()->getParent());
+            }
+            if (txOnly) {
+                fTxOnly.insert(f);
+                changed = true;
+            }
+        }
+    }
+}
+
+// Whether every use of v is a load or store through it in a function that
+// only runs inside the transaction. Sets stored if one of them writes it.
+bool CanTM::isTxOnlyAccess(Value *v, bool &stored) {
+    for (auto ui = v->use_begin(), ue = v->use_end(); ui != ue; ++ui) {
+        if (LoadInst *li = dyn_cast<LoadInst>(*ui)) {
+            if (!li->isSimple() || !fTxOnly.count(li->getParent()->getParent()))
+                return false;
+        } else if (StoreInst *si = dyn_cast<StoreInst>(*ui)) {
+            if (si->getValueOperand() == v || !si->isSimple() ||
+                !fTxOnly.count(si->getParent()->getParent()))
+                return false;
+            stored = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Code that only runs inside the transaction has its accesses reserved, so
+// other transactions can't see them half done and atomics are unnecessary.
+// Lower them to plain loads and stores as LowerAtomic does; the pass then
+// reserves those like any others, and they can go through the redo log.
+// Fences go away altogether.
+void CanTM::lowerAtomics() {
+    if (!LowerAtomics)
+        return;
+    std::vector<Instruction *> atomics;
+    for (auto fi = fTxOnly.begin(), fe = fTxOnly.end(); fi != fe; ++fi) {
+        for (auto bi = (*fi)->begin(), be = (*fi)->end(); bi != be; ++bi) {
+            for (auto ii = bi->begin(), ie = bi->end(); ii != ie; ++ii) {
+                if (isa<FenceInst>(ii) || isa<AtomicRMWInst>(ii) || isa<AtomicCmpXchgInst>(ii))
+                    atomics.push_back(ii);
+                else if (LoadInst *li = dyn_cast<LoadInst>(ii)) {
+                    if (li->isAtomic())
+                        atomics.push_back(li);
+                } else if (StoreInst *si = dyn_cast<StoreInst>(ii)) {
+                    if (si->isAtomic())
+                        atomics.push_back(si);
+                }
+            }
+        }
+    }
+
+    for (auto it = atomics.begin(), it_end = atomics.end(); it != it_end; ++it) {
+        Instruction *I = *it;
+        ++num_atomics_lowered;
+        if (LoadInst *li = dyn_cast<LoadInst>(I)) {
+            li->setAtomic(NotAtomic);
+            continue;
+        }
+        if (StoreInst *si = dyn_cast<StoreInst>(I)) {
+            si->setAtomic(NotAtomic);
+            continue;
+        }
+        if (isa<FenceInst>(I)) {
+            I->eraseFromParent();
+            continue;
+        }
+
+        IRBuilder<> Builder(I);
+        Value *ptr = getWrittenPointer(I);
+        LoadInst *orig = Builder.CreateLoad(ptr);
+        Value *res;
+        if (AtomicCmpXchgInst *cx = dyn_cast<AtomicCmpXchgInst>(I)) {
+            orig->setVolatile(cx->isVolatile());
+            Value *equal = Builder.CreateICmpEQ(orig, cx->getCompareOperand());
+            res = Builder.CreateSelect(equal, cx->getNewValOperand(), orig);
+        } else {
+            AtomicRMWInst *rmw = cast<AtomicRMWInst>(I);
+            Value *val = rmw->getValOperand();
+            orig->setVolatile(rmw->isVolatile());
+            switch (rmw->getOperation()) {
+            case AtomicRMWInst::Xchg: res = val; break;
+            case AtomicRMWInst::Add: res = Builder.CreateAdd(orig, val); break;
+            case AtomicRMWInst::Sub: res = Builder.CreateSub(orig, val); break;
+            case AtomicRMWInst::And: res = Builder.CreateAnd(orig, val); break;
+            case AtomicRMWInst::Nand: res = Builder.CreateNot(Builder.CreateAnd(orig, val)); break;
+            case AtomicRMWInst::Or: res = Builder.CreateOr(orig, val); break;
+            case AtomicRMWInst::Xor: res = Builder.CreateXor(orig, val); break;
+            case AtomicRMWInst::Max:
+                res = Builder.CreateSelect(Builder.CreateICmpSLT(orig, val), val, orig);
+                break;
+            case AtomicRMWInst::Min:
+                res = Builder.CreateSelect(Builder.CreateICmpSLT(orig, val), orig, val);
+                break;
+            case AtomicRMWInst::UMax:
+                res = Builder.CreateSelect(Builder.CreateICmpULT(orig, val), val, orig);
+                break;
+            case AtomicRMWInst::UMin:
+                res = Builder.CreateSelect(Builder.CreateICmpULT(orig, val), orig, val);
+                break;
+            default: llvm_unreachable("Unexpected RMW operation");
+            }
+        }
+        StoreInst *store = Builder.CreateStore(res, ptr);
+        store->setVolatile(orig->isVolatile());
+        I->replaceAllUsesWith(orig);
+        I->eraseFromParent();
+    }
+}
+
+// Globals nobody outside the transaction can touch don't need an ownership
+// record of their own. If the transaction only reads one, it holds its
+// initial value forever and needs no reservation at all. If it also writes
+// one, the only conflicts left are with other instances of the same
+// transaction, so reading it reserves a single per-transaction lock
+// instead; stores still reserve their own record, which keeps them in the
+// undo log. Everything else may be shared and stays escapable.
+void CanTM::analyzeGlobals(Module &M) {
+    for (Module::global_iterator G = M.global_begin(), E = M.global_end();
+        G != E; ++G) {
+        bool stored = false;
+        if (G->isConstant()) {
+            fReadOnlyGlobals.insert(G);
+        } else if (!G->hasLocalLinkage() || !isTxOnlyAccess(G, stored)) {
+            updateEscapability(G, true);
+            continue;
+        } else if (stored) {
+            ++num_globals_locked;
+            fLockedGlobals.insert(G);
+        } else {
+            ++num_globals_readonly;
+            fReadOnlyGlobals.insert(G);
+        }
+        updateEscapability(G, false);
+    }
+
+    if (!fLockedGlobals.empty()) {
+        Type *i8Ptr = Type::getInt8PtrTy(M.getContext());
+        fTxLock = new GlobalVariable(M, i8Ptr, false, GlobalValue::PrivateLinkage,
+                Constant::getNullValue(i8Ptr), "cantm.lock." + tx->getName());
+    }
+}
+
+// Memory allocated inside the transaction is private to it until commit, so
+// accesses to it need no reservation.
+bool CanTM::isFreshAllocation(Value *v) {
+    if (CallInst *ci = dyn_cast<CallInst>(GetUnderlyingObject(v))) {
+        CallKind kind = classifyCall(ci);
+        return kind == AllocCall;
+    }
+    return false;
+}
+
+// Memory the transaction allocated itself, on its stack or with malloc, and
+// constants need no reservation
+bool CanTM::isPrivateRange(Value *v) {
+    Value *object = GetUnderlyingObject(v);
+    return isa<AllocaInst>(object) || isFreshAllocation(v) ||
+        fReadOnlyGlobals.count(object);
+}
+
+// Struct copies and initializations turn into memcpy, memmove and memset.
+// Their source is read and their destination written as a whole, so they
+// are reserved as ranges of known length rather than as calls. They write
+// memory behind the accessors' back, so transactions with them keep the
+// undo log and don't read from snapshots.
+void CanTM::analyzeMemIntrinsic(MemIntrinsic *mi) {
+    bool sharedSource = false;
+    if (MemTransferInst *mt = dyn_cast<MemTransferInst>(mi))
+        sharedSource = !isPrivateRange(mt->getSource());
+    bool sharedDest = !isPrivateRange(mi->getDest());
+    if (!sharedSource && !sharedDest)
+        return;
+    ++num_calls_mem;
+    if (sharedDest)
+        fSharedStores = true;
+    fRanges.push_back(mi);
+}
+
+// Reserve the shared ranges of every memory intrinsic right before it, with
+// stm_reserve_ranges. Returns the number of reservations this amounts to, or
+// more than fit in a hardware transaction if a length isn't known.
+unsigned CanTM::reserveRanges(Module &M) {
+    LLVMContext &C = M.getContext();
+    Type *i8Ptr = Type::getInt8PtrTy(C);
+    Type *i32 = Type::getInt32Ty(C);
+    Type *intPtr = TD ? TD->getIntPtrType(C) : Type::getInt64Ty(C);
+    Constant *stm_reserve_ranges = M.getOrInsertFunction("stm_reserve_ranges",
+            FunctionType::get(Type::getVoidTy(C), i32, true));
+
+    unsigned num_reserved = 0;
+    for (auto it = fRanges.begin(), it_end = fRanges.end(); it != it_end; ++it) {
+        MemIntrinsic *mi = *it;
+        Value *len = CastInst::CreateIntegerCast(mi->getLength(), intPtr, false, "", mi);
+        std::vector<Value *> reads, writes;
+        if (MemTransferInst *mt = dyn_cast<MemTransferInst>(mi)) {
+            if (!isPrivateRange(mt->getSource()))
+                reads.push_back(new BitCastInst(mt->getSource(), i8Ptr, "", mi));
+        }
+        if (!isPrivateRange(mi->getDest()))
+            writes.push_back(new BitCastInst(mi->getDest(), i8Ptr, "", mi));
+
+        std::vector<Value *> args;
+        args.push_back(ConstantInt::get(i32, 2 + 2 * (reads.size() + writes.size())));
+        args.push_back(ConstantInt::get(i32, reads.size()));
+        for (auto r = reads.begin(), re = reads.end(); r != re; ++r) {
+            args.push_back(*r);
+            args.push_back(len);
+        }
+        args.push_back(ConstantInt::get(i32, writes.size()));
+        for (auto w = writes.begin(), we = writes.end(); w != we; ++w) {
+            args.push_back(*w);
+            args.push_back(len);
+        }
+        CallInst::Create(stm_reserve_ranges, args, "", mi);
+
+        if (ConstantInt *n = dyn_cast<ConstantInt>(mi->getLength()))
+            num_reserved += (reads.size() + writes.size()) *
+                ((n->getZExtValue() + CacheLineSize - 1) / CacheLineSize + 1);
+        else
+            num_reserved += HTMMaxReservations + 1;
+    }
+    return num_reserved;
+}
+
+// Route allocations in transactional code through the runtime, which defers
+// frees until commit and releases allocations on abort
+void CanTM::rewriteAllocations(Module &M) {
+    for (auto it = fAllocCalls.begin(), it_end = fAllocCalls.end(); it != it_end; ++it) {
+        CallInst *ci = *it;
+        const char *name = classifyCall(ci) == AllocCall ? "stm_malloc" : "stm_free";
+        ci->setCalledFunction(M.getOrInsertFunction(name, ci->getCalledFunction()->getFunctionType()));
+    }
+}
+
+// Width of the runtime accessor that can carry the load or store, or 0
+unsigned CanTM::redoAccessBits(Instruction *I) {
+    Type *ty;
+    if (LoadInst *li = dyn_cast<LoadInst>(I)) {
+        if (!li->isSimple())
+            return 0;
+        ty = li->getType();
+    } else if (StoreInst *si = dyn_cast<StoreInst>(I)) {
+        if (!si->isSimple())
+            return 0;
+        ty = si->getValueOperand()->getType();
+    } else {
+        return 0;
+    }
+
+    unsigned bits = 0;
+    if (ty->isIntegerTy() || ty->isFloatingPointTy())
+        bits = ty->getPrimitiveSizeInBits();
+    else if (ty->isPointerTy() && TD)
+        bits = TD->getPointerSizeInBits();
+    return (bits == 8 || bits == 16 || bits == 32 || bits == 64) ? bits : 0;
+}
+
+// Route the loads and stores in accesses through the runtime's sized
+// accessors. Nothing is rewritten unless all of them can be.
+bool CanTM::rewriteAccesses(Module &M, std::vector<Instruction *> &accesses) {
+    for (auto it = accesses.begin(), it_end = accesses.end(); it != it_end; ++it) {
+        if (!redoAccessBits(*it))
+            return false;
+    }
+
+    LLVMContext &C = M.getContext();
+    Type *i8Ptr = Type::getInt8PtrTy(C);
+    for (auto it = accesses.begin(), it_end = accesses.end(); it != it_end; ++it) {
+        Instruction *I = *it;
+        unsigned bits = redoAccessBits(I);
+        IntegerType *intTy = IntegerType::get(C, bits);
+        if (LoadInst *li = dyn_cast<LoadInst>(I)) {
+            Type *ty = li->getType();
+            Constant *load = M.getOrInsertFunction("stm_load" + utostr(bits), intTy, i8Ptr, NULL);
+            Value *addr = new BitCastInst(li->getPointerOperand(), i8Ptr, "", li);
+            Value *v = CallInst::Create(load, addr, "", li);
+            if (ty->isPointerTy())
+                v = new IntToPtrInst(v, ty, "", li);
+            else if (ty->isFloatingPointTy())
+                v = new BitCastInst(v, ty, "", li);
+            v->takeName(li);
+            li->replaceAllUsesWith(v);
+            li->eraseFromParent();
+        } else {
+            StoreInst *si = cast<StoreInst>(I);
+            Value *v = si->getValueOperand();
+            Constant *store = M.getOrInsertFunction("stm_store" + utostr(bits), Type::getVoidTy(C), intTy, i8Ptr, NULL);
+            if (v->getType()->isPointerTy())
+                v = new PtrToIntInst(v, intTy, "", si);
+            else if (v->getType()->isFloatingPointTy())
+                v = new BitCastInst(v, intTy, "", si);
+            Value *addr = new BitCastInst(si->getPointerOperand(), i8Ptr, "", si);
+            Value *args[] = { v, addr };
+            CallInst::Create(store, args, "", si);
+            si->eraseFromParent();
+        }
+    }
+    return true;
+}
+
+// Route every reserved access through the accessors, so that the transaction
+// can buffer its stores in a redo log. Stores that are left in place would
+// not be undone on abort, and loads left in place would miss the buffered
+// stores, so give up (and keep the undo log) unless every access can be
+// rewritten. Library calls reading through their arguments miss them too.
+bool CanTM::rewriteRedoAccesses(Module &M) {
+    if (fUnprocessedStores || fUnprocessedLoads || fPureReads || !fRanges.empty() ||
+        !rewriteAccesses(M, fRedoAccesses))
+        return false;
+    num_redo_accesses += fRedoAccesses.size();
+    return true;
+}
+
+// A transaction that only stores to its own stack can run as a snapshot
+// reader, which needs no reservations: its loads go through the accessors,
+// which read the version of memory current when the transaction began.
+// Loads the pass couldn't name, library calls reading current memory through
+// their arguments, calls to unknown code and allocations all disqualify it.
+bool CanTM::rewriteSnapshotReads(Module &M) {
+    if (fSharedStores || fUnprocessedStores || fUnprocessedLoads || fPureReads ||
+        !fIrrevocableBlocks.empty() || !fAllocCalls.empty() || !fRanges.empty())
+        return false;
+
+    std::vector<Instruction *> reads;
+    for (auto it = fRedoAccesses.begin(), it_end = fRedoAccesses.end(); it != it_end; ++it) {
+        LoadInst *li = dyn_cast<LoadInst>(*it);
+        if (li && !isa<AllocaInst>(GetUnderlyingObject(li->getPointerOperand())))
+            reads.push_back(li);
+    }
+    if (!rewriteAccesses(M, reads))
+        return false;
+    ++num_snapshot_transactions;
+    return true;
+}
+
+// The globals a block reserves form an address set that is fixed once the
+// program is loaded. Describe it with a private table of the addresses,
+// loads first, and a site record the runtime reserves from; the
+// runtime hashes and sorts the set on first use and caches the result in
+// the record, so later executions don't rebuild the argument list.
+//
+// Blocks reserving the same set share one site, and with it the plan.
+Constant *CanTM::createReservationSite(Module &M, std::vector<Value *> &addrs, unsigned numLoads, unsigned numStores) {
+    LLVMContext &C = M.getContext();
+    Type *i8Ptr = Type::getInt8PtrTy(C);
+    Type *i32 = Type::getInt32Ty(C);
+
+    Constant *&shared = fSites[std::make_pair(numLoads, addrs)];
+    if (shared) {
+        ++num_reservation_sites_shared;
+        return shared;
+    }
+
+    std::vector<Constant *> elts;
+    for (auto it = addrs.begin(), it_end = addrs.end(); it != it_end; ++it)
+        elts.push_back(ConstantExpr::getBitCast(cast<Constant>(*it), i8Ptr));
+    ArrayType *tableTy = ArrayType::get(i8Ptr, elts.size());
+    GlobalVariable *table = new GlobalVariable(M, tableTy, true,
+            GlobalValue::PrivateLinkage, ConstantArray::get(tableTy, elts),
+            "cantm.reservations");
+    table->setUnnamedAddr(true);
+
+    Constant *zero = ConstantInt::get(i32, 0);
+    Constant *indices[] = { zero, zero };
+    Constant *fields[] = {
+        ConstantInt::get(i32, numLoads),
+        ConstantInt::get(i32, numStores),
+        ConstantExpr::getInBoundsGetElementPtr(table, indices),
+        Constant::getNullValue(i8Ptr)   // Filled in by the runtime
+    };
+    Constant *init = ConstantStruct::getAnon(fields);
+    GlobalVariable *site = new GlobalVariable(M, init->getType(), false,
+            GlobalValue::PrivateLinkage, init, "cantm.site");
+    shared = ConstantExpr::getBitCast(site, i8Ptr);
+    return shared;
+}
+
+// Whether an address is the same in every thread, so that it can go in a
+// static reservation table. A thread-local global, or a constant expression
+// built on one, is a different address in each thread
+static bool isStaticAddress(Value *v) {
+    if (GlobalVariable *gv = dyn_cast<GlobalVariable>(v))
+        return !gv->isThreadLocal();
+    if (GlobalAlias *ga = dyn_cast<GlobalAlias>(v))
+        return isStaticAddress(ga->getAliasee());
+    Constant *c = dyn_cast<Constant>(v);
+    if (!c)
+        return false;
+    for (unsigned i = 0, e = c->getNumOperands(); i != e; ++i)
+        if (!isStaticAddress(c->getOperand(i)))
+            return false;
+    return true;
+}
+
+// Put constant addresses in canonical order: by the definition order of the
+// global each points into, then by offset. The loads and stores of a block
+// come out of pointer-keyed sets, so this is what makes equal sets produce
+// equal tables. Globals tend to be laid out in that order, too.
+void CanTM::sortReservationTable(Module &M, std::vector<Value *> &addrs) {
+    if (fGlobalOrder.empty()) {
+        unsigned index = 0;
+        for (auto G = M.global_begin(), E = M.global_end(); G != E; ++G)
+            fGlobalOrder[G] = index++;
+    }
+
+    std::vector<std::pair<std::pair<unsigned, int64_t>, Value *> > keyed;
+    for (auto it = addrs.begin(), it_end = addrs.end(); it != it_end; ++it) {
+        int64_t offset = 0;
+        Value *base = TD ? GetPointerBaseWithConstantOffset(*it, offset, *TD)
+                         : (*it)->stripPointerCasts();
+        auto order = fGlobalOrder.find(base);
+        unsigned index = order == fGlobalOrder.end() ? ~0U : order->second;
+        keyed.push_back(std::make_pair(std::make_pair(index, offset), *it));
+    }
+    std::stable_sort(keyed.begin(), keyed.end());
+    for (unsigned i = 0; i != keyed.size(); ++i)
+        addrs[i] = keyed[i].second;
+}
+
 void CanTM::getLoadsStores(BasicBlock *bb, std::set<Value*> &loads, std::set<Value*> &stores) {
     errs() << "Compressing BB (begin): " << bb << "\n";
     for (pred_iterator pi = pred_begin(bb), pi_e = pred_end(bb); pi != pi_e; ++pi) {
@@ -604,38 +1329,98 @@ void CanTM::compressFunction(Function *f, std::set<unsigned> &reservedLoads, std
     getLoadsStores(bb, loads, stores);
 }
 
+// Bracket the root transaction with stm_begin/stm_commit. The checkpoint
+// returned by stm_begin is armed with _setjmp, so that the runtime's
+// contention manager can roll the transaction back and restart it.
+//
+// Small transactions on x86 begin with stm_begin_htm instead, which runs
+// them as RTM hardware transactions while that keeps succeeding. The same
+// body serves both paths: under HTM the reservations only check the
+// ownership records. Whether the processor has RTM is decided by the
+// runtime, so the binary still runs on hosts without it. Read-only
+// transactions begin with stm_begin_snapshot, which the runtime treats as
+// stm_begin unless multi-version snapshots are enabled.
+void CanTM::insertTxBoundaries(Module &M, Function *f, unsigned num_reserved, bool lazy, bool snapshot) {
+    LLVMContext &C = M.getContext();
+    Type *i8Ptr = Type::getInt8PtrTy(C);
+    Type *i32 = Type::getInt32Ty(C);
+    Constant *stm_commit = M.getOrInsertFunction("stm_commit", Type::getVoidTy(C), NULL);
+    Constant *setjmp = M.getOrInsertFunction("_setjmp", i32, i8Ptr, NULL);
+
+    Triple T(M.getTargetTriple());
+    bool htm = !snapshot && EnableHTM && num_reserved <= HTMMaxReservations &&
+        fIrrevocableBlocks.empty() &&
+        (T.getArch() == Triple::x86 || T.getArch() == Triple::x86_64);
+
+    Instruction *InsertPos = f->getEntryBlock().begin();
+    CallInst *checkpoint;
+    if (snapshot) {
+        Constant *stm_begin_snapshot = M.getOrInsertFunction("stm_begin_snapshot", i8Ptr, NULL);
+        checkpoint = CallInst::Create(stm_begin_snapshot, "checkpoint", InsertPos);
+    } else if (htm) {
+        ++num_htm_transactions;
+        Constant *stm_begin_htm = M.getOrInsertFunction("stm_begin_htm", i8Ptr, i32, NULL);
+        checkpoint = CallInst::Create(stm_begin_htm, ConstantInt::get(i32, HTMRetries), "checkpoint", InsertPos);
+    } else {
+        Constant *stm_begin = M.getOrInsertFunction("stm_begin", i8Ptr, NULL);
+        checkpoint = CallInst::Create(stm_begin, "checkpoint", InsertPos);
+    }
+    CallInst *arm = CallInst::Create(setjmp, checkpoint, "", InsertPos);
+    arm->addAttribute(~0U, Attribute::ReturnsTwice);
+    if (lazy) {
+        Constant *stm_redo_log = M.getOrInsertFunction("stm_redo_log", Type::getVoidTy(C), NULL);
+        CallInst::Create(stm_redo_log, "", InsertPos);
+    }
+
+    for (auto i_f = f->begin(), ie_f = f->end(); i_f != ie_f; i_f++) {
+        if (ReturnInst *ri = dyn_cast<ReturnInst>(i_f->getTerminator()))
+            CallInst::Create(stm_commit, "", ri);
+    }
+}
+
 bool CanTM::runOnModule(Module &M) {
     AA = &getAnalysis<AliasAnalysis>();
+    TD = getAnalysisIfAvailable<TargetData>();
     errs() << "Processing Module: ";
     errs().write_escaped(M.getModuleIdentifier()) << '\n';
 
-    //TODO: Link to library
-    stm_reserve = M.begin();
+    // The pass may be both requested explicitly and run from the pipeline
+    if (M.getNamedMetadata("cantm.instrumented"))
+        return false;
 
     // Automatically add *foo*() and *tx*() functions to system
     // TODO: Use clang to insert LLVM instructions to start/end a transaction
     for (auto i = M.begin(), ie = M.end(); i != ie; ++i) {
         Function* f = i;
-        if (f->getName().str().find("foo") != std::string::npos) {
-            fQueue.push(f);
-            fAdded.insert(f);
-            tx = f;
-        }
-        if (f->getName().str().find("tx") != std::string::npos) {
-            fQueue.push(f);
-            fAdded.insert(f);
-            tx = f;
+        if (f->isDeclaration() || !isCanTMTransaction(f))
+            continue;
+        fQueue.push(f);
+        fAdded.insert(f);
+        tx = f;
+        if (f->getName().find("tx") != StringRef::npos)
             break;
-        }
-    }
-
-    // Mark all globals as escapable, including all aliases
-    // TODO: If a global is accessed by a single transaction it
-    // doesn't need to be marked as so
-    for (Module::global_iterator G = M.global_begin(), E = M.global_end();
-        G != E; ++G) {
-        updateEscapability(G, true);
     }
+    if (!tx)
+        return false;
+    M.getOrInsertNamedMetadata("cantm.instrumented");
+
+    // Runtime entry points, see runtime/libcantm
+    stm_reserve = M.getOrInsertFunction("stm_reserve",
+            FunctionType::get(Type::getVoidTy(M.getContext()),
+                IntegerType::get(M.getContext(), 32), true));
+    stm_reserve_site = M.getOrInsertFunction("stm_reserve_site",
+            Type::getVoidTy(M.getContext()),
+            Type::getInt8PtrTy(M.getContext()), NULL);
+    Type *partialArgs[] = { Type::getInt8PtrTy(M.getContext()), IntegerType::get(M.getContext(), 32) };
+    stm_reserve_partial = M.getOrInsertFunction("stm_reserve_partial",
+            FunctionType::get(Type::getVoidTy(M.getContext()), partialArgs, true));
+
+    // Atomics in code that only runs inside the transaction are subsumed by
+    // it; mark globals as escapable, except those that only this transaction
+    // accesses
+    computeTxOnlyFunctions(M);
+    lowerAtomics();
+    analyzeGlobals(M);
 
     // Process each function
     while (!fQueue.empty()) {
@@ -650,6 +1435,8 @@ bool CanTM::runOnModule(Module &M) {
         for (auto i_f = f->begin(), ie_f = f->end(); i_f != ie_f; i_f++) {
             //aliasTracker->add(*i_f);
         }
+        // analyizeBB splits blocks after calls and allocas; the second half
+        // comes next in the function, and is analyzed in its turn
         for (auto i_f = f->begin(), ie_f = f->end(); i_f != ie_f; i_f++) {
             BasicBlock *bb = i_f;
             analyizeBB(bb, aliasTracker);
@@ -665,29 +1452,86 @@ bool CanTM::runOnModule(Module &M) {
 
     //TODO: Merge basic blocks get rid on unconditional branches
 
-    for (auto it = bbMap.begin(), it_end = bbMap.end(); it != it_end; ++it) {
-        BasicBlock *bb = (*it).first;
-        LoadStore ls = (*it).second;
+    Type *intPtr = TD ? TD->getIntPtrType(M.getContext()) : Type::getInt64Ty(M.getContext());
+    unsigned num_reserved = 0;
+    // Instrument in module order rather than that of the block addresses,
+    // so that reservation sites are numbered the same on every run
+    std::vector<BasicBlock *> blocks;
+    for (auto fi = M.begin(), fe = M.end(); fi != fe; ++fi)
+        for (auto bi = fi->begin(), be = fi->end(); bi != be; ++bi)
+            if (bbMap.count(bi))
+                blocks.push_back(bi);
+    for (auto it = blocks.begin(), it_end = blocks.end(); it != it_end; ++it) {
+        BasicBlock *bb = *it;
+        LoadStore ls = bbMap[bb];
         if (ls.empty())
             continue;
+        num_reserved += ls.numLoads() + ls.numStores();
         errs() << "Instrumenting BB: " << bb << " ";
         ls.debugPrint();
+        auto InsertPos = bb->begin();
+        while (isa<PHINode>(InsertPos))
+            ++InsertPos;
+
+        // Globals are reserved from a constant table in canonical order,
+        // which the runtime sorts into acquisition order only once; the
+        // remaining addresses are passed as arguments and sorted each time
+        std::vector<Value*> loads, stores, tableLoads, tableStores, dynLoads, dynStores;
+        ls.copyLoads(loads);
+        ls.copyStores(stores);
+        for (auto addr_it = loads.begin(), addr_end = loads.end(); addr_it != addr_end; ++addr_it)
+            (ReservationTables && isStaticAddress(*addr_it) ? tableLoads : dynLoads).push_back(*addr_it);
+        for (auto addr_it = stores.begin(), addr_end = stores.end(); addr_it != addr_end; ++addr_it)
+            (ReservationTables && isStaticAddress(*addr_it) ? tableStores : dynStores).push_back(*addr_it);
+
+        Constant *site = 0;
+        if (!tableLoads.empty() || !tableStores.empty()) {
+            sortReservationTable(M, tableLoads);
+            sortReservationTable(M, tableStores);
+            std::vector<Value*> addrs(tableLoads);
+            addrs.insert(addrs.end(), tableStores.begin(), tableStores.end());
+            site = createReservationSite(M, addrs, tableLoads.size(), tableStores.size());
+            if (dynLoads.empty() && dynStores.empty()) {
+                ++num_reservation_tables;
+                CallInst::Create(stm_reserve_site, site, "", InsertPos);
+                continue;
+            }
+            ++num_reservation_tables_partial;
+        }
+
+        // The runtime reads each address with va_arg as a uintptr_t
         std::vector<Value*> args;
-        ConstantInt* num_args = ConstantInt::get(IntegerType::get(M.getContext(), 32), 2 + ls.numLoads() + ls.numStores(), true);
+        if (site)
+            args.push_back(site);
+        ConstantInt* num_args = ConstantInt::get(IntegerType::get(M.getContext(), 32), 2 + dynLoads.size() + dynStores.size(), true);
         args.push_back(num_args);
-        ConstantInt* num_loads = ConstantInt::get(IntegerType::get(M.getContext(), 32), ls.numLoads(), true);
+        ConstantInt* num_loads = ConstantInt::get(IntegerType::get(M.getContext(), 32), dynLoads.size(), true);
         args.push_back(num_loads);
-        ls.copyLoads(args);
-        ConstantInt* num_stores = ConstantInt::get(IntegerType::get(M.getContext(), 32), ls.numStores(), true);
+        for (auto addr_it = dynLoads.begin(), addr_end = dynLoads.end(); addr_it != addr_end; ++addr_it)
+            args.push_back(new PtrToIntInst(*addr_it, intPtr, "", InsertPos));
+        ConstantInt* num_stores = ConstantInt::get(IntegerType::get(M.getContext(), 32), dynStores.size(), true);
         args.push_back(num_stores);
-        ls.copyStores(args);
-        auto InsertPos = bb->begin();
-        while (isa<PHINode>(InsertPos))
-            ++InsertPos;
+        for (auto addr_it = dynStores.begin(), addr_end = dynStores.end(); addr_it != addr_end; ++addr_it)
+            args.push_back(new PtrToIntInst(*addr_it, intPtr, "", InsertPos));
+        CallInst::Create(site ? stm_reserve_partial : stm_reserve, args, "", InsertPos);
+    }
+
+    num_reserved += reserveRanges(M);
 
-        CallInst::Create(stm_reserve, args, "", InsertPos);
+    // Blocks calling code that can't be rolled back switch the transaction
+    // to irrevocable mode at their reservation point
+    Constant *stm_irrevocable = M.getOrInsertFunction("stm_irrevocable",
+            Type::getVoidTy(M.getContext()), NULL);
+    for (auto it = fIrrevocableBlocks.begin(), it_end = fIrrevocableBlocks.end(); it != it_end; ++it) {
+        BasicBlock *bb = *it;
+        DEBUG(dbgs() << "Irrevocable BB: " << bb << "\n");
+        CallInst::Create(stm_irrevocable, "", bb->getFirstNonPHI());
     }
 
+    bool snapshot = Snapshots && rewriteSnapshotReads(M);
+    bool lazy = !snapshot && RedoLog && rewriteRedoAccesses(M);
+    rewriteAllocations(M);
+    insertTxBoundaries(M, tx, num_reserved, lazy, snapshot);
 
     // TODO: return false if no changes were made
     return true;
@@ -18,6 +18,8 @@
 #include "llvm/Constants.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/ErrorHandling.h"
 #include <algorithm>
 using namespace llvm;
 
@@ -36,6 +38,9 @@ namespace {
     explicit GVExtractorPass(std::vector<GlobalValue*>& GVs, bool deleteS = true)
       : ModulePass(ID), Named(GVs.begin(), GVs.end()), deleteStuff(deleteS) {}
 
+    /// This pass reads only the function bodies that it keeps.
+    bool materializesFunctions() const { return true; }
+
     bool runOnModule(Module &M) {
       // Visit the global inline asm.
       if (!deleteStuff)
@@ -66,10 +71,16 @@ namespace {
       }
 
       // Visit the Functions.
+      // Bodies that are still to be read are deleted without reading them.
       for (Module::iterator I = M.begin(), E = M.end(); I != E; ++I) {
-        if (deleteStuff == (bool)Named.count(I) && !I->isDeclaration()) {
+        if (deleteStuff == (bool)Named.count(I) &&
+            (!I->isDeclaration() || I->isMaterializable())) {
           I->deleteBody();
 	} else {
+          std::string ErrInfo;
+          if (I->Materialize(&ErrInfo))
+            report_fatal_error("Error reading bitcode file: " +
+                               Twine(ErrInfo));
 	  if (I->hasAvailableExternallyLinkage())
 	    continue;
 	}
@@ -287,6 +287,8 @@ void PassManagerBuilder::populateLTOPassManager(PassManagerBase &PM,
 
   // Now that we have optimized the program, discard unreachable functions.
   PM.add(createGlobalDCEPass());
+
+  addExtensionsToPM(EP_LinkTimeOptimizerLast, PM);
 }
 
 LLVMPassManagerBuilderRef LLVMPassManagerBuilderCreate(void) {
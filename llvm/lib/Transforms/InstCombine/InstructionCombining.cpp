@@ -1824,6 +1824,7 @@ static bool AddReachableCodeToWorklist(BasicBlock *BB,
         ++NumDeadInst;
         DEBUG(errs() << "IC: DCE: " << *Inst << '\n');
         Inst->eraseFromParent();
+        MadeIRChange = true;
         continue;
       }
       
@@ -1835,6 +1836,7 @@ static bool AddReachableCodeToWorklist(BasicBlock *BB,
           Inst->replaceAllUsesWith(C);
           ++NumConstProp;
           Inst->eraseFromParent();
+          MadeIRChange = true;
           continue;
         }
       
@@ -243,6 +243,14 @@ void Function::dropAllReferences() {
     BasicBlocks.begin()->eraseFromParent();
 }
 
+void Function::deleteBody() {
+  // If the body is still to be read, forget it rather than read it.
+  if (isMaterializable())
+    getParent()->Discard(this);
+  dropAllReferences();
+  setLinkage(ExternalLinkage);
+}
+
 void Function::addAttribute(unsigned i, Attributes attr) {
   AttrListPtr PAL = getAttributes();
   PAL = PAL.addAttr(i, attr);
@@ -416,6 +416,11 @@ void Module::Dematerialize(GlobalValue *GV) {
     return Materializer->Dematerialize(GV);
 }
 
+void Module::Discard(GlobalValue *GV) {
+  if (Materializer)
+    Materializer->Discard(GV);
+}
+
 bool Module::MaterializeAll(std::string *ErrInfo) {
   if (!Materializer)
     return false;
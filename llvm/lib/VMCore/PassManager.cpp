@@ -25,6 +25,10 @@
 #include "llvm/Support/PassNameParser.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Mutex.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/ThreadLocal.h"
+#include "llvm/ADT/StringExtras.h"
 #include <algorithm>
 #include <map>
 using namespace llvm;
@@ -1455,6 +1459,16 @@ void FPPassManager::dumpPassStructure(unsigned Offset) {
 /// runOnFunction method.  Keep track of whether any of the passes modifies
 /// the function, and if so, return true.
 bool FPPassManager::runOnFunction(Function &F) {
+  // The body of a lazily loaded function is read when it is first needed, and
+  // dropped again if no pass changed it; it can be read back later.
+  bool Materialized = false;
+  if (F.isMaterializable()) {
+    std::string errstr;
+    if (F.Materialize(&errstr))
+      report_fatal_error("Error reading bitcode file: " + Twine(errstr));
+    Materialized = true;
+  }
+
   if (F.isDeclaration())
     return false;
 
@@ -1475,6 +1489,7 @@ bool FPPassManager::runOnFunction(Function &F) {
     {
       PassManagerPrettyStackEntry X(FP, F);
       TimeRegion PassTimer(getPassTimer(FP));
+      PassTraceRegion PassTrace(FP, F);
 
       LocalChanged |= FP->runOnFunction(F);
     }
@@ -1489,6 +1504,9 @@ bool FPPassManager::runOnFunction(Function &F) {
     recordAvailableAnalysis(FP);
     removeDeadPasses(FP, F.getName(), ON_FUNCTION_MSG);
   }
+
+  if (Materialized && !Changed)
+    F.Dematerialize();
   return Changed;
 }
 
@@ -1541,6 +1559,12 @@ MPPassManager::runOnModule(Module &M) {
     ModulePass *MP = getContainedPass(Index);
     bool LocalChanged = false;
 
+    if (!MP->materializesFunctions()) {
+      std::string errstr;
+      if (M.MaterializeAll(&errstr))
+        report_fatal_error("Error reading bitcode file: " + Twine(errstr));
+    }
+
     dumpPassInfo(MP, EXECUTION_MSG, ON_MODULE_MSG, M.getModuleIdentifier());
     dumpRequiredSet(MP);
 
@@ -1549,6 +1573,7 @@ MPPassManager::runOnModule(Module &M) {
     {
       PassManagerPrettyStackEntry X(MP, M);
       TimeRegion PassTimer(getPassTimer(MP));
+      PassTraceRegion PassTrace(MP, M);
 
       LocalChanged |= MP->runOnModule(M);
     }
@@ -1695,6 +1720,196 @@ Timer *llvm::getPassTimer(Pass *P) {
   return 0;
 }
 
+//===----------------------------------------------------------------------===//
+// PassTrace Class - This class collects the runs of passes recorded by
+// PassTraceRegion, and writes them to the file given with -time-passes-trace
+// as Chrome trace events on exit.  Load the file in chrome://tracing.
+//
+static cl::opt<std::string>
+TimePassesTrace("time-passes-trace", cl::value_desc("filename"),
+  cl::desc("Write the time, instruction count change and heap growth of each "
+           "pass on each function to a Chrome trace file"));
+
+namespace {
+
+class PassTrace {
+  struct Event {
+    std::string Pass;
+    std::string Unit;        // The function or module the pass ran on
+    bool OnFunction;
+    unsigned Thread;
+    double Start, Duration;  // In seconds
+    int64_t Instructions;    // Change in the number of instructions
+    int64_t MemUsed;         // Growth of the heap, in bytes
+  };
+
+  // The begin or end of an event.  Stamps are written in time order, and
+  // among stamps at the same time, runs that took time end first, outer runs
+  // begin before the runs nested in them, and empty runs end last.
+  struct Stamp {
+    double Time;
+    unsigned Rank;
+    double Order;
+    unsigned Index;
+    bool Begin;
+
+    bool operator<(const Stamp &RHS) const {
+      if (Time != RHS.Time) return Time < RHS.Time;
+      if (Rank != RHS.Rank) return Rank < RHS.Rank;
+      if (Order != RHS.Order) return Order < RHS.Order;
+      return Index < RHS.Index;
+    }
+  };
+
+  std::vector<Event> Events;
+  unsigned NumThreads;
+  sys::ThreadLocal<const void> ThreadIndex;
+
+  static void writeString(raw_ostream &OS, StringRef Str);
+public:
+  PassTrace() : NumThreads(0) {}
+  ~PassTrace();
+
+  void record(Pass *P, const Function *F, const Module *M, double Start,
+              double End, int64_t Instructions, int64_t MemUsed);
+};
+
+} // End of anon namespace
+
+static ManagedStatic<sys::SmartMutex<true> > PassTraceMutex;
+static ManagedStatic<PassTrace> ThePassTrace;
+
+void PassTrace::record(Pass *P, const Function *F, const Module *M,
+                       double Start, double End, int64_t Instructions,
+                       int64_t MemUsed) {
+  sys::SmartScopedLock<true> Lock(*PassTraceMutex);
+  // Threads are numbered in the order they first run a pass.
+  uintptr_t Thread = reinterpret_cast<uintptr_t>(ThreadIndex.get());
+  if (!Thread) {
+    Thread = ++NumThreads;
+    ThreadIndex.set(reinterpret_cast<const void*>(Thread));
+  }
+
+  Event E;
+  E.Pass = P->getPassName();
+  E.Unit = F ? F->getName().str() : M->getModuleIdentifier();
+  E.OnFunction = F != 0;
+  E.Thread = Thread - 1;
+  E.Start = Start;
+  E.Duration = End - Start;
+  E.Instructions = Instructions;
+  E.MemUsed = MemUsed;
+  Events.push_back(E);
+}
+
+void PassTrace::writeString(raw_ostream &OS, StringRef Str) {
+  OS << '"';
+  for (unsigned i = 0, e = Str.size(); i != e; ++i) {
+    unsigned char C = Str[i];
+    if (C == '"' || C == '\\')
+      OS << '\\' << C;
+    else if (C < 0x20)
+      OS << "\\u00" << hexdigit(C >> 4) << hexdigit(C & 15);
+    else
+      OS << C;
+  }
+  OS << '"';
+}
+
+PassTrace::~PassTrace() {
+  std::string Error;
+  raw_fd_ostream OS(TimePassesTrace.c_str(), Error);
+  if (!Error.empty()) {
+    errs() << "Error opening pass trace file '" << TimePassesTrace << "': "
+           << Error << "\n";
+    return;
+  }
+
+  // Time stamps count from the first pass run.
+  double Origin = 0;
+  for (unsigned i = 0, e = Events.size(); i != e; ++i)
+    if (i == 0 || Events[i].Start < Origin)
+      Origin = Events[i].Start;
+
+  // Each run is a begin event naming the function or module, and an end
+  // event with what the run changed.
+  std::vector<Stamp> Stamps;
+  for (unsigned i = 0, e = Events.size(); i != e; ++i) {
+    const Event &E = Events[i];
+    Stamp B = { E.Start, 1, -E.Duration, i, true };
+    Stamp End = { E.Start + E.Duration, E.Duration > 0 ? 0U : 2U, -E.Start, i,
+                  false };
+    Stamps.push_back(B);
+    Stamps.push_back(End);
+  }
+  std::sort(Stamps.begin(), Stamps.end());
+
+  OS << "{\"traceEvents\":[";
+  for (unsigned i = 0, e = Stamps.size(); i != e; ++i) {
+    const Stamp &S = Stamps[i];
+    const Event &E = Events[S.Index];
+    OS << (i ? ",\n" : "\n") << "{\"name\":";
+    writeString(OS, E.Pass);
+    OS << ",\"cat\":\"" << (E.OnFunction ? "function" : "module")
+       << "\",\"ph\":\"" << (S.Begin ? 'B' : 'E')
+       << "\",\"pid\":0,\"tid\":" << E.Thread
+       << ",\"ts\":" << format("%.3f", (S.Time - Origin) * 1e6)
+       << ",\"args\":{";
+    if (S.Begin) {
+      OS << (E.OnFunction ? "\"function\":" : "\"module\":");
+      writeString(OS, E.Unit);
+    } else {
+      OS << "\"instructions\":" << E.Instructions
+         << ",\"heap\":" << E.MemUsed;
+    }
+    OS << "}}";
+  }
+  OS << "\n]}\n";
+}
+
+static unsigned countInstructions(const Function &F) {
+  unsigned Count = 0;
+  for (Function::const_iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    Count += BB->size();
+  return Count;
+}
+
+void PassTraceRegion::start() {
+  if (TimePassesTrace.empty() || P->getAsPMDataManager()) {
+    P = 0;
+    return;
+  }
+
+  Instructions = 0;
+  if (F) {
+    Instructions = countInstructions(*F);
+  } else {
+    for (Module::const_iterator I = M->begin(), E = M->end(); I != E; ++I)
+      Instructions += countInstructions(*I);
+  }
+  // Unlike -time-passes, this always tracks the heap, which mallinfo reports
+  // for the whole process.
+  MemUsed = sys::Process::GetMallocUsage();
+  WallTime = TimeRecord::getCurrentTime().getWallTime();
+}
+
+PassTraceRegion::~PassTraceRegion() {
+  if (!P)
+    return;
+
+  double End = TimeRecord::getCurrentTime().getWallTime();
+  int64_t Heap = sys::Process::GetMallocUsage();
+  unsigned After = 0;
+  if (F) {
+    After = countInstructions(*F);
+  } else {
+    for (Module::const_iterator I = M->begin(), E = M->end(); I != E; ++I)
+      After += countInstructions(*I);
+  }
+  ThePassTrace->record(P, F, M, WallTime, End,
+                       int64_t(After) - int64_t(Instructions), Heap - MemUsed);
+}
+
 //===----------------------------------------------------------------------===//
 // PMStack implementation
 //
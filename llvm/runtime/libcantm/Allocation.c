@@ -0,0 +1,78 @@
+/*===-- Allocation.c - CanTM transactional memory allocation --------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the bookkeeping behind stm_malloc and stm_free.  Frees
+|* are deferred until the transaction commits, and blocks allocated by an
+|* aborted transaction are released.  Released small blocks are kept in a
+|* per-thread pool, so that a retried transaction gets them straight back
+|* instead of going to the system allocator again.  Every block still comes
+|* from malloc, so memory allocated in a transaction may be freed outside one.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "CanTM.h"
+#include <stdlib.h>
+
+static unsigned sizeClass(size_t Size) {
+  return (unsigned)((Size + CANTM_POOL_GRAIN - 1) / CANTM_POOL_GRAIN);
+}
+
+void *stm_pool_alloc(stm_tx *Tx, size_t Size) {
+  unsigned Class = sizeClass(Size);
+  stm_alloc *A;
+  void *Ptr;
+
+  if (Class < CANTM_POOL_CLASSES && Tx->PoolSize[Class])
+    Ptr = Tx->Pool[Class][--Tx->PoolSize[Class]];
+  else if (Class < CANTM_POOL_CLASSES)
+    Ptr = malloc(Class ? Class * CANTM_POOL_GRAIN : CANTM_POOL_GRAIN);
+  else
+    Ptr = malloc(Size);
+
+  if (Ptr) {
+    A = (stm_alloc*)stm_vector_push(&Tx->Allocs, sizeof(stm_alloc));
+    A->Ptr = Ptr;
+    A->Class = Class;
+  }
+  return Ptr;
+}
+
+void stm_pool_free(stm_tx *Tx, void *Ptr) {
+  if (Ptr)
+    *(void**)stm_vector_push(&Tx->Frees, sizeof(void*)) = Ptr;
+}
+
+/* stm_alloc_commit - Carry out the frees deferred by a committing
+ * transaction; its allocations now belong to the program.
+ */
+void stm_alloc_commit(stm_tx *Tx) {
+  void **F = (void**)Tx->Frees.Data;
+  size_t i;
+  for (i = 0; i != Tx->Frees.Size; ++i)
+    free(F[i]);
+  Tx->Frees.Size = 0;
+  Tx->Allocs.Size = 0;
+}
+
+/* stm_alloc_abort - Drop the deferred frees of an aborting transaction and
+ * return its allocations to the pool.
+ */
+void stm_alloc_abort(stm_tx *Tx) {
+  stm_alloc *A = (stm_alloc*)Tx->Allocs.Data;
+  size_t i;
+  for (i = 0; i != Tx->Allocs.Size; ++i) {
+    unsigned Class = A[i].Class;
+    if (Class < CANTM_POOL_CLASSES && Tx->PoolSize[Class] < CANTM_POOL_DEPTH)
+      Tx->Pool[Class][Tx->PoolSize[Class]++] = A[i].Ptr;
+    else
+      free(A[i].Ptr);
+  }
+  Tx->Frees.Size = 0;
+  Tx->Allocs.Size = 0;
+}
@@ -0,0 +1,242 @@
+/*===-- CanTM.h - CanTM transactional memory runtime support --------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file defines the transaction descriptor and the routines shared by the
+|* reservation and contention management parts of the CanTM runtime.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#ifndef CANTM_H
+#define CANTM_H
+
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Memory is guarded by a table of ownership records (orecs).  Every aligned
+ * granule of CANTM_GRANULE bytes hashes onto one orec.  An orec holds either
+ * a version number shifted left by one, or the owning descriptor with the low
+ * bit set.
+ */
+#define CANTM_OREC_BITS 20
+#define CANTM_NUM_ORECS (1u << CANTM_OREC_BITS)
+#define CANTM_GRANULE   sizeof(uintptr_t)
+/* Ranges reserved by stm_reserve_ranges are widened to whole cache lines. */
+#define CANTM_LINE      64
+
+typedef uintptr_t stm_orec_t;
+
+extern volatile stm_orec_t stm_orecs[CANTM_NUM_ORECS];
+
+static inline unsigned stm_orec_index(uintptr_t addr) {
+  return (unsigned)(addr / CANTM_GRANULE) & (CANTM_NUM_ORECS - 1);
+}
+
+/* stm_entry - An orec observed (reads) or acquired (writes) by a transaction,
+ * along with the unlocked value the orec had at that point.
+ */
+typedef struct {
+  unsigned Index;
+  stm_orec_t Version;
+} stm_entry;
+
+/* stm_undo - Granule contents saved before the transaction first wrote it. */
+typedef struct {
+  uintptr_t Addr;
+  uintptr_t Value;
+} stm_undo;
+
+/* stm_sig - A Bloom filter over orec indices, see Signature.c. */
+#define CANTM_SIG_BITS  1024
+#define CANTM_SIG_WORDS (CANTM_SIG_BITS / 64)
+
+typedef struct {
+  uint64_t Bits[CANTM_SIG_WORDS];
+} stm_sig;
+
+/* stm_site - A reservation whose addresses are all globals, or the global
+ * part of one, emitted by the -CanTM pass as a constant table.  Plan caches
+ * the orec indices of the loads, the stores sorted into acquisition order and
+ * the signature of the stores; it starts out null and is built by the first
+ * transaction that reaches the site.
+ */
+typedef struct {
+  unsigned NumLoads;
+  unsigned NumStores;
+  const uintptr_t *Addrs;  /* Loads, then stores. */
+  void *volatile Plan;
+} stm_site;
+
+/* stm_span - The bytes [Begin, End) of a range reservation. */
+typedef struct {
+  uintptr_t Begin;
+  uintptr_t End;
+} stm_span;
+
+/* stm_redo - A granule buffered by a lazily versioned transaction.  Only the
+ * bytes set in Mask have been written.
+ */
+typedef struct {
+  uintptr_t Addr;
+  uintptr_t Value;
+  uintptr_t Mask;
+} stm_redo;
+
+/* stm_alloc - A block allocated by the transaction, and its pool class. */
+typedef struct {
+  void *Ptr;
+  unsigned Class;
+} stm_alloc;
+
+typedef struct {
+  void *Data;
+  size_t Size;
+  size_t Capacity;
+} stm_vector;
+
+/* stm_vector_push - Grow V by one element of EltSize bytes and return it. */
+void *stm_vector_push(stm_vector *V, size_t EltSize);
+
+/* Blocks released by aborted transactions are pooled per thread, in size
+ * classes of CANTM_POOL_GRAIN bytes.
+ */
+#define CANTM_POOL_GRAIN   16
+#define CANTM_POOL_CLASSES 32
+#define CANTM_POOL_DEPTH   16
+
+/* stm_tx - The per-thread transaction descriptor.  The ID is handed out when a
+ * transaction first begins and is kept across retries, so contention managers
+ * can use it as the transaction's age.
+ */
+typedef struct stm_tx {
+  uint64_t ID;
+  unsigned Nesting;
+  unsigned Aborts;       /* Consecutive aborts of the current transaction. */
+  uint64_t Karma;        /* Orecs reserved, accumulated across aborts. */
+  volatile uint64_t Run; /* Counts the runs of every transaction. */
+  volatile uint64_t Kill; /* The run a rival's contention manager aborts. */
+  int Irrevocable;       /* Holds the serial token; can never abort. */
+  int InHTM;             /* Running as a hardware transaction. */
+  int Lazy;              /* Buffers stores in the redo log. */
+  int Snapshot;          /* Read-only, reads the snapshot at SnapshotTime. */
+  uint64_t SnapshotTime;
+  volatile uint64_t Epoch; /* Announced while reading a snapshot, else 0. */
+  stm_vector Retired;    /* Old versions waiting to be freed. */
+  struct stm_tx *NextTx; /* All descriptors, see stm_tx_list. */
+  stm_sig ReadSig;       /* Read set, in signature mode. */
+  uint64_t SigSeen;      /* Last publication ReadSig was validated against. */
+  uint64_t Seed;
+  stm_vector Reads;      /* stm_entry */
+  stm_vector Writes;     /* stm_entry */
+  stm_vector Undo;       /* stm_undo */
+  stm_vector Pending;    /* uintptr_t, scratch for stm_reserve */
+  stm_vector Spans;      /* stm_span, scratch for stm_reserve_ranges */
+  stm_vector Redo;       /* stm_redo */
+  unsigned *RedoIndex;   /* Open-addressed, entries are Redo index + 1. */
+  unsigned RedoBuckets;
+  stm_vector Allocs;     /* stm_alloc */
+  stm_vector Frees;      /* void *, deferred until commit */
+  void *Pool[CANTM_POOL_CLASSES][CANTM_POOL_DEPTH];
+  unsigned PoolSize[CANTM_POOL_CLASSES];
+  jmp_buf Checkpoint;
+  jmp_buf Nested;        /* Scratch checkpoint handed to nested begins. */
+} stm_tx;
+
+/* stm_cm_decision - What a contention manager wants to do about a conflict. */
+typedef enum {
+  STM_CM_RETRY,          /* Try to acquire the orec again. */
+  STM_CM_ABORT_SELF,     /* Roll back and restart the transaction. */
+  STM_CM_ABORT_OTHER     /* Ask the owner to abort, back off and retry. */
+} stm_cm_decision;
+
+/* stm_cm - A pluggable contention manager.  OnConflict is called each time Tx
+ * finds an orec owned by Owner, with the number of attempts made so far.
+ */
+typedef struct {
+  const char *Name;
+  void (*OnBegin)(stm_tx *Tx);
+  stm_cm_decision (*OnConflict)(stm_tx *Tx, stm_tx *Owner, unsigned Attempt);
+  void (*OnAbort)(stm_tx *Tx);
+  void (*OnCommit)(stm_tx *Tx);
+} stm_cm;
+
+extern const stm_cm *stm_contention_manager;
+
+/* stm_cm_init - Select the contention manager named by $CANTM_CM. */
+void stm_cm_init(void);
+
+/* stm_backoff - Spin for a randomized, exponentially growing delay. */
+void stm_backoff(stm_tx *Tx, unsigned Attempt);
+
+/* stm_tx_list - Every descriptor ever created, linked through NextTx. */
+stm_tx *stm_tx_list(void);
+
+/* Multi-version snapshots, see Snapshot.c. */
+extern int stm_mv_enabled;
+void stm_mv_init(void);
+uint64_t stm_mv_tick(void);
+void stm_mv_begin(stm_tx *Tx);
+void stm_mv_end(stm_tx *Tx);
+void stm_mv_save(stm_tx *Tx, uint64_t Until);
+int stm_mv_read(stm_tx *Tx, uintptr_t Addr, void *Dst, unsigned Size);
+
+/* Signature mode, see Signature.c. */
+extern int stm_signatures;
+void stm_sig_init(void);
+void stm_sig_clear(stm_sig *S);
+void stm_sig_add(stm_sig *S, unsigned Index);
+int stm_sig_intersects(const stm_sig *A, const stm_sig *B);
+uint64_t stm_sig_now(void);
+void stm_sig_publish(stm_tx *Tx, const stm_sig *Sig);
+int stm_sig_validate(stm_tx *Tx);
+
+/* Redo log for lazy versioning, see Redo.c. */
+void stm_redo_reserve(stm_tx *Tx, unsigned Count);
+void stm_redo_write(stm_tx *Tx, uintptr_t Addr, const void *Src,
+                    unsigned Size);
+void stm_redo_read(stm_tx *Tx, uintptr_t Addr, void *Dst, unsigned Size);
+void stm_redo_writeback(stm_tx *Tx);
+void stm_redo_clear(stm_tx *Tx);
+
+/* Allocation bookkeeping, see Allocation.c. */
+void *stm_pool_alloc(stm_tx *Tx, size_t Size);
+void stm_pool_free(stm_tx *Tx, void *Ptr);
+void stm_alloc_commit(stm_tx *Tx);
+void stm_alloc_abort(stm_tx *Tx);
+
+/* Entry points called by code instrumented with the -CanTM pass.  The buffer
+ * returned by stm_begin must be passed straight to _setjmp by the caller; an
+ * abort rolls the transaction back and resumes there.
+ */
+void *stm_begin(void);
+void *stm_begin_htm(int retries);
+void *stm_begin_snapshot(void);
+void stm_commit(void);
+void stm_abort(void);
+void stm_irrevocable(void);
+void stm_redo_log(void);
+void stm_reserve(int num_args, ...);
+void stm_reserve_site(stm_site *site);
+void stm_reserve_partial(stm_site *site, int num_args, ...);
+void stm_reserve_ranges(int num_args, ...);
+int stm_load(uintptr_t addr);
+void stm_store(int val, uintptr_t addr);
+uint8_t stm_load8(const void *addr);
+uint16_t stm_load16(const void *addr);
+uint32_t stm_load32(const void *addr);
+uint64_t stm_load64(const void *addr);
+void stm_store8(uint8_t val, void *addr);
+void stm_store16(uint16_t val, void *addr);
+void stm_store32(uint32_t val, void *addr);
+void stm_store64(uint64_t val, void *addr);
+uint64_t stm_tx_id(void);
+void *stm_malloc(size_t size);
+void stm_free(void *ptr);
+
+#endif
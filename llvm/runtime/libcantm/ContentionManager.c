@@ -0,0 +1,143 @@
+/*===-- ContentionManager.c - CanTM contention managers -------------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the contention managers consulted when a reservation
+|* finds an orec owned by another transaction.  The manager is picked once at
+|* startup from the CANTM_CM environment variable:
+|*
+|*   backoff    - Polite randomized exponential backoff, then abort self.
+|*   karma      - The transaction that has reserved more orecs wins.
+|*   timestamp  - The older transaction (smaller ID) wins.
+|*   serial     - Like backoff, but after CANTM_SERIAL_AFTER consecutive aborts
+|*                the transaction restarts irrevocably, holding the serial
+|*                token.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "CanTM.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Attempts after which a losing transaction gives up and aborts itself. */
+#define MAX_ATTEMPTS 16
+/* Backoff windows stop growing at 2^MAX_BACKOFF_SHIFT spins. */
+#define MAX_BACKOFF_SHIFT 16
+/* Windows at least this large also give up the processor. */
+#define YIELD_BACKOFF_SHIFT 10
+
+static unsigned SerialAfter = 8;
+
+void stm_backoff(stm_tx *Tx, unsigned Attempt) {
+  volatile unsigned Spin;
+  unsigned Delay;
+
+  if (Attempt > MAX_BACKOFF_SHIFT)
+    Attempt = MAX_BACKOFF_SHIFT;
+
+  /* xorshift64 */
+  Tx->Seed ^= Tx->Seed << 13;
+  Tx->Seed ^= Tx->Seed >> 7;
+  Tx->Seed ^= Tx->Seed << 17;
+
+  Delay = (unsigned)(Tx->Seed % (1u << Attempt)) + 1;
+  for (Spin = 0; Spin != Delay; ++Spin)
+    ;
+  if (Attempt >= YIELD_BACKOFF_SHIFT)
+    sched_yield();
+}
+
+static void nop(stm_tx *Tx) {
+}
+
+/*===----------------------------------------------------------------------===*
+ * backoff
+ *===----------------------------------------------------------------------===*/
+
+static stm_cm_decision backoffOnConflict(stm_tx *Tx, stm_tx *Owner,
+                                         unsigned Attempt) {
+  if (Attempt >= MAX_ATTEMPTS)
+    return STM_CM_ABORT_SELF;
+  stm_backoff(Tx, Attempt);
+  return STM_CM_RETRY;
+}
+
+static void backoffOnAbort(stm_tx *Tx) {
+  stm_backoff(Tx, Tx->Aborts);
+}
+
+/*===----------------------------------------------------------------------===*
+ * karma
+ *===----------------------------------------------------------------------===*/
+
+static stm_cm_decision karmaOnConflict(stm_tx *Tx, stm_tx *Owner,
+                                       unsigned Attempt) {
+  /* Each attempt is worth one orec of karma, so a waiting transaction will
+   * eventually overtake the owner.
+   */
+  if (Tx->Karma + Attempt > Owner->Karma)
+    return STM_CM_ABORT_OTHER;
+  stm_backoff(Tx, Attempt);
+  return STM_CM_RETRY;
+}
+
+/*===----------------------------------------------------------------------===*
+ * timestamp
+ *===----------------------------------------------------------------------===*/
+
+static stm_cm_decision timestampOnConflict(stm_tx *Tx, stm_tx *Owner,
+                                           unsigned Attempt) {
+  if (Tx->ID < Owner->ID)
+    return STM_CM_ABORT_OTHER;
+  return backoffOnConflict(Tx, Owner, Attempt);
+}
+
+/*===----------------------------------------------------------------------===*
+ * serial
+ *===----------------------------------------------------------------------===*/
+
+static void serialOnAbort(stm_tx *Tx) {
+  if (SerialAfter && Tx->Aborts >= SerialAfter)
+    Tx->Irrevocable = 1;
+  else
+    backoffOnAbort(Tx);
+}
+
+static const stm_cm ContentionManagers[] = {
+  { "backoff", nop, backoffOnConflict, backoffOnAbort, nop },
+  { "karma", nop, karmaOnConflict, backoffOnAbort, nop },
+  { "timestamp", nop, timestampOnConflict, backoffOnAbort, nop },
+  { "serial", nop, backoffOnConflict, serialOnAbort, nop }
+};
+
+const stm_cm *stm_contention_manager = &ContentionManagers[0];
+
+void stm_cm_init(void) {
+  const char *Name = getenv("CANTM_CM");
+  const char *K = getenv("CANTM_SERIAL_AFTER");
+  unsigned i;
+
+  if (K)
+    SerialAfter = (unsigned)strtoul(K, 0, 10);
+
+  if (!Name || !*Name)
+    return;
+
+  for (i = 0; i != sizeof(ContentionManagers)/sizeof(ContentionManagers[0]);
+       ++i) {
+    if (!strcmp(Name, ContentionManagers[i].Name)) {
+      stm_contention_manager = &ContentionManagers[i];
+      return;
+    }
+  }
+
+  fprintf(stderr, "CanTM: unknown contention manager '%s', using '%s'\n",
+          Name, stm_contention_manager->Name);
+}
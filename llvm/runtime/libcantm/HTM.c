@@ -0,0 +1,52 @@
+/*===-- HTM.c - Restricted transactional memory detection -----------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file decides at startup whether the hardware fast path can be used.
+|* Setting CANTM_HTM=0 disables it even on processors that have RTM.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "HTM.h"
+#include <stdlib.h>
+
+int stm_htm_supported;
+
+#if defined(__i386__) || defined(__x86_64__)
+static void cpuid(unsigned Leaf, unsigned Subleaf, unsigned *EAX,
+                  unsigned *EBX, unsigned *ECX, unsigned *EDX) {
+#if defined(__i386__) && defined(__PIC__)
+  /* %ebx holds the GOT pointer in 32-bit PIC code. */
+  __asm__("xchgl %%ebx, %1\n\tcpuid\n\txchgl %%ebx, %1"
+          : "=a"(*EAX), "=r"(*EBX), "=c"(*ECX), "=d"(*EDX)
+          : "0"(Leaf), "2"(Subleaf));
+#else
+  __asm__("cpuid"
+          : "=a"(*EAX), "=b"(*EBX), "=c"(*ECX), "=d"(*EDX)
+          : "0"(Leaf), "2"(Subleaf));
+#endif
+}
+#endif
+
+void stm_htm_init(void) {
+  const char *Enable = getenv("CANTM_HTM");
+  if (Enable && !atoi(Enable))
+    return;
+
+#if defined(__i386__) || defined(__x86_64__)
+  {
+    unsigned EAX, EBX, ECX, EDX;
+    cpuid(0, 0, &EAX, &EBX, &ECX, &EDX);
+    if (EAX < 7)
+      return;
+    /* CPUID.(EAX=07H,ECX=0):EBX.RTM[bit 11] */
+    cpuid(7, 0, &EAX, &EBX, &ECX, &EDX);
+    stm_htm_supported = (EBX >> 11) & 1;
+  }
+#endif
+}
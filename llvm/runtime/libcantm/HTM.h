@@ -0,0 +1,66 @@
+/*===-- HTM.h - Restricted transactional memory primitives ----------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file wraps the x86 RTM instructions used by the hardware fast path.
+|* They are emitted as raw bytes so that the runtime builds with compilers and
+|* assemblers that do not know about TSX.  On other hosts, and on x86 hosts
+|* without RTM, stm_htm_supported is zero and none of these are executed.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#ifndef CANTM_HTM_H
+#define CANTM_HTM_H
+
+#define STM_XBEGIN_STARTED     (~0u)
+#define STM_XABORT_EXPLICIT    (1u << 0)
+#define STM_XABORT_RETRY       (1u << 1)
+#define STM_XABORT_CONFLICT    (1u << 2)
+#define STM_XABORT_CAPACITY    (1u << 3)
+#define STM_XABORT_CODE(Status) (((Status) >> 24) & 0xff)
+
+/* Explicit abort codes used by the runtime. */
+#define STM_XABORT_IRREVOCABLE 0xfd
+#define STM_XABORT_LOCKED      0xfe
+#define STM_XABORT_USER        0xff
+
+/* stm_htm_supported - Set by stm_htm_init if the processor has RTM. */
+extern int stm_htm_supported;
+
+/* stm_htm_init - Probe the processor for RTM. */
+void stm_htm_init(void);
+
+#if defined(__i386__) || defined(__x86_64__)
+
+static inline unsigned stm_xbegin(void) {
+  unsigned Status = STM_XBEGIN_STARTED;
+  __asm__ __volatile__(".byte 0xc7,0xf8 ; .long 0" : "+a"(Status) :: "memory");
+  return Status;
+}
+
+static inline void stm_xend(void) {
+  __asm__ __volatile__(".byte 0x0f,0x01,0xd5" ::: "memory");
+}
+
+#define stm_xabort(Code) \
+  __asm__ __volatile__(".byte 0xc6,0xf8,%P0" :: "i"(Code) : "memory")
+
+#else
+
+static inline unsigned stm_xbegin(void) {
+  return 0;
+}
+
+static inline void stm_xend(void) {
+}
+
+#define stm_xabort(Code) ((void)0)
+
+#endif
+
+#endif
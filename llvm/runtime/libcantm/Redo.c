@@ -0,0 +1,160 @@
+/*===-- Redo.c - CanTM redo log for lazy versioning -----------------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the redo log used by transactions running with lazy
+|* versioning.  Stores are buffered per granule, together with a mask of the
+|* bytes written, and found again through a small open-addressed hash table.
+|* Memory is only updated when the transaction commits, so an abort simply
+|* discards the log.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "CanTM.h"
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned hashGranule(uintptr_t Granule, unsigned Buckets) {
+  return (unsigned)((Granule / CANTM_GRANULE) * 2654435761u) & (Buckets - 1);
+}
+
+static void rehash(stm_tx *Tx, unsigned Buckets) {
+  stm_redo *R = (stm_redo*)Tx->Redo.Data;
+  size_t i;
+
+  free(Tx->RedoIndex);
+  Tx->RedoIndex = (unsigned*)calloc(Buckets, sizeof(unsigned));
+  Tx->RedoBuckets = Buckets;
+  for (i = 0; i != Tx->Redo.Size; ++i) {
+    unsigned H = hashGranule(R[i].Addr, Buckets);
+    while (Tx->RedoIndex[H])
+      H = (H + 1) & (Buckets - 1);
+    Tx->RedoIndex[H] = (unsigned)i + 1;
+  }
+}
+
+/* stm_redo_reserve - Make room for Count more granules, so that the stores of
+ * a block never have to grow the table halfway through.  The table is kept
+ * at most half full.
+ */
+void stm_redo_reserve(stm_tx *Tx, unsigned Count) {
+  unsigned Buckets = Tx->RedoBuckets ? Tx->RedoBuckets : 16;
+  while (2 * (Tx->Redo.Size + Count) > Buckets)
+    Buckets *= 2;
+  if (Buckets != Tx->RedoBuckets)
+    rehash(Tx, Buckets);
+}
+
+static stm_redo *findGranule(stm_tx *Tx, uintptr_t Granule, int Create) {
+  stm_redo *R;
+  unsigned H;
+
+  if (!Tx->RedoBuckets) {
+    if (!Create)
+      return 0;
+    stm_redo_reserve(Tx, 1);
+  }
+
+  H = hashGranule(Granule, Tx->RedoBuckets);
+  for (; Tx->RedoIndex[H]; H = (H + 1) & (Tx->RedoBuckets - 1)) {
+    R = (stm_redo*)Tx->Redo.Data + Tx->RedoIndex[H] - 1;
+    if (R->Addr == Granule)
+      return R;
+  }
+  if (!Create)
+    return 0;
+
+  if (2 * (Tx->Redo.Size + 1) > Tx->RedoBuckets) {
+    stm_redo_reserve(Tx, 1);
+    return findGranule(Tx, Granule, Create);
+  }
+
+  R = (stm_redo*)stm_vector_push(&Tx->Redo, sizeof(stm_redo));
+  R->Addr = Granule;
+  R->Value = 0;
+  R->Mask = 0;
+  Tx->RedoIndex[H] = (unsigned)Tx->Redo.Size;
+  return R;
+}
+
+void stm_redo_write(stm_tx *Tx, uintptr_t Addr, const void *Src,
+                    unsigned Size) {
+  const unsigned char *S = (const unsigned char*)Src;
+  while (Size) {
+    uintptr_t Granule = Addr & ~(uintptr_t)(CANTM_GRANULE - 1);
+    unsigned Offset = (unsigned)(Addr - Granule);
+    unsigned N = CANTM_GRANULE - Offset < Size ? CANTM_GRANULE - Offset : Size;
+    stm_redo *R = findGranule(Tx, Granule, 1);
+    memcpy((unsigned char*)&R->Value + Offset, S, N);
+    memset((unsigned char*)&R->Mask + Offset, 0xff, N);
+    Addr += N;
+    S += N;
+    Size -= N;
+  }
+}
+
+void stm_redo_read(stm_tx *Tx, uintptr_t Addr, void *Dst, unsigned Size) {
+  unsigned char *D = (unsigned char*)Dst;
+  memcpy(D, (const void*)Addr, Size);
+  if (!Tx->Redo.Size)
+    return;
+
+  while (Size) {
+    uintptr_t Granule = Addr & ~(uintptr_t)(CANTM_GRANULE - 1);
+    unsigned Offset = (unsigned)(Addr - Granule);
+    unsigned N = CANTM_GRANULE - Offset < Size ? CANTM_GRANULE - Offset : Size;
+    stm_redo *R = findGranule(Tx, Granule, 0);
+    if (R) {
+      const unsigned char *V = (const unsigned char*)&R->Value + Offset;
+      const unsigned char *M = (const unsigned char*)&R->Mask + Offset;
+      unsigned i;
+      for (i = 0; i != N; ++i)
+        if (M[i])
+          D[i] = V[i];
+    }
+    Addr += N;
+    D += N;
+    Size -= N;
+  }
+}
+
+static int compareGranules(const void *LHS, const void *RHS) {
+  uintptr_t L = ((const stm_redo*)LHS)->Addr;
+  uintptr_t R = ((const stm_redo*)RHS)->Addr;
+  return L < R ? -1 : L > R;
+}
+
+/* stm_redo_writeback - Copy the log to memory in address order, which keeps
+ * neighbouring granules together, and empty it.
+ */
+void stm_redo_writeback(stm_tx *Tx) {
+  stm_redo *R = (stm_redo*)Tx->Redo.Data;
+  size_t i;
+
+  qsort(R, Tx->Redo.Size, sizeof(stm_redo), compareGranules);
+  for (i = 0; i != Tx->Redo.Size; ++i) {
+    if (R[i].Mask == ~(uintptr_t)0) {
+      *(volatile uintptr_t*)R[i].Addr = R[i].Value;
+    } else {
+      unsigned char *D = (unsigned char*)R[i].Addr;
+      const unsigned char *V = (const unsigned char*)&R[i].Value;
+      const unsigned char *M = (const unsigned char*)&R[i].Mask;
+      unsigned j;
+      for (j = 0; j != CANTM_GRANULE; ++j)
+        if (M[j])
+          D[j] = V[j];
+    }
+  }
+  stm_redo_clear(Tx);
+}
+
+void stm_redo_clear(stm_tx *Tx) {
+  if (Tx->Redo.Size)
+    memset(Tx->RedoIndex, 0, Tx->RedoBuckets * sizeof(unsigned));
+  Tx->Redo.Size = 0;
+}
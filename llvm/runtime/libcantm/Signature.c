@@ -0,0 +1,150 @@
+/*===-- Signature.c - CanTM Bloom filter read set signatures --------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the signature mode of the runtime, selected with
+|* CANTM_SIGNATURES=1.  Instead of logging the version of every orec it reads,
+|* a transaction folds the orec indices into a Bloom filter.  Writers publish
+|* a signature of the orecs they acquire, before they write, into a ring of
+|* recent publications; validation intersects the read signature with every
+|* publication made since the last validation.  Its cost then depends on the
+|* number of concurrent writers rather than on the size of the read set.
+|*
+|* Signatures are conservative: a false positive only costs an abort.  When
+|* the ring has wrapped since a transaction last validated, it aborts too.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "CanTM.h"
+#include "HTM.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+int stm_signatures;
+
+/* Publications are numbered by SigClock and land in slot Stamp % RING.  A
+ * slot's Stamp is the number of the publication it holds, or SIG_BUSY while
+ * one is being copied in.  A publication waits for the one RING before it to
+ * be complete, so two never write the same slot at once.
+ */
+#define SIG_RING 256
+#define SIG_BUSY (~(uint64_t)0)
+
+typedef struct {
+  volatile uint64_t Stamp;
+  stm_tx *volatile Owner;
+  stm_sig Sig;
+} stm_sig_slot;
+
+static stm_sig_slot Ring[SIG_RING];
+static volatile uint64_t SigClock = SIG_RING - 1;
+
+void stm_sig_init(void) {
+  const char *Enable = getenv("CANTM_SIGNATURES");
+  unsigned i;
+
+  if (!Enable || !atoi(Enable))
+    return;
+
+  for (i = 0; i != SIG_RING; ++i)
+    Ring[i].Stamp = i;
+  stm_signatures = 1;
+  /* Hardware writers only bump orec versions, which readers no longer look
+   * at.
+   */
+  stm_htm_supported = 0;
+}
+
+void stm_sig_clear(stm_sig *S) {
+  memset(S, 0, sizeof(*S));
+}
+
+void stm_sig_add(stm_sig *S, unsigned Index) {
+  uint64_t H = (uint64_t)Index * 0x9E3779B97F4A7C15ULL;
+  unsigned B1 = (unsigned)(H >> 54) & (CANTM_SIG_BITS - 1);
+  unsigned B2 = (unsigned)(H >> 44) & (CANTM_SIG_BITS - 1);
+  S->Bits[B1 / 64] |= (uint64_t)1 << (B1 % 64);
+  S->Bits[B2 / 64] |= (uint64_t)1 << (B2 % 64);
+}
+
+int stm_sig_intersects(const stm_sig *A, const stm_sig *B) {
+  unsigned i;
+#if defined(__AVX2__)
+  __m256i Acc = _mm256_setzero_si256();
+  for (i = 0; i != CANTM_SIG_WORDS; i += 4)
+    Acc = _mm256_or_si256(Acc, _mm256_and_si256(
+        _mm256_loadu_si256((const __m256i*)(A->Bits + i)),
+        _mm256_loadu_si256((const __m256i*)(B->Bits + i))));
+  return !_mm256_testz_si256(Acc, Acc);
+#elif defined(__SSE2__)
+  __m128i Acc = _mm_setzero_si128();
+  for (i = 0; i != CANTM_SIG_WORDS; i += 2)
+    Acc = _mm_or_si128(Acc, _mm_and_si128(
+        _mm_loadu_si128((const __m128i*)(A->Bits + i)),
+        _mm_loadu_si128((const __m128i*)(B->Bits + i))));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(Acc, _mm_setzero_si128())) != 0xffff;
+#else
+  uint64_t Acc = 0;
+  for (i = 0; i != CANTM_SIG_WORDS; ++i)
+    Acc |= A->Bits[i] & B->Bits[i];
+  return Acc != 0;
+#endif
+}
+
+uint64_t stm_sig_now(void) {
+  return SigClock;
+}
+
+void stm_sig_publish(stm_tx *Tx, const stm_sig *Sig) {
+  uint64_t T = __sync_add_and_fetch(&SigClock, 1);
+  stm_sig_slot *S = &Ring[T % SIG_RING];
+
+  while (S->Stamp != T - SIG_RING)
+    sched_yield();
+  S->Stamp = SIG_BUSY;
+  __sync_synchronize();
+  S->Owner = Tx;
+  S->Sig = *Sig;
+  __sync_synchronize();
+  S->Stamp = T;
+}
+
+int stm_sig_validate(stm_tx *Tx) {
+  uint64_t Now = SigClock;
+  uint64_t T;
+
+  if (Now - Tx->SigSeen > SIG_RING)
+    return 0;
+
+  for (T = Tx->SigSeen + 1; T <= Now; ++T) {
+    stm_sig_slot *S = &Ring[T % SIG_RING];
+    uint64_t Stamp;
+    int Hit;
+
+    /* Wait for the publication to be complete; give up if it was already
+     * overwritten.
+     */
+    while ((Stamp = S->Stamp) != T) {
+      if (Stamp != SIG_BUSY && Stamp > T)
+        return 0;
+      sched_yield();
+    }
+    __sync_synchronize();
+    Hit = S->Owner != Tx && stm_sig_intersects(&Tx->ReadSig, &S->Sig);
+    __sync_synchronize();
+    if (Hit || S->Stamp != T)
+      return 0;
+  }
+  Tx->SigSeen = Now;
+  return 1;
+}
@@ -0,0 +1,272 @@
+/*===-- Snapshot.c - CanTM multi-version snapshot reads -------------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file lets read-only transactions, started with stm_begin_snapshot, read
+|* a consistent snapshot of memory instead of validating against writers.  It
+|* is enabled with CANTM_SNAPSHOTS=N, N being the number of old versions kept
+|* per bucket of orecs.
+|*
+|* In this mode orecs are released with a timestamp from a global clock.  A
+|* snapshot transaction takes the clock when it starts; a granule whose orec
+|* is not newer can be read from memory.  Otherwise the committing writer left
+|* the granule's previous contents in the version chain of the orec's bucket,
+|* tagged with its commit time.  Writers only do so while snapshot readers are
+|* active.
+|*
+|* Versions beyond the bound are unlinked and freed by epoch-based
+|* reclamation once no reader that could still be traversing them remains.  A
+|* reader that needs a version that was already dropped restarts with a newer
+|* snapshot; that is the only way it can abort.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "CanTM.h"
+#include "HTM.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MV_BUCKETS (1u << 16)
+/* Retired versions a thread collects before it tries to free them. */
+#define MV_RECLAIM_AFTER 64
+
+/* stm_version - The contents Value that Addr had before the commit at time
+ * Until.
+ */
+typedef struct stm_version {
+  uintptr_t Addr;
+  uintptr_t Value;
+  uint64_t Until;
+  struct stm_version *volatile Next;
+} stm_version;
+
+/* stm_bucket - Versions, newest first, of the granules whose orecs fall into
+ * the bucket.  Trimmed is the newest Until of any version dropped from it.
+ */
+typedef struct {
+  volatile int Lock;
+  stm_version *volatile Head;
+  volatile uint64_t Trimmed;
+} stm_bucket;
+
+/* stm_retired - A version unlinked at epoch Epoch. */
+typedef struct {
+  stm_version *Version;
+  uint64_t Epoch;
+} stm_retired;
+
+int stm_mv_enabled;
+static unsigned MaxVersions;
+static stm_bucket Buckets[MV_BUCKETS];
+static volatile uint64_t Clock;
+static volatile uint64_t GlobalEpoch = 1;
+static volatile unsigned Readers;
+
+void stm_mv_init(void) {
+  const char *Versions = getenv("CANTM_SNAPSHOTS");
+  if (!Versions || atoi(Versions) <= 0)
+    return;
+
+  MaxVersions = (unsigned)atoi(Versions);
+  stm_mv_enabled = 1;
+  /* Hardware writers can't leave old versions behind. */
+  stm_htm_supported = 0;
+}
+
+uint64_t stm_mv_tick(void) {
+  return __sync_add_and_fetch(&Clock, 1);
+}
+
+void stm_mv_begin(stm_tx *Tx) {
+  __sync_add_and_fetch(&Readers, 1);
+  Tx->Epoch = GlobalEpoch;
+  __sync_synchronize();
+  Tx->SnapshotTime = Clock;
+}
+
+void stm_mv_end(stm_tx *Tx) {
+  __sync_synchronize();
+  Tx->Epoch = 0;
+  __sync_sub_and_fetch(&Readers, 1);
+}
+
+/* reclaim - Free the retired versions no snapshot reader can still reach:
+ * those unlinked before the oldest epoch any active reader announced.
+ */
+static void reclaim(stm_tx *Tx) {
+  stm_retired *R = (stm_retired*)Tx->Retired.Data;
+  uint64_t Epoch = GlobalEpoch;
+  uint64_t Oldest;
+  stm_tx *Other;
+  size_t i, Kept = 0;
+
+  __sync_bool_compare_and_swap(&GlobalEpoch, Epoch, Epoch + 1);
+  __sync_synchronize();
+  Oldest = Epoch + 1;
+  for (Other = stm_tx_list(); Other; Other = Other->NextTx) {
+    uint64_t E = Other->Epoch;
+    if (E && E < Oldest)
+      Oldest = E;
+  }
+
+  for (i = 0; i != Tx->Retired.Size; ++i) {
+    if (R[i].Epoch < Oldest)
+      free(R[i].Version);
+    else
+      R[Kept++] = R[i];
+  }
+  Tx->Retired.Size = Kept;
+}
+
+static void retire(stm_tx *Tx, stm_version *V) {
+  uint64_t Epoch = GlobalEpoch;
+  while (V) {
+    stm_retired *R = (stm_retired*)stm_vector_push(&Tx->Retired,
+                                                   sizeof(stm_retired));
+    R->Version = V;
+    R->Epoch = Epoch;
+    V = V->Next;
+  }
+  if (Tx->Retired.Size >= MV_RECLAIM_AFTER)
+    reclaim(Tx);
+}
+
+/* pushVersion - Record that Addr held Value before the commit at Until.  The
+ * caller holds the orec of Addr, so versions of one granule are pushed in
+ * commit order.  Only the first version pushed for Addr at Until is kept.
+ */
+static void pushVersion(stm_tx *Tx, uintptr_t Addr, uintptr_t Value,
+                        uint64_t Until) {
+  stm_bucket *B = &Buckets[stm_orec_index(Addr) & (MV_BUCKETS - 1)];
+  stm_version *V = (stm_version*)malloc(sizeof(stm_version));
+  stm_version *Last, *Dropped;
+  uint64_t Trimmed;
+  unsigned Count;
+
+  V->Addr = Addr;
+  V->Value = Value;
+  V->Until = Until;
+
+  while (!__sync_bool_compare_and_swap(&B->Lock, 0, 1))
+    sched_yield();
+  for (Last = B->Head; Last; Last = Last->Next)
+    if (Last->Addr == Addr && Last->Until == Until)
+      break;
+  if (Last) {
+    B->Lock = 0;
+    free(V);
+    return;
+  }
+  V->Next = B->Head;
+  __sync_synchronize();
+  B->Head = V;
+
+  for (Last = V, Count = 1; Last->Next && Count < MaxVersions; ++Count)
+    Last = Last->Next;
+  Dropped = Last->Next;
+  if (Dropped) {
+    Trimmed = B->Trimmed;
+    for (V = Dropped; V; V = V->Next)
+      if (V->Until > Trimmed)
+        Trimmed = V->Until;
+    B->Trimmed = Trimmed;
+    __sync_synchronize();
+    Last->Next = 0;
+  }
+  __sync_synchronize();
+  B->Lock = 0;
+
+  if (Dropped)
+    retire(Tx, Dropped);
+}
+
+/* stm_mv_save - Called by a committing writer that drew timestamp Until,
+ * before it releases its orecs, to keep the previous contents of everything
+ * it wrote.  Eager transactions find them in the undo log, which holds an
+ * entry per store; the first one for a granule predates the transaction, so
+ * the log is walked forwards and later entries are dropped by pushVersion.
+ * Lazy transactions haven't written anything yet.
+ */
+void stm_mv_save(stm_tx *Tx, uint64_t Until) {
+  stm_undo *U = (stm_undo*)Tx->Undo.Data;
+  stm_redo *R = (stm_redo*)Tx->Redo.Data;
+  size_t i;
+
+  __sync_synchronize();
+  if (!Readers)
+    return;
+
+  for (i = 0; i != Tx->Undo.Size; ++i)
+    pushVersion(Tx, U[i].Addr, U[i].Value, Until);
+  for (i = 0; i != Tx->Redo.Size; ++i)
+    pushVersion(Tx, R[i].Addr, *(volatile uintptr_t*)R[i].Addr, Until);
+}
+
+/* readGranule - Read the granule at Addr as of the snapshot of Tx.  Returns
+ * zero if the version needed has been dropped.
+ */
+static int readGranule(stm_tx *Tx, uintptr_t Addr, uintptr_t *Value) {
+  unsigned Index = stm_orec_index(Addr);
+  stm_bucket *B = &Buckets[Index & (MV_BUCKETS - 1)];
+
+  for (;;) {
+    stm_orec_t O = stm_orecs[Index];
+    stm_version *V, *Found = 0;
+    uintptr_t Current;
+
+    if (O & 1) {
+      sched_yield();
+      continue;
+    }
+    __sync_synchronize();
+    Current = *(volatile uintptr_t*)Addr;
+
+    if ((O >> 1) > Tx->SnapshotTime) {
+      /* The oldest version newer than the snapshot is the one to read,
+       * unless an even older one was dropped.
+       */
+      for (V = B->Head; V; V = V->Next) {
+        if (V->Addr != Addr)
+          continue;
+        if (V->Until <= Tx->SnapshotTime)
+          break;
+        Found = V;
+      }
+      if (B->Trimmed > Tx->SnapshotTime)
+        return 0;
+      if (Found) {
+        *Value = Found->Value;
+        return 1;
+      }
+    }
+
+    __sync_synchronize();
+    if (stm_orecs[Index] == O) {
+      *Value = Current;
+      return 1;
+    }
+  }
+}
+
+int stm_mv_read(stm_tx *Tx, uintptr_t Addr, void *Dst, unsigned Size) {
+  unsigned char *D = (unsigned char*)Dst;
+  while (Size) {
+    uintptr_t Granule = Addr & ~(uintptr_t)(CANTM_GRANULE - 1);
+    unsigned Offset = (unsigned)(Addr - Granule);
+    unsigned N = CANTM_GRANULE - Offset < Size ? CANTM_GRANULE - Offset : Size;
+    uintptr_t Value;
+    if (!readGranule(Tx, Granule, &Value))
+      return 0;
+    memcpy(D, (unsigned char*)&Value + Offset, N);
+    Addr += N;
+    D += N;
+    Size -= N;
+  }
+  return 1;
+}
@@ -0,0 +1,943 @@
+/*===-- Transaction.c - CanTM transaction and reservation support ---------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the transaction boundaries and the eager reservation
+|* of read and write sets requested by code instrumented with the -CanTM pass.
+|* Writes are made in place; the original contents are kept in an undo log so
+|* that an aborted transaction can be rolled back and restarted.
+|*
+|* When the -CanTM pass routes every reserved access through the sized
+|* accessors it asks for lazy versioning instead: stores are buffered in a
+|* redo log and written back at commit, so aborts have nothing to undo.
+|*
+|* With CANTM_SIGNATURES=1 read sets are kept as Bloom filter signatures and
+|* validated against the write signatures published by other transactions,
+|* see Signature.c.
+|*
+|* Small transactions may start with stm_begin_htm instead, which first tries
+|* to run them as RTM hardware transactions.  Those only check the orecs of
+|* their reservations, and fall back to the software path when they abort.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "CanTM.h"
+#include "HTM.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+volatile stm_orec_t stm_orecs[CANTM_NUM_ORECS];
+
+static __thread stm_tx *Current;
+static stm_tx *volatile AllTx;
+static pthread_once_t InitOnce = PTHREAD_ONCE_INIT;
+static volatile uint64_t NextID;
+
+/* The serial token.  Irrevocable transactions hold it exclusively, all other
+ * transactions are counted in ActiveCount while they run.
+ */
+static volatile int SerialOwner;
+static volatile unsigned ActiveCount;
+
+static void init(void) {
+  stm_cm_init();
+  stm_htm_init();
+  stm_sig_init();
+  stm_mv_init();
+}
+
+static stm_tx *getTx(void) {
+  if (!Current) {
+    pthread_once(&InitOnce, init);
+    Current = (stm_tx*)calloc(1, sizeof(stm_tx));
+    Current->Seed = (uintptr_t)Current * 0x9E3779B97F4A7C15ULL;
+    do
+      Current->NextTx = AllTx;
+    while (!__sync_bool_compare_and_swap(&AllTx, Current->NextTx, Current));
+  }
+  return Current;
+}
+
+stm_tx *stm_tx_list(void) {
+  return AllTx;
+}
+
+void *stm_vector_push(stm_vector *V, size_t EltSize) {
+  if (V->Size == V->Capacity) {
+    V->Capacity = V->Capacity ? 2 * V->Capacity : 16;
+    V->Data = realloc(V->Data, V->Capacity * EltSize);
+  }
+  return (char*)V->Data + EltSize * V->Size++;
+}
+
+static int isLocked(stm_orec_t O) {
+  return O & 1;
+}
+
+static stm_tx *ownerOf(stm_orec_t O) {
+  return (stm_tx*)(O & ~(stm_orec_t)1);
+}
+
+static void acquireToken(stm_tx *Tx) {
+  if (Tx->Irrevocable) {
+    while (!__sync_bool_compare_and_swap(&SerialOwner, 0, 1))
+      sched_yield();
+    while (ActiveCount)
+      sched_yield();
+    return;
+  }
+
+  for (;;) {
+    while (SerialOwner)
+      sched_yield();
+    __sync_add_and_fetch(&ActiveCount, 1);
+    if (!SerialOwner)
+      return;
+    __sync_sub_and_fetch(&ActiveCount, 1);
+  }
+}
+
+static void releaseToken(stm_tx *Tx) {
+  if (Tx->Irrevocable) {
+    __sync_synchronize();
+    SerialOwner = 0;
+  } else {
+    __sync_sub_and_fetch(&ActiveCount, 1);
+  }
+}
+
+/* killed - Whether a rival's contention manager asked the current run of Tx
+ * to abort.  Requests name the run they were meant for, so one that arrives
+ * after that run has committed is ignored.
+ */
+static int killed(stm_tx *Tx) {
+  return Tx->Kill == Tx->Run;
+}
+
+static void startTx(stm_tx *Tx) {
+  ++Tx->Run;
+  acquireToken(Tx);
+  if (stm_signatures) {
+    stm_sig_clear(&Tx->ReadSig);
+    Tx->SigSeen = stm_sig_now();
+  }
+  if (Tx->Snapshot)
+    stm_mv_begin(Tx);
+  stm_contention_manager->OnBegin(Tx);
+}
+
+/* releaseWrites - Unlock every orec in the write set, bumping its version so
+ * that readers which observed the old one fail validation.  With snapshots
+ * the new version is Stamp, a time from the global clock.
+ */
+static void releaseWrites(stm_tx *Tx, uint64_t Stamp) {
+  stm_entry *W = (stm_entry*)Tx->Writes.Data;
+  size_t i;
+  __sync_synchronize();
+  for (i = 0; i != Tx->Writes.Size; ++i)
+    stm_orecs[W[i].Index] = Stamp ? (stm_orec_t)Stamp << 1 : W[i].Version + 2;
+  Tx->Reads.Size = 0;
+  Tx->Writes.Size = 0;
+  Tx->Undo.Size = 0;
+}
+
+static void rollback(stm_tx *Tx) {
+  stm_undo *U = (stm_undo*)Tx->Undo.Data;
+  size_t i;
+  for (i = Tx->Undo.Size; i != 0; --i)
+    *(volatile uintptr_t*)U[i - 1].Addr = U[i - 1].Value;
+  stm_redo_clear(Tx);
+  releaseWrites(Tx, stm_mv_enabled && Tx->Writes.Size ? stm_mv_tick() : 0);
+  stm_alloc_abort(Tx);
+}
+
+/* restart - Roll the transaction back and resume at its checkpoint, as an
+ * irrevocable transaction if Irrevocable is set.
+ */
+static void restart(stm_tx *Tx, int Irrevocable) {
+  rollback(Tx);
+  if (Tx->Snapshot)
+    stm_mv_end(Tx);
+  releaseToken(Tx);
+  Tx->Nesting = 1;
+  ++Tx->Aborts;
+  stm_contention_manager->OnAbort(Tx);
+  if (Irrevocable)
+    Tx->Irrevocable = 1;
+  startTx(Tx);
+  _longjmp(Tx->Checkpoint, 1);
+}
+
+/* resolveConflict - Tx found the orec at Index holding O, which is owned by
+ * Owner.  Let the contention manager decide what to do; if this returns, Tx
+ * should try again.
+ */
+static void resolveConflict(stm_tx *Tx, unsigned Index, stm_orec_t O,
+                            unsigned Attempt) {
+  stm_tx *Owner = ownerOf(O);
+  uint64_t Run;
+
+  /* An irrevocable transaction is waiting for the others to drain, and the
+   * owner may be it.
+   */
+  if (killed(Tx) || SerialOwner)
+    restart(Tx, 0);
+
+  switch (stm_contention_manager->OnConflict(Tx, Owner, Attempt)) {
+  case STM_CM_RETRY:
+    break;
+  case STM_CM_ABORT_SELF:
+    restart(Tx, 0);
+    break;
+  case STM_CM_ABORT_OTHER:
+    /* Only ask the run that still owns the orec.  The owner notices at its
+     * next reservation, access or commit, so give it time to.
+     */
+    Run = Owner->Run;
+    __sync_synchronize();
+    if (stm_orecs[Index] == O)
+      Owner->Kill = Run;
+    stm_backoff(Tx, Attempt);
+    break;
+  }
+}
+
+static void reserveRead(stm_tx *Tx, unsigned Index) {
+  unsigned Attempt = 0;
+  for (;;) {
+    stm_orec_t O = stm_orecs[Index];
+    if (!isLocked(O) && stm_signatures) {
+      stm_sig_add(&Tx->ReadSig, Index);
+      ++Tx->Karma;
+      return;
+    }
+    if (!isLocked(O)) {
+      stm_entry *R = (stm_entry*)stm_vector_push(&Tx->Reads, sizeof(stm_entry));
+      R->Index = Index;
+      R->Version = O;
+      ++Tx->Karma;
+      return;
+    }
+    if (ownerOf(O) == Tx)
+      return;
+    resolveConflict(Tx, Index, O, Attempt++);
+  }
+}
+
+/* reserveWrite - Acquire the orec at Index.  Returns nonzero if Tx did not
+ * already own it.
+ */
+static int reserveWrite(stm_tx *Tx, unsigned Index) {
+  unsigned Attempt = 0;
+  for (;;) {
+    stm_orec_t O = stm_orecs[Index];
+    if (!isLocked(O)) {
+      if (__sync_bool_compare_and_swap(&stm_orecs[Index], O,
+                                       (stm_orec_t)Tx | 1)) {
+        stm_entry *W = (stm_entry*)stm_vector_push(&Tx->Writes, sizeof(stm_entry));
+        W->Index = Index;
+        W->Version = O;
+        ++Tx->Karma;
+        return 1;
+      }
+      continue;
+    }
+    if (ownerOf(O) == Tx)
+      return 0;
+    resolveConflict(Tx, Index, O, Attempt++);
+  }
+}
+
+/* logGranule - Save the granule holding Addr before it is first written. */
+static void logGranule(stm_tx *Tx, uintptr_t Addr) {
+  stm_undo *U = (stm_undo*)stm_vector_push(&Tx->Undo, sizeof(stm_undo));
+  U->Addr = Addr & ~(uintptr_t)(CANTM_GRANULE - 1);
+  U->Value = *(volatile uintptr_t*)U->Addr;
+}
+
+static stm_orec_t acquiredVersion(stm_tx *Tx, unsigned Index) {
+  stm_entry *W = (stm_entry*)Tx->Writes.Data;
+  size_t i;
+  for (i = 0; i != Tx->Writes.Size; ++i)
+    if (W[i].Index == Index)
+      return W[i].Version;
+  return 1;
+}
+
+/* validate - Check that nothing in the read set changed since it was read. */
+static int validate(stm_tx *Tx) {
+  stm_entry *R = (stm_entry*)Tx->Reads.Data;
+  size_t i;
+  if (stm_signatures)
+    return stm_sig_validate(Tx);
+  for (i = 0; i != Tx->Reads.Size; ++i) {
+    stm_orec_t O = stm_orecs[R[i].Index];
+    if (O == R[i].Version)
+      continue;
+    if (isLocked(O) && ownerOf(O) == Tx &&
+        acquiredVersion(Tx, R[i].Index) == R[i].Version)
+      continue;
+    return 0;
+  }
+  return 1;
+}
+
+static int compareOrecs(const void *LHS, const void *RHS) {
+  unsigned L = stm_orec_index(*(const uintptr_t*)LHS);
+  unsigned R = stm_orec_index(*(const uintptr_t*)RHS);
+  return L < R ? -1 : L > R;
+}
+
+/* sortByOrec - Sort Addrs into acquisition order.  The dynamic part of a
+ * reservation is usually a handful of addresses, for which an insertion sort
+ * beats qsort's indirect comparisons.
+ */
+static void sortByOrec(uintptr_t *Addrs, unsigned Count) {
+  unsigned i, j;
+  if (Count > 16) {
+    qsort(Addrs, Count, sizeof(uintptr_t), compareOrecs);
+    return;
+  }
+  for (i = 1; i < Count; ++i) {
+    uintptr_t A = Addrs[i];
+    unsigned Index = stm_orec_index(A);
+    for (j = i; j && stm_orec_index(Addrs[j - 1]) > Index; --j)
+      Addrs[j] = Addrs[j - 1];
+    Addrs[j] = A;
+  }
+}
+
+/* mergeByOrec - Merge two address lists that are in acquisition order. */
+static void mergeByOrec(const uintptr_t *A, unsigned NA, const uintptr_t *B,
+                        unsigned NB, uintptr_t *Out) {
+  while (NA && NB) {
+    if (stm_orec_index(*B) < stm_orec_index(*A)) {
+      *Out++ = *B++;
+      --NB;
+    } else {
+      *Out++ = *A++;
+      --NA;
+    }
+  }
+  memcpy(Out, A, NA * sizeof(uintptr_t));
+  memcpy(Out + NA, B, NB * sizeof(uintptr_t));
+}
+
+/* reserveWrites - Acquire the orecs of Addrs, which are sorted by orec, and
+ * validate everything reserved so far.  In signature mode the acquisition is
+ * published before anything is written, using Sig if the caller has the
+ * signature of Addrs at hand.
+ */
+static void reserveWrites(stm_tx *Tx, const uintptr_t *Addrs, unsigned Count,
+                          const stm_sig *Sig) {
+  stm_sig Local;
+  int Acquired = 0;
+  unsigned i;
+  for (i = 0; i != Count; ++i) {
+    Acquired |= reserveWrite(Tx, stm_orec_index(Addrs[i]));
+    if (!Tx->Lazy)
+      logGranule(Tx, Addrs[i]);
+  }
+  if (stm_signatures && Acquired) {
+    if (!Sig) {
+      stm_sig_clear(&Local);
+      for (i = 0; i != Count; ++i)
+        stm_sig_add(&Local, stm_orec_index(Addrs[i]));
+      Sig = &Local;
+    }
+    stm_sig_publish(Tx, Sig);
+  }
+  if (Tx->Lazy)
+    stm_redo_reserve(Tx, Count);
+
+  if (!validate(Tx))
+    restart(Tx, 0);
+}
+
+static int inTx(stm_tx *Tx) {
+  return Tx && Tx->Nesting && !Tx->Irrevocable;
+}
+
+/* htmReserve - Subscribe a hardware transaction to an orec.  A locked orec
+ * belongs to a software writer, so give up; writes bump the version so that
+ * software readers notice them once the hardware transaction commits.
+ */
+static void htmReserve(unsigned Index, int IsWrite) {
+  stm_orec_t O = stm_orecs[Index];
+  if (isLocked(O))
+    stm_xabort(STM_XABORT_LOCKED);
+  if (IsWrite)
+    stm_orecs[Index] = O + 2;
+}
+
+void *stm_begin(void) {
+  stm_tx *Tx = getTx();
+  if (Tx->Nesting++)
+    return Tx->Nested;
+
+  Tx->ID = __sync_add_and_fetch(&NextID, 1);
+  Tx->Aborts = 0;
+  Tx->Karma = 0;
+  Tx->Irrevocable = 0;
+  Tx->Lazy = 0;
+  Tx->Snapshot = 0;
+  startTx(Tx);
+  return Tx->Checkpoint;
+}
+
+/* stm_begin_snapshot - Begin a transaction the compiler proved read-only.
+ * With multi-version snapshots enabled it reads the state of memory as of its
+ * start and never validates; otherwise, or when nested, it is an ordinary
+ * transaction.
+ */
+void *stm_begin_snapshot(void) {
+  stm_tx *Tx = getTx();
+  if (Tx->Nesting || !stm_mv_enabled)
+    return stm_begin();
+
+  Tx->Nesting = 1;
+  Tx->ID = __sync_add_and_fetch(&NextID, 1);
+  Tx->Aborts = 0;
+  Tx->Karma = 0;
+  Tx->Irrevocable = 0;
+  Tx->Lazy = 0;
+  Tx->Snapshot = 1;
+  startTx(Tx);
+  return Tx->Checkpoint;
+}
+
+/* stm_begin_htm - Try up to Retries times to run the transaction in hardware
+ * before falling back to stm_begin.  An RTM abort resumes inside this
+ * function with the stack as it was at xbegin, so returning the checkpoint
+ * from here is safe in both modes.
+ */
+void *stm_begin_htm(int retries) {
+  stm_tx *Tx = getTx();
+  unsigned Status;
+  int Attempt;
+
+  if (Tx->Nesting || !stm_htm_supported)
+    return stm_begin();
+
+  for (Attempt = 0; Attempt < retries; ++Attempt) {
+    Status = stm_xbegin();
+    if (Status == STM_XBEGIN_STARTED) {
+      /* Subscribe to the serial token. */
+      if (SerialOwner)
+        stm_xabort(STM_XABORT_LOCKED);
+      Tx->ID = 0;
+      Tx->Nesting = 1;
+      Tx->InHTM = 1;
+      return Tx->Checkpoint;
+    }
+    /* Capacity, user and irrevocability aborts don't go away by retrying. */
+    if (Status & STM_XABORT_CAPACITY)
+      break;
+    if ((Status & STM_XABORT_EXPLICIT) &&
+        STM_XABORT_CODE(Status) != STM_XABORT_LOCKED)
+      break;
+    stm_backoff(Tx, Attempt);
+  }
+  return stm_begin();
+}
+
+void stm_commit(void) {
+  stm_tx *Tx = Current;
+  uint64_t Stamp = 0;
+  if (!Tx || !Tx->Nesting || --Tx->Nesting)
+    return;
+
+  if (Tx->InHTM) {
+    stm_xend();
+    Tx->InHTM = 0;
+    return;
+  }
+
+  if (Tx->Snapshot) {
+    stm_mv_end(Tx);
+    releaseToken(Tx);
+    stm_contention_manager->OnCommit(Tx);
+    return;
+  }
+
+  /* Write-back is the last chance to honour a rival's request to abort. */
+  if (!Tx->Irrevocable && (killed(Tx) || !validate(Tx))) {
+    Tx->Nesting = 1;
+    restart(Tx, 0);
+  }
+  if (stm_mv_enabled && Tx->Writes.Size) {
+    Stamp = stm_mv_tick();
+    stm_mv_save(Tx, Stamp);
+  }
+  stm_redo_writeback(Tx);
+  releaseWrites(Tx, Stamp);
+  stm_alloc_commit(Tx);
+  releaseToken(Tx);
+  stm_contention_manager->OnCommit(Tx);
+  Tx->Irrevocable = 0;
+}
+
+/* stm_irrevocable - Called where a transaction is about to do something that
+ * cannot be rolled back, such as I/O or a call to unknown code.  Take the
+ * serial token, keeping the reservations made so far, and wait for every
+ * other transaction to finish.  If another transaction holds the token, roll
+ * back and restart irrevocably instead.
+ */
+void stm_irrevocable(void) {
+  stm_tx *Tx = Current;
+  if (Tx && Tx->InHTM)
+    stm_xabort(STM_XABORT_IRREVOCABLE);
+  if (!inTx(Tx))
+    return;
+
+  /* Reads after this point would come from the present, not the snapshot. */
+  if (Tx->Snapshot) {
+    stm_mv_end(Tx);
+    Tx->Snapshot = 0;
+    restart(Tx, 1);
+  }
+
+  if (!__sync_bool_compare_and_swap(&SerialOwner, 0, 1))
+    restart(Tx, 1);
+  __sync_sub_and_fetch(&ActiveCount, 1);
+  while (ActiveCount)
+    sched_yield();
+
+  /* stm_commit does not validate an irrevocable transaction, so check the
+   * reads made before the others drained now.  restart() hands the token
+   * back, which it does only for a transaction marked irrevocable.
+   */
+  if (!validate(Tx)) {
+    Tx->Irrevocable = 1;
+    restart(Tx, 1);
+  }
+  Tx->Irrevocable = 1;
+
+  /* From here on accesses go straight to memory. */
+  stm_redo_writeback(Tx);
+  Tx->Lazy = 0;
+}
+
+/* stm_redo_log - Switch the running transaction to lazy versioning.  Called
+ * right after the checkpoint by code in which every reserved access goes
+ * through the sized accessors.
+ */
+void stm_redo_log(void) {
+  stm_tx *Tx = Current;
+  if (inTx(Tx) && !Tx->InHTM)
+    Tx->Lazy = 1;
+}
+
+void stm_abort(void) {
+  stm_tx *Tx = Current;
+  if (Tx && Tx->InHTM)
+    stm_xabort(STM_XABORT_USER);
+  if (inTx(Tx))
+    restart(Tx, 0);
+}
+
+/* stm_reserve - Reserve the read and write sets of a basic block.  The
+ * arguments are the number of loads followed by their addresses, then the
+ * number of stores followed by theirs.  Write orecs are acquired in index
+ * order so two reservations can never deadlock against each other.
+ */
+void stm_reserve(int num_args, ...) {
+  stm_tx *Tx = Current;
+  uintptr_t *Addrs;
+  va_list vl;
+  int i, NumLoads, NumStores;
+
+  if (!inTx(Tx) || Tx->Snapshot)
+    return;
+
+  if (Tx->InHTM) {
+    va_start(vl, num_args);
+    NumLoads = va_arg(vl, int);
+    for (i = 0; i != NumLoads; ++i)
+      htmReserve(stm_orec_index(va_arg(vl, uintptr_t)), 0);
+    NumStores = va_arg(vl, int);
+    for (i = 0; i != NumStores; ++i)
+      htmReserve(stm_orec_index(va_arg(vl, uintptr_t)), 1);
+    va_end(vl);
+    return;
+  }
+
+  if (killed(Tx))
+    restart(Tx, 0);
+
+  va_start(vl, num_args);
+  NumLoads = va_arg(vl, int);
+  for (i = 0; i != NumLoads; ++i)
+    reserveRead(Tx, stm_orec_index(va_arg(vl, uintptr_t)));
+
+  Tx->Pending.Size = 0;
+  NumStores = va_arg(vl, int);
+  for (i = 0; i != NumStores; ++i)
+    *(uintptr_t*)stm_vector_push(&Tx->Pending, sizeof(uintptr_t)) =
+      va_arg(vl, uintptr_t);
+  va_end(vl);
+
+  Addrs = (uintptr_t*)Tx->Pending.Data;
+  sortByOrec(Addrs, NumStores);
+  reserveWrites(Tx, Addrs, NumStores, 0);
+}
+
+/* sitePlan - Return the cached plan of Site, building it if this is the
+ * first time the site is reached.  The plan holds the signature of the
+ * stores, the store addresses sorted by orec, and the orec indices of the
+ * loads.  Threads racing to build it compute the same thing, so the loser
+ * just drops its copy.
+ */
+static stm_sig *sitePlan(stm_site *Site) {
+  stm_sig *Sig;
+  uintptr_t *Writes;
+  unsigned *Reads;
+  void *Plan = Site->Plan;
+  unsigned i;
+
+  if (Plan)
+    return (stm_sig*)Plan;
+
+  Plan = malloc(sizeof(stm_sig) + Site->NumStores * sizeof(uintptr_t) +
+                Site->NumLoads * sizeof(unsigned));
+  Sig = (stm_sig*)Plan;
+  Writes = (uintptr_t*)(Sig + 1);
+  Reads = (unsigned*)(Writes + Site->NumStores);
+  memcpy(Writes, Site->Addrs + Site->NumLoads,
+         Site->NumStores * sizeof(uintptr_t));
+  qsort(Writes, Site->NumStores, sizeof(uintptr_t), compareOrecs);
+  stm_sig_clear(Sig);
+  for (i = 0; i != Site->NumStores; ++i)
+    stm_sig_add(Sig, stm_orec_index(Writes[i]));
+  for (i = 0; i != Site->NumLoads; ++i)
+    Reads[i] = stm_orec_index(Site->Addrs[i]);
+
+  if (!__sync_bool_compare_and_swap(&Site->Plan, (void*)0, Plan)) {
+    free(Plan);
+    Plan = Site->Plan;
+  }
+  return (stm_sig*)Plan;
+}
+
+/* stm_reserve_site - Reserve a constant address set described by a table
+ * emitted by the -CanTM pass.  Same as stm_reserve, minus the hashing and
+ * sorting after the first time.
+ */
+void stm_reserve_site(stm_site *site) {
+  stm_tx *Tx = Current;
+  const stm_sig *Sig;
+  const uintptr_t *Writes;
+  const unsigned *Reads;
+  unsigned i;
+
+  if (!inTx(Tx) || Tx->Snapshot)
+    return;
+
+  Sig = sitePlan(site);
+  Writes = (const uintptr_t*)(Sig + 1);
+  Reads = (const unsigned*)(Writes + site->NumStores);
+
+  if (Tx->InHTM) {
+    for (i = 0; i != site->NumLoads; ++i)
+      htmReserve(Reads[i], 0);
+    for (i = 0; i != site->NumStores; ++i)
+      htmReserve(stm_orec_index(Writes[i]), 1);
+    return;
+  }
+
+  if (killed(Tx))
+    restart(Tx, 0);
+
+  for (i = 0; i != site->NumLoads; ++i)
+    reserveRead(Tx, Reads[i]);
+  reserveWrites(Tx, Writes, site->NumStores, Sig);
+}
+
+/* stm_reserve_partial - Reserve a set of which the -CanTM pass could only
+ * tabulate part: the globals are described by Site, whose plan is already in
+ * acquisition order, and the remaining addresses follow as for stm_reserve.
+ * Only those are sorted here, then merged with the plan.
+ */
+void stm_reserve_partial(stm_site *site, int num_args, ...) {
+  stm_tx *Tx = Current;
+  const stm_sig *Sig;
+  const uintptr_t *Writes;
+  const unsigned *Reads;
+  uintptr_t *Addrs;
+  va_list vl;
+  unsigned i, NumLoads, NumStores;
+
+  if (!inTx(Tx) || Tx->Snapshot)
+    return;
+
+  Sig = sitePlan(site);
+  Writes = (const uintptr_t*)(Sig + 1);
+  Reads = (const unsigned*)(Writes + site->NumStores);
+
+  if (Tx->InHTM) {
+    for (i = 0; i != site->NumLoads; ++i)
+      htmReserve(Reads[i], 0);
+    for (i = 0; i != site->NumStores; ++i)
+      htmReserve(stm_orec_index(Writes[i]), 1);
+    va_start(vl, num_args);
+    NumLoads = va_arg(vl, int);
+    for (i = 0; i != NumLoads; ++i)
+      htmReserve(stm_orec_index(va_arg(vl, uintptr_t)), 0);
+    NumStores = va_arg(vl, int);
+    for (i = 0; i != NumStores; ++i)
+      htmReserve(stm_orec_index(va_arg(vl, uintptr_t)), 1);
+    va_end(vl);
+    return;
+  }
+
+  if (killed(Tx))
+    restart(Tx, 0);
+
+  for (i = 0; i != site->NumLoads; ++i)
+    reserveRead(Tx, Reads[i]);
+  va_start(vl, num_args);
+  NumLoads = va_arg(vl, int);
+  for (i = 0; i != NumLoads; ++i)
+    reserveRead(Tx, stm_orec_index(va_arg(vl, uintptr_t)));
+
+  /* The dynamic stores go first in Pending, the merged list after them. */
+  Tx->Pending.Size = 0;
+  NumStores = va_arg(vl, int);
+  for (i = 0; i != NumStores; ++i)
+    *(uintptr_t*)stm_vector_push(&Tx->Pending, sizeof(uintptr_t)) =
+      va_arg(vl, uintptr_t);
+  va_end(vl);
+  for (i = 0; i != NumStores + site->NumStores; ++i)
+    stm_vector_push(&Tx->Pending, sizeof(uintptr_t));
+
+  Addrs = (uintptr_t*)Tx->Pending.Data;
+  sortByOrec(Addrs, NumStores);
+  mergeByOrec(Writes, site->NumStores, Addrs, NumStores, Addrs + NumStores);
+  reserveWrites(Tx, Addrs + NumStores, NumStores + site->NumStores, 0);
+}
+
+static int compareSpans(const void *LHS, const void *RHS) {
+  uintptr_t L = ((const stm_span*)LHS)->Begin;
+  uintptr_t R = ((const stm_span*)RHS)->Begin;
+  return L < R ? -1 : L > R;
+}
+
+/* readSpans - Pop a count and that many (address, length) pairs off Args
+ * into Tx->Spans, widened to cache lines, and merge the ones that overlap or
+ * touch.  Returns the number of spans left.
+ */
+static unsigned readSpans(stm_tx *Tx, va_list *Args) {
+  stm_span *S;
+  unsigned i, Count = va_arg(*Args, int), Kept = 0;
+
+  Tx->Spans.Size = 0;
+  for (i = 0; i != Count; ++i) {
+    uintptr_t Addr = va_arg(*Args, uintptr_t);
+    uintptr_t Len = va_arg(*Args, uintptr_t);
+    if (!Len)
+      continue;
+    S = (stm_span*)stm_vector_push(&Tx->Spans, sizeof(stm_span));
+    S->Begin = Addr & ~(uintptr_t)(CANTM_LINE - 1);
+    S->End = (Addr + Len + CANTM_LINE - 1) & ~(uintptr_t)(CANTM_LINE - 1);
+  }
+
+  S = (stm_span*)Tx->Spans.Data;
+  if (Tx->Spans.Size > 1)
+    qsort(S, Tx->Spans.Size, sizeof(stm_span), compareSpans);
+  for (i = 0; i != Tx->Spans.Size; ++i) {
+    if (Kept && S[i].Begin <= S[Kept - 1].End) {
+      if (S[i].End > S[Kept - 1].End)
+        S[Kept - 1].End = S[i].End;
+    } else {
+      S[Kept++] = S[i];
+    }
+  }
+  return Kept;
+}
+
+/* stm_reserve_ranges - Reserve the memory touched by memcpy, memmove and
+ * memset.  The arguments are the number of ranges read followed by an
+ * address and a length for each, then the same for the ranges written.
+ * Ranges are reserved in whole cache lines, so the copies of a record that
+ * lie on the same lines are reserved together.
+ */
+void stm_reserve_ranges(int num_args, ...) {
+  stm_tx *Tx = Current;
+  stm_span *S;
+  uintptr_t G;
+  va_list vl;
+  unsigned i, Count, Last;
+
+  if (!inTx(Tx) || Tx->Snapshot)
+    return;
+  if (!Tx->InHTM && killed(Tx))
+    restart(Tx, 0);
+
+  va_start(vl, num_args);
+  Count = readSpans(Tx, &vl);
+  S = (stm_span*)Tx->Spans.Data;
+  for (i = 0; i != Count; ++i) {
+    for (G = S[i].Begin, Last = ~0u; G != S[i].End; G += CANTM_GRANULE) {
+      if (Tx->InHTM)
+        htmReserve(stm_orec_index(G), 0);
+      else if (stm_orec_index(G) != Last)
+        reserveRead(Tx, stm_orec_index(G));
+      Last = stm_orec_index(G);
+    }
+  }
+
+  Count = readSpans(Tx, &vl);
+  va_end(vl);
+  S = (stm_span*)Tx->Spans.Data;
+  Tx->Pending.Size = 0;
+  for (i = 0; i != Count; ++i) {
+    for (G = S[i].Begin; G != S[i].End; G += CANTM_GRANULE) {
+      if (Tx->InHTM)
+        htmReserve(stm_orec_index(G), 1);
+      else
+        *(uintptr_t*)stm_vector_push(&Tx->Pending, sizeof(uintptr_t)) = G;
+    }
+  }
+  if (Tx->InHTM)
+    return;
+
+  /* Spans are sorted and disjoint, so this is only out of order where the
+   * orec table wraps around.
+   */
+  sortByOrec((uintptr_t*)Tx->Pending.Data, Tx->Pending.Size);
+  reserveWrites(Tx, (uintptr_t*)Tx->Pending.Data, Tx->Pending.Size, 0);
+}
+
+static void load(uintptr_t Addr, void *Dst, unsigned Size) {
+  stm_tx *Tx = Current;
+  if (Tx && Tx->InHTM) {
+    htmReserve(stm_orec_index(Addr), 0);
+  } else if (inTx(Tx) && Tx->Snapshot) {
+    if (!stm_mv_read(Tx, Addr, Dst, Size))
+      restart(Tx, 0);
+    return;
+  } else if (inTx(Tx)) {
+    /* Validate after copying, so that a writer that slipped in between the
+     * orec and the data is caught.
+     */
+    if (killed(Tx))
+      restart(Tx, 0);
+    reserveRead(Tx, stm_orec_index(Addr));
+    __sync_synchronize();
+    if (Tx->Lazy)
+      stm_redo_read(Tx, Addr, Dst, Size);
+    else
+      memcpy(Dst, (const void*)Addr, Size);
+    __sync_synchronize();
+    if (!validate(Tx))
+      restart(Tx, 0);
+    return;
+  }
+  memcpy(Dst, (const void*)Addr, Size);
+}
+
+static void store(uintptr_t Addr, const void *Src, unsigned Size) {
+  stm_tx *Tx = Current;
+  if (Tx && Tx->InHTM) {
+    htmReserve(stm_orec_index(Addr), 1);
+  } else if (inTx(Tx)) {
+    unsigned Index = stm_orec_index(Addr);
+    if (killed(Tx))
+      restart(Tx, 0);
+    if (reserveWrite(Tx, Index) && stm_signatures) {
+      stm_sig Sig;
+      stm_sig_clear(&Sig);
+      stm_sig_add(&Sig, Index);
+      stm_sig_publish(Tx, &Sig);
+    }
+    if (Tx->Lazy) {
+      stm_redo_write(Tx, Addr, Src, Size);
+      return;
+    }
+    logGranule(Tx, Addr);
+  }
+  memcpy((void*)Addr, Src, Size);
+}
+
+int stm_load(uintptr_t addr) {
+  int Val;
+  load(addr, &Val, sizeof(Val));
+  return Val;
+}
+
+void stm_store(int val, uintptr_t addr) {
+  store(addr, &val, sizeof(val));
+}
+
+uint8_t stm_load8(const void *addr) {
+  uint8_t Val;
+  load((uintptr_t)addr, &Val, sizeof(Val));
+  return Val;
+}
+
+uint16_t stm_load16(const void *addr) {
+  uint16_t Val;
+  load((uintptr_t)addr, &Val, sizeof(Val));
+  return Val;
+}
+
+uint32_t stm_load32(const void *addr) {
+  uint32_t Val;
+  load((uintptr_t)addr, &Val, sizeof(Val));
+  return Val;
+}
+
+uint64_t stm_load64(const void *addr) {
+  uint64_t Val;
+  load((uintptr_t)addr, &Val, sizeof(Val));
+  return Val;
+}
+
+void stm_store8(uint8_t val, void *addr) {
+  store((uintptr_t)addr, &val, sizeof(val));
+}
+
+void stm_store16(uint16_t val, void *addr) {
+  store((uintptr_t)addr, &val, sizeof(val));
+}
+
+void stm_store32(uint32_t val, void *addr) {
+  store((uintptr_t)addr, &val, sizeof(val));
+}
+
+void stm_store64(uint64_t val, void *addr) {
+  store((uintptr_t)addr, &val, sizeof(val));
+}
+
+uint64_t stm_tx_id(void) {
+  stm_tx *Tx = Current;
+  return Tx && Tx->Nesting ? Tx->ID : 0;
+}
+
+/* stm_malloc/stm_free - Replacements for malloc, free and the C++ operators
+ * new and delete inside transactions.  Hardware and irrevocable transactions
+ * can never be rolled back by the runtime, so they use the system allocator
+ * directly.
+ */
+void *stm_malloc(size_t size) {
+  stm_tx *Tx = Current;
+  if (inTx(Tx) && !Tx->InHTM)
+    return stm_pool_alloc(Tx, size);
+  return malloc(size);
+}
+
+void stm_free(void *ptr) {
+  stm_tx *Tx = Current;
+  if (inTx(Tx) && !Tx->InHTM)
+    stm_pool_free(Tx, ptr);
+  else
+    free(ptr);
+}
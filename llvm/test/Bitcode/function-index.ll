@@ -0,0 +1,54 @@
+; RUN: llvm-as < %s | llvm-dis > %t.ref.ll
+; RUN: llvm-as -bitcode-function-index < %s > %t.bc
+; RUN: llvm-as -bitcode-function-index -bitcode-writer-threads=2 < %s > %t.threads.bc
+; RUN: llvm-bcanalyzer -dump %t.bc |& FileCheck %s
+
+; The streaming reader in llvm-dis skips the index, as readers that predate it
+; do; -lazy-bitcode reads every body through it.
+; RUN: llvm-dis < %t.bc | diff %t.ref.ll -
+; RUN: opt -lazy-bitcode -lower-expect %t.bc -o - | llvm-dis | diff %t.ref.ll -
+; RUN: opt -lazy-bitcode -lower-expect %t.threads.bc -o - | llvm-dis | diff %t.ref.ll -
+
+; CHECK: <FNINDEX
+; CHECK: <FUNCTION_INDEX_BLOCK
+; CHECK-NEXT: <ENTRY
+; CHECK-NEXT: <ENTRY
+; CHECK-NEXT: <ENTRY
+; CHECK-NEXT: </FUNCTION_INDEX_BLOCK>
+
+@table = internal constant [2 x i8*] [i8* blockaddress(@jump, %a), i8* blockaddress(@jump, %b)]
+
+declare i32 @external(i32)
+
+define i32 @jump(i32 %i) {
+entry:
+  %slot = getelementptr [2 x i8*]* @table, i32 0, i32 %i
+  %target = load i8** %slot
+  indirectbr i8* %target, [label %a, label %b]
+a:
+  ret i32 1
+b:
+  ret i32 2
+}
+
+define i32 @sum(i32 %n) {
+entry:
+  br label %body
+body:
+  %i = phi i32 [ 0, %entry ], [ %next, %body ]
+  %acc = phi i32 [ 0, %entry ], [ %s, %body ]
+  %s = add i32 %acc, %i
+  %next = add i32 %i, 1
+  %done = icmp eq i32 %next, %n
+  br i1 %done, label %exit, label %body
+exit:
+  ret i32 %s
+}
+
+define i32 @main() {
+  %a = call i32 @sum(i32 10)
+  %b = call i32 @jump(i32 1)
+  %c = call i32 @external(i32 %b)
+  %r = add i32 %a, %c
+  ret i32 %r
+}
@@ -0,0 +1,32 @@
+; RUN: llvm-as < %s > %t.bc
+; RUN: opt -lower-expect %t.bc -o - | llvm-dis > %t.serial.ll
+; RUN: opt -lazy-bitcode -lower-expect %t.bc -o - | llvm-dis > %t.lazy.ll
+; RUN: diff %t.serial.ll %t.lazy.ll
+; RUN: FileCheck %s < %t.lazy.ll
+
+; -lower-expect changes none of these functions, so -lazy-bitcode drops each
+; body again once it has run.  The blockaddresses taken before and after their
+; target has been read must both survive.
+
+; CHECK: define i8* @before()
+; CHECK: ret i8* blockaddress(@jump, %one)
+define i8* @before() {
+  ret i8* blockaddress(@jump, %one)
+}
+
+; CHECK: define i32 @jump(i8* %target)
+; CHECK: indirectbr i8* %target, [label %one, label %two]
+define i32 @jump(i8* %target) {
+entry:
+  indirectbr i8* %target, [label %one, label %two]
+one:
+  ret i32 1
+two:
+  ret i32 2
+}
+
+; CHECK: define i8* @after()
+; CHECK: ret i8* blockaddress(@jump, %two)
+define i8* @after() {
+  ret i8* blockaddress(@jump, %two)
+}
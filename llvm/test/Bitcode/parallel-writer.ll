@@ -0,0 +1,66 @@
+; RUN: llvm-as < %s > %t.serial.bc
+; RUN: llvm-as -bitcode-writer-threads=3 < %s > %t.parallel.bc
+; RUN: cmp %t.serial.bc %t.parallel.bc
+; RUN: llvm-dis < %t.parallel.bc | FileCheck %s
+
+; Function blocks encoded on several threads must come out byte for byte
+; the same as the serial writer's.
+
+@table = internal constant [2 x i8*] [i8* blockaddress(@dispatch, %a), i8* blockaddress(@dispatch, %b)]
+@counter = global i32 0
+
+; CHECK: define i32 @dispatch(i32 %i)
+define i32 @dispatch(i32 %i) {
+entry:
+  %slot = getelementptr [2 x i8*]* @table, i32 0, i32 %i
+  %target = load i8** %slot
+  indirectbr i8* %target, [label %a, label %b]
+a:
+  ret i32 1
+b:
+  ret i32 2
+}
+
+; CHECK: define double @mix(double %x, float %y)
+define double @mix(double %x, float %y) {
+  %e = fpext float %y to double
+  %s = fadd double %x, %e
+  %m = fmul double %s, 2.500000e-01
+  ret double %m, !dbg !0
+}
+
+; CHECK: define i32 @loop(i32 %n)
+define i32 @loop(i32 %n) {
+entry:
+  br label %body
+body:
+  %i = phi i32 [ 0, %entry ], [ %next, %body ]
+  %acc = phi i32 [ 0, %entry ], [ %sum, %body ]
+  %sum = add i32 %acc, %i
+  %next = add nsw i32 %i, 1
+  %done = icmp eq i32 %next, %n
+  br i1 %done, label %exit, label %body, !prof !1
+exit:
+  %old = load i32* @counter
+  store i32 %sum, i32* @counter
+  switch i32 %old, label %other [ i32 0, label %zero
+                                  i32 7, label %seven ]
+zero:
+  ret i32 0
+seven:
+  ret i32 7
+other:
+  ret i32 %sum
+}
+
+; CHECK: define void @calls()
+define void @calls() {
+  %r = call i32 @loop(i32 10)
+  %d = call double @mix(double 1.000000e+00, float 2.000000e+00)
+  %f = call i32 @dispatch(i32 %r)
+  ret void
+}
+
+!0 = metadata !{i32 1, i32 2, metadata !2, null}
+!1 = metadata !{metadata !"branch_weights", i32 4, i32 64}
+!2 = metadata !{metadata !"scope"}
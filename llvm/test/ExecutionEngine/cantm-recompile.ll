@@ -0,0 +1,82 @@
+; RUN: %lli -cantm %s 2> /dev/null | FileCheck %s
+
+; With the JIT, -cantm instruments the module when the first transaction is
+; compiled, here foo_bump. @bump already ran by then and is only reached
+; from tx_run, so it has to be recompiled for its reservation to count.
+; The runtime is stood in for by the functions below.
+
+; CHECK: reserved 2
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@g = global i32 0
+@reserved = global i32 0
+@checkpoint = global [512 x i8] zeroinitializer
+@fmt = private constant [13 x i8] c"reserved %d\0A\00"
+
+declare i32 @printf(i8*, ...)
+
+define i8* @stm_begin() {
+  ret i8* getelementptr ([512 x i8]* @checkpoint, i64 0, i64 0)
+}
+
+define i8* @stm_begin_htm(i32 %retries) {
+  ret i8* getelementptr ([512 x i8]* @checkpoint, i64 0, i64 0)
+}
+
+define void @stm_commit() {
+  ret void
+}
+
+define void @stm_reserve_site(i8* %site) {
+  %n = load i32* @reserved
+  %n1 = add i32 %n, 1
+  store i32 %n1, i32* @reserved
+  ret void
+}
+
+define void @stm_reserve(i32 %n, ...) {
+  ret void
+}
+
+define void @stm_reserve_partial(i8* %site, i32 %n, ...) {
+  call void @stm_reserve_site(i8* %site)
+  ret void
+}
+
+define void @stm_reserve_ranges(i32 %n, ...) {
+  ret void
+}
+
+define void @stm_irrevocable() {
+  ret void
+}
+
+define void @foo_bump() {
+  %x = load i32* @g
+  %x1 = add i32 %x, 1
+  store i32 %x1, i32* @g
+  ret void
+}
+
+define void @bump() {
+  %x = load i32* @g
+  %x1 = add i32 %x, 2
+  store i32 %x1, i32* @g
+  ret void
+}
+
+define void @tx_run() {
+  call void @bump()
+  ret void
+}
+
+define i32 @main() {
+  call void @bump()
+  call void @foo_bump()
+  call void @tx_run()
+  %n = load i32* @reserved
+  %f = getelementptr [13 x i8]* @fmt, i64 0, i64 0
+  call i32 (i8*, ...)* @printf(i8* %f, i32 %n)
+  ret i32 0
+}
@@ -0,0 +1,111 @@
+; RUN: %lli -force-interpreter %s | FileCheck %s
+; RUN: %lli -force-interpreter -interpreter-threaded-code=false %s | FileCheck %s
+; RUN: %lli -tiered -tier-threshold=10 -tier-in-background=false %s | FileCheck %s
+
+; CHECK: sum 4950 classify 30 indirect 76 depth 50000 div -9223372036854775808 0
+
+; The interpreter takes a module without a layout to be big-endian, and would
+; then load @ops the wrong way round.
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@format = internal constant [45 x i8] c"sum %d classify %d indirect %d depth %d div \00"
+@format.div = internal constant [10 x i8] c"%lld %lld\00"
+@newline = internal constant [2 x i8] c"\0A\00"
+@min = global i64 -9223372036854775808
+@minus.one = global i64 -1
+@ops = internal global [2 x i32 (i32)*] [i32 (i32)* @twice, i32 (i32)* @plus.one]
+
+declare i32 @printf(i8*, ...)
+
+define internal i32 @sum(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %acc = phi i32 [ 0, %entry ], [ %add, %loop ]
+  %add = add i32 %acc, %i
+  %next = add i32 %i, 1
+  %done = icmp eq i32 %next, %n
+  br i1 %done, label %exit, label %loop
+exit:
+  ret i32 %add
+}
+
+define internal i32 @classify(i32 %x) {
+  switch i32 %x, label %other [ i32 0, label %zero
+                                i32 1, label %one
+                                i32 7, label %seven ]
+zero:
+  ret i32 1
+one:
+  ret i32 2
+seven:
+  ret i32 4
+other:
+  ret i32 8
+}
+
+define internal i32 @twice(i32 %x) {
+  %r = mul i32 %x, 2
+  ret i32 %r
+}
+
+define internal i32 @plus.one(i32 %x) {
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+; Deep enough to overflow the C stack if every level ran as threaded code.
+define internal i32 @depth(i32 %n) {
+  %stop = icmp eq i32 %n, 0
+  br i1 %stop, label %base, label %recurse
+base:
+  ret i32 0
+recurse:
+  %m = sub i32 %n, 1
+  %d = call i32 @depth(i32 %m)
+  %r = add i32 %d, 1
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  %total = phi i32 [ 0, %entry ], [ %total.next, %loop ]
+  %s = call i32 @sum(i32 100)
+  %c = call i32 @classify(i32 %i)
+  %acc.next = add i32 %acc, %c
+  %slot = getelementptr [2 x i32 (i32)*]* @ops, i32 0, i32 %i
+  %op = load i32 (i32)** %slot
+  %v = call i32 %op(i32 25)
+  %total.next = add i32 %total, %v
+  %next = add i32 %i, 1
+  %again = icmp ult i32 %next, 2
+  br i1 %again, label %loop, label %more
+more:
+  %c7 = call i32 @classify(i32 7)
+  %c9 = call i32 @classify(i32 9)
+  %c3 = call i32 @classify(i32 3)
+  %c.1 = add i32 %acc.next, %c7
+  %c.2 = add i32 %c.1, %c9
+  %c.3 = add i32 %c.2, %c3
+  %c.4 = mul i32 %c.3, 1
+  %c.5 = add i32 %c.4, 7
+  %d = call i32 @depth(i32 50000)
+  %f = getelementptr [45 x i8]* @format, i32 0, i32 0
+  %p = call i32 (i8*, ...)* @printf(i8* %f, i32 %s, i32 %c.5, i32 %total.next, i32 %d)
+
+  ; INT64_MIN / -1 must not trap.
+  %min = load i64* @min
+  %minus.one = load i64* @minus.one
+  %q = sdiv i64 %min, %minus.one
+  %r = srem i64 %min, %minus.one
+  %fd = getelementptr [10 x i8]* @format.div, i32 0, i32 0
+  %p2 = call i32 (i8*, ...)* @printf(i8* %fd, i64 %q, i64 %r)
+  %nl = getelementptr [2 x i8]* @newline, i32 0, i32 0
+  %p3 = call i32 (i8*, ...)* @printf(i8* %nl)
+  ret i32 0
+}
@@ -0,0 +1,51 @@
+; RUN: %lli -tiered -tier-threshold=10 -tier-in-background=false -stats %s \
+; RUN:   > %t.out 2> %t.stats
+; RUN: FileCheck %s < %t.out
+; RUN: FileCheck %s -check-prefix=STATS < %t.stats
+; REQUIRES: asserts
+
+; Hot functions are compiled, and later calls to them run the native code.
+; The module's layout is the x86-64 one minus the preferred and stack
+; alignments and native integer widths, which don't change where data is.
+
+; CHECK: total 24750
+; STATS: interpreter {{ *}}- Number of calls to native code when tiered
+; STATS: tier-up {{ *}}- Number of hot functions compiled
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@format = internal constant [10 x i8] c"total %d\0A\00"
+@total = internal global i32 0
+
+declare i32 @printf(i8*, ...)
+
+define internal void @add(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %old = load i32* @total
+  %new = add i32 %old, %i
+  store i32 %new, i32* @total
+  %next = add i32 %i, 1
+  %done = icmp eq i32 %next, %n
+  br i1 %done, label %exit, label %loop
+exit:
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  call void @add(i32 10)
+  %next = add i32 %i, 1
+  %done = icmp eq i32 %next, 550
+  br i1 %done, label %exit, label %loop
+exit:
+  %t = load i32* @total
+  %f = getelementptr [10 x i8]* @format, i32 0, i32 0
+  call i32 (i8*, ...)* @printf(i8* %f, i32 %t)
+  ret i32 0
+}
@@ -0,0 +1,42 @@
+; RUN: llvm-as < %s > %t.a.bc
+; RUN: llvm-as < %p/parallel-b.ll > %t.b.bc
+; RUN: echo "@shared = weak global i32 3 define i32 @c() { ret i32 3 }" | llvm-as > %t.c.bc
+; RUN: echo "define linkonce i32 @pick() { ret i32 4 } define i32 @d() { ret i32 4 }" | llvm-as > %t.d.bc
+; RUN: llvm-link -S %t.a.bc %t.b.bc %t.c.bc %t.d.bc -o %t.serial.ll
+; RUN: llvm-link -j 2 -S %t.a.bc %t.b.bc %t.c.bc %t.d.bc -o %t.j2.ll
+; RUN: llvm-link -j 3 -S %t.a.bc %t.b.bc %t.c.bc %t.d.bc -o %t.j3.ll
+; RUN: diff %t.serial.ll %t.j2.ll
+; RUN: diff %t.serial.ll %t.j3.ll
+; RUN: FileCheck %s < %t.j2.ll
+
+; Linking on threads keeps the command line order: the first weak and
+; linkonce definitions win, and appending globals keep their order.
+
+; CHECK: @shared = weak global i32 1
+; CHECK: @llvm.global_ctors = appending global [2 x { i32, void ()* }] [{ i32, void ()* } { i32 65535, void ()* @init_a }, { i32, void ()* } { i32 65535, void ()* @init_b }]
+; CHECK: define linkonce i32 @pick()
+; CHECK-NEXT: ret i32 1
+
+@shared = weak global i32 1
+@llvm.global_ctors = appending global [1 x { i32, void ()* }] [{ i32, void ()* } { i32 65535, void ()* @init_a }]
+
+define linkonce i32 @pick() {
+  ret i32 1
+}
+
+define internal void @init_a() {
+  store i32 10, i32* @shared
+  ret void
+}
+
+define i32 @a() {
+  %p = call i32 @pick()
+  %b = call i32 @b()
+  %d = call i32 @d()
+  %s = add i32 %p, %b
+  %r = add i32 %s, %d
+  ret i32 %r
+}
+
+declare i32 @b()
+declare i32 @d()
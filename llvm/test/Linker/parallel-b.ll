@@ -0,0 +1,23 @@
+; This file is for use with parallel-a.ll
+; RUN: true
+
+@shared = weak global i32 2
+@llvm.global_ctors = appending global [1 x { i32, void ()* }] [{ i32, void ()* } { i32 65535, void ()* @init_b }]
+
+define linkonce i32 @pick() {
+  ret i32 2
+}
+
+define internal void @init_b() {
+  %v = load i32* @shared
+  %w = add i32 %v, 1
+  store i32 %w, i32* @shared
+  ret void
+}
+
+define i32 @b() {
+  %c = call i32 @c()
+  ret i32 %c
+}
+
+declare i32 @c()
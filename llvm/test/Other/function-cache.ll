@@ -0,0 +1,39 @@
+; RUN: rm -rf %t.cache
+; RUN: opt -function-cache=%t.cache -gvn -instcombine -stats -S < %s > %t.1.ll 2> %t.1.stats
+; RUN: FileCheck -check-prefix=MISS < %t.1.stats %s
+; RUN: opt -function-cache=%t.cache -gvn -instcombine -stats -S < %s > %t.2.ll 2> %t.2.stats
+; RUN: FileCheck -check-prefix=HIT < %t.2.stats %s
+; RUN: diff %t.1.ll %t.2.ll
+
+; Any other option may change what the passes do, so it misses the cache.
+; RUN: opt -function-cache=%t.cache -gvn -enable-load-pre=false -instcombine -stats -S < %s > %t.3.ll 2> %t.3.stats
+; RUN: FileCheck -check-prefix=MISS < %t.3.stats %s
+; RUN: diff %t.1.ll %t.3.ll
+; REQUIRES: asserts
+
+; MISS-NOT: taken from the cache
+; MISS: 2 function-cache - Number of functions optimized
+; MISS-NOT: taken from the cache
+
+; HIT-NOT: optimized
+; HIT: 2 function-cache - Number of functions taken from the cache
+; HIT-NOT: optimized
+
+@counter = internal global i32 0
+
+define i32 @twice(i32 %x) {
+  %a = add i32 %x, 0
+  %b = load i32* @counter
+  %c = load i32* @counter
+  %d = add i32 %b, %c
+  %e = add i32 %a, %d
+  ret i32 %e
+}
+
+define void @bump() {
+  %v = load i32* @counter
+  %w = add i32 %v, 1
+  store i32 %w, i32* @counter
+  %r = call i32 @twice(i32 %w)
+  ret void
+}
@@ -0,0 +1,35 @@
+; RUN: opt -basicaa -gvn -instcombine -mem2reg -S %s -o %t.serial
+; RUN: opt -j 2 -basicaa -gvn -instcombine -mem2reg -S %s -o %t.parallel 2> %t.err
+; RUN: count 0 < %t.err
+; RUN: diff %t.serial %t.parallel
+; RUN: not opt -j 2 -tsan %s -o /dev/null |& FileCheck %s
+
+; opt -j only runs passes that change nothing but the function they run on.
+; CHECK: -j can't run the pass '-tsan'
+
+@counter = internal global i32 0
+@.str = private constant [4 x i8] c"abc\00"
+
+define internal i32 @load_twice(i32* %p) {
+  %a = load i32* %p
+  %b = load i32* %p
+  %c = add i32 %a, %b
+  ret i32 %c
+}
+
+define i32 @bump(i32 %x) {
+  %slot = alloca i32
+  store i32 %x, i32* %slot
+  %v = load i32* %slot
+  %old = load i32* @counter
+  %new = add i32 %old, %v
+  store i32 %new, i32* @counter
+  %r = call i32 @load_twice(i32* @counter)
+  ret i32 %r
+}
+
+define i8* @name(i32 %x) {
+  %m = mul i32 %x, 1
+  %p = getelementptr [4 x i8]* @.str, i32 0, i32 %m
+  ret i8* %p
+}
@@ -0,0 +1,21 @@
+; RUN: opt < %s -instcombine -globaldce -time-passes-trace=%t -disable-output
+; RUN: FileCheck %s < %t
+
+; Each run of a pass is a begin event naming the function or module it ran
+; on, followed by an end event with the change in instruction count.
+
+; CHECK: {"traceEvents":[
+; CHECK-NEXT: {"name":"Combine redundant instructions","cat":"function","ph":"B","pid":0,"tid":0,"ts":{{[0-9.]+}},"args":{"function":"add_zero"}},
+; CHECK-NEXT: {"name":"Combine redundant instructions","cat":"function","ph":"E","pid":0,"tid":0,"ts":{{[0-9.]+}},"args":{"instructions":-1,"heap":{{-?[0-9]+}}}},
+; CHECK: {"name":"Dead Global Elimination","cat":"module","ph":"B","pid":0,"tid":0,"ts":{{[0-9.]+}},"args":{"module":"<stdin>"}},
+; CHECK-NEXT: {"name":"Dead Global Elimination","cat":"module","ph":"E","pid":0,"tid":0,"ts":{{[0-9.]+}},"args":{"instructions":-1,"heap":{{-?[0-9]+}}}}
+; CHECK: ]}
+
+define i32 @add_zero(i32 %x) {
+  %a = add i32 %x, 0
+  ret i32 %a
+}
+
+define internal void @unused() {
+  ret void
+}
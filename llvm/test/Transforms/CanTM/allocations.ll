@@ -0,0 +1,37 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM -S 2> /dev/null \
+; RUN:   | FileCheck %s
+; REQUIRES: loadable_module
+
+; Allocations in the transaction go through stm_malloc and stm_free, so
+; frees wait for commit and aborted allocations are released. Stores to
+; memory the transaction just allocated aren't reserved.
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@p = global i32* null
+
+declare noalias i8* @malloc(i64) nounwind
+declare void @free(i8*) nounwind
+
+define void @tx_alloc() {
+  %m = call i8* @malloc(i64 4)
+  %q = bitcast i8* %m to i32*
+  store i32 1, i32* %q
+  %old = load i32** @p
+  store i32* %q, i32** @p
+  %o = bitcast i32* %old to i8*
+  call void @free(i8* %o)
+  ret void
+}
+
+; CHECK: @cantm.site = private global { i32, i32, i8**, i8* } { i32 1, i32 1,
+
+; CHECK: define void @tx_alloc()
+; CHECK: %m = call i8* @stm_malloc(i64 4)
+; CHECK-NOT: @malloc(
+; CHECK: call void @stm_reserve_site(
+; CHECK-NEXT: %q = bitcast i8* %m to i32*
+; CHECK-NEXT: store i32 1, i32* %q
+; CHECK: call void @stm_free(i8* %o)
+; CHECK-NOT: @free(
+; CHECK: call void @stm_commit()
@@ -0,0 +1,66 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM -S 2> /dev/null \
+; RUN:   | FileCheck %s
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM \
+; RUN:   -cantm-lower-atomics=false -S 2> /dev/null \
+; RUN:   | FileCheck %s -check-prefix=KEEP
+; REQUIRES: loadable_module
+
+; Atomics in internal functions that only the transaction calls are lowered
+; to plain loads and stores, and fences dropped. Read-modify-writes in code
+; that may also run outside the transaction stay atomic, and are reserved
+; as stores.
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@a = global i32 0
+@b = global i32 0
+@c = global i32 0
+
+define internal i32 @bump() {
+  fence seq_cst
+  %old = atomicrmw add i32* @a, i32 1 seq_cst
+  %x = cmpxchg i32* @b, i32 0, i32 %old seq_cst
+  %y = load atomic i32* @c acquire, align 4
+  store atomic i32 %y, i32* @a release, align 4
+  ret i32 %x
+}
+
+define i32 @shared() {
+  %old = atomicrmw add i32* @c, i32 1 seq_cst
+  ret i32 %old
+}
+
+define i32 @tx_atomics() {
+  %x = call i32 @bump()
+  %y = call i32 @shared()
+  %r = add i32 %x, %y
+  ret i32 %r
+}
+
+; CHECK: @cantm.site = private global { i32, i32, i8**, i8* } { i32 3, i32 2,
+; CHECK: @cantm.site2 = private global { i32, i32, i8**, i8* } { i32 0, i32 1,
+
+; CHECK: define internal i32 @bump()
+; CHECK-NEXT: call void @stm_reserve_site(i8* bitcast ({{.*}}@cantm.site to i8*))
+; CHECK-NEXT: [[A:%[0-9]+]] = load i32* @a
+; CHECK-NEXT: [[INC:%[0-9]+]] = add i32 [[A]], 1
+; CHECK-NEXT: store i32 [[INC]], i32* @a
+; CHECK-NEXT: [[B:%[0-9]+]] = load i32* @b
+; CHECK-NEXT: [[EQ:%[0-9]+]] = icmp eq i32 [[B]], 0
+; CHECK-NEXT: [[NEW:%[0-9]+]] = select i1 [[EQ]], i32 [[A]], i32 [[B]]
+; CHECK-NEXT: store i32 [[NEW]], i32* @b
+; CHECK-NEXT: %y = load i32* @c, align 4
+; CHECK-NEXT: store i32 %y, i32* @a, align 4
+; CHECK-NEXT: ret i32 [[B]]
+
+; CHECK: define i32 @shared()
+; CHECK-NEXT: call void @stm_reserve_site(i8* bitcast ({{.*}}@cantm.site2 to i8*))
+; CHECK-NEXT: %old = atomicrmw add i32* @c, i32 1 seq_cst
+
+; KEEP: define internal i32 @bump()
+; KEEP-NEXT: call void @stm_reserve_site(
+; KEEP-NEXT: fence seq_cst
+; KEEP-NEXT: %old = atomicrmw add i32* @a, i32 1 seq_cst
+; KEEP-NEXT: %x = cmpxchg i32* @b, i32 0, i32 %old seq_cst
+; KEEP-NEXT: %y = load atomic i32* @c acquire, align 4
+; KEEP-NEXT: store atomic i32 %y, i32* @a release, align 4
@@ -0,0 +1,50 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM -S 2> /dev/null \
+; RUN:   | FileCheck %s
+; REQUIRES: loadable_module
+
+; Memory intrinsics reserve the shared ranges they read and write with
+; stm_reserve_ranges, right before the call. Ranges in the transaction's
+; own stack frame are left out, and an unknown length is too many
+; reservations for a hardware transaction.
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@src = global [100 x i8] zeroinitializer
+@dst = global [100 x i8] zeroinitializer
+
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i32, i1)
+declare void @llvm.memset.p0i8.i64(i8*, i8, i64, i32, i1)
+
+define void @tx_ranges(i64 %n) {
+  %buf = alloca [16 x i8]
+  %b = getelementptr [16 x i8]* %buf, i64 0, i64 0
+  %s = getelementptr [100 x i8]* @src, i64 0, i64 0
+  %d = getelementptr [100 x i8]* @dst, i64 0, i64 0
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %d, i8* %s, i64 %n, i32 1, i1 false)
+  call void @llvm.memset.p0i8.i64(i8* %d, i8 0, i64 10, i32 1, i1 false)
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %b, i8* %s, i64 16, i32 1, i1 false)
+  call void @llvm.memset.p0i8.i64(i8* %b, i8 0, i64 16, i32 1, i1 false)
+  ret void
+}
+
+; CHECK: define void @tx_ranges(i64 %n)
+; CHECK-NEXT: %checkpoint = call i8* @stm_begin()
+
+; CHECK: [[N:%[0-9]+]] = bitcast i64 %n to i64
+; CHECK-NEXT: [[S:%[0-9]+]] = bitcast [100 x i8]* @src to i8*
+; CHECK-NEXT: [[D:%[0-9]+]] = bitcast [100 x i8]* @dst to i8*
+; CHECK-NEXT: call void (i32, ...)* @stm_reserve_ranges(i32 6, i32 1, i8* [[S]], i64 [[N]], i32 1, i8* [[D]], i64 [[N]])
+; CHECK-NEXT: call void @llvm.memcpy.p0i8.p0i8.i64(i8* %d, i8* %s, i64 %n, i32 1, i1 false)
+
+; CHECK: [[D:%[0-9]+]] = bitcast [100 x i8]* @dst to i8*
+; CHECK-NEXT: call void (i32, ...)* @stm_reserve_ranges(i32 4, i32 0, i32 1, i8* [[D]], i64 {{%[0-9]+}})
+; CHECK-NEXT: call void @llvm.memset.p0i8.i64(i8* %d, i8 0, i64 10, i32 1, i1 false)
+
+; CHECK: [[S:%[0-9]+]] = bitcast [100 x i8]* @src to i8*
+; CHECK-NEXT: call void (i32, ...)* @stm_reserve_ranges(i32 4, i32 1, i8* [[S]], i64 {{%[0-9]+}}, i32 0)
+; CHECK-NEXT: call void @llvm.memcpy.p0i8.p0i8.i64(i8* %b, i8* %s, i64 16, i32 1, i1 false)
+
+; CHECK-NOT: @stm_reserve_ranges(
+; CHECK: call void @llvm.memset.p0i8.i64(i8* %b, i8 0, i64 16, i32 1, i1 false)
+; CHECK: call void @stm_commit()
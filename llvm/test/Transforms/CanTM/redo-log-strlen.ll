@@ -0,0 +1,27 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM -cantm-redo-log \
+; RUN:   -S 2> /dev/null | FileCheck %s
+; REQUIRES: loadable_module
+
+; strlen reads memory directly, and would miss the stores buffered in the
+; redo log, so the transaction keeps the undo log.
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@s = global i8* null
+@n = global i64 0
+
+declare i64 @strlen(i8*) nounwind readonly
+
+define void @tx_strlen() {
+  %p = load i8** @s
+  %len = call i64 @strlen(i8* %p)
+  store i64 %len, i64* @n
+  ret void
+}
+
+; CHECK: define void @tx_strlen()
+; CHECK-NOT: stm_redo_log
+; CHECK-NOT: stm_load
+; CHECK: call i64 @strlen(i8* %p)
+; CHECK: store i64 %len, i64* @n
+; CHECK: call void @stm_commit()
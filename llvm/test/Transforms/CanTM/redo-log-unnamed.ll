@@ -0,0 +1,24 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM -cantm-redo-log \
+; RUN:   -S 2> /dev/null | FileCheck %s
+; REQUIRES: loadable_module
+
+; A load through an address the pass can't name stays a plain load, which
+; would miss the stores buffered in the redo log, so the transaction keeps
+; the undo log.
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@a = global [2 x i32] zeroinitializer
+@b = global i32 0
+
+define void @tx_unnamed() {
+  %v = load i32* getelementptr inbounds ([2 x i32]* @a, i32 0, i32 1)
+  store i32 %v, i32* @b
+  ret void
+}
+
+; CHECK: define void @tx_unnamed()
+; CHECK-NOT: stm_redo_log
+; CHECK-NOT: stm_load
+; CHECK: store i32 %v, i32* @b
+; CHECK: call void @stm_commit()
@@ -0,0 +1,32 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM -cantm-redo-log \
+; RUN:   -S 2> /dev/null | FileCheck %s
+; REQUIRES: loadable_module
+
+; With -cantm-redo-log, a transaction whose accesses can all be rewritten
+; buffers its stores in the redo log.
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@a = global i32 0
+@b = global i32 0
+
+define void @tx_redo() {
+  %slot = alloca i32
+  %v = load i32* @a
+  store i32 %v, i32* %slot
+  %u = load i32* %slot
+  %w = add i32 %u, 1
+  store i32 %w, i32* @b
+  ret void
+}
+
+; CHECK: define void @tx_redo()
+; CHECK: call i8* @stm_begin()
+; CHECK: call void @stm_redo_log()
+; CHECK: call void {{.*}}@stm_reserve_partial(
+; CHECK: %v = call i32 @stm_load32(
+; CHECK: call void @stm_store32(i32 %v,
+; CHECK: %u = call i32 @stm_load32(
+; CHECK: call void @stm_store32(i32 %w,
+; CHECK-NOT: store i32
+; CHECK: call void @stm_commit()
@@ -0,0 +1,70 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM -S 2> /dev/null \
+; RUN:   | FileCheck %s
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM \
+; RUN:   -cantm-reservation-tables=false -S 2> /dev/null \
+; RUN:   | FileCheck %s -check-prefix=NOTABLES
+; REQUIRES: loadable_module
+
+; Blocks whose reservations are all globals reserve them from one private
+; table, loads first, and blocks reserving the same set share it. A block
+; that also reserves computed addresses passes those with
+; stm_reserve_partial, and thread-locals are never put in a table.
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@a = global i32 0
+@b = global i32 0
+@t = thread_local global i32 0
+
+; CHECK: @cantm.reservations = private unnamed_addr constant [2 x i8*] [i8* bitcast (i32* @a to i8*), i8* bitcast (i32* @b to i8*)]
+; CHECK: @cantm.site = private global { i32, i32, i8**, i8* } { i32 1, i32 1, i8** getelementptr inbounds ([2 x i8*]* @cantm.reservations, i32 0, i32 0), i8* null }
+; CHECK-NOT: @cantm.site{{[0-9]+}} = private global { i32, i32, i8**, i8* } { i32 1, i32 1,
+
+; NOTABLES-NOT: @cantm.reservations
+; NOTABLES-NOT: @cantm.site
+
+define void @tx_sites(i1 %c, i32* %p) {
+entry:
+  br i1 %c, label %left, label %right
+
+left:
+  %x = load i32* @a
+  store i32 %x, i32* @b
+  br label %mixed
+
+right:
+  %y = load i32* @a
+  store i32 %y, i32* @b
+  br label %mixed
+
+mixed:
+  %v = load i32* %p
+  store i32 %v, i32* @a
+  br label %done
+
+done:
+  %z = load i32* @t
+  ret void
+}
+
+; CHECK: define void @tx_sites(i1 %c, i32* %p)
+; CHECK: %checkpoint = call i8* @stm_begin_htm(i32 4)
+; CHECK: left:
+; CHECK-NEXT: call void @stm_reserve_site(i8* bitcast ({ i32, i32, i8**, i8* }* @cantm.site to i8*))
+; CHECK: right:
+; CHECK-NEXT: call void @stm_reserve_site(i8* bitcast ({ i32, i32, i8**, i8* }* @cantm.site to i8*))
+; CHECK: mixed:
+; CHECK: [[P:%[0-9]+]] = ptrtoint i32* %p to i64
+; CHECK: call void (i8*, i32, ...)* @stm_reserve_partial(i8* bitcast ({{.*}}@cantm.site{{[0-9]+}} to i8*), i32 3, i32 1, i64 [[P]], i32 0)
+; CHECK: done:
+; CHECK: [[T:%[0-9]+]] = ptrtoint i32* @t to i64
+; CHECK-NEXT: call void (i32, ...)* @stm_reserve(i32 3, i32 1, i64 [[T]], i32 0)
+
+; NOTABLES: left:
+; NOTABLES: [[A:%[0-9]+]] = ptrtoint i32* @a to i64
+; NOTABLES-NEXT: [[B:%[0-9]+]] = ptrtoint i32* @b to i64
+; NOTABLES-NEXT: call void (i32, ...)* @stm_reserve(i32 4, i32 1, i64 [[A]], i32 1, i64 [[B]])
+; NOTABLES-NOT: @stm_reserve_site
+; NOTABLES-NOT: @stm_reserve_partial
+; NOTABLES: ret void
@@ -0,0 +1,37 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM -S 2> /dev/null \
+; RUN:   | FileCheck %s
+; REQUIRES: loadable_module
+
+; Pure calls reserve the pointers they are passed as loads, as integers the
+; runtime reads with va_arg.  Other arguments aren't addresses, and are left
+; out of the reservation.
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@s = global i8* null
+@x = global double 0.0
+@n = global i64 0
+
+declare double @sqrt(double) nounwind readnone
+declare double @llvm.sqrt.f64(double) nounwind readnone
+declare i64 @strlen(i8*) nounwind readonly
+
+define void @tx_args() {
+  %d = load double* @x
+  %r1 = call double @sqrt(double %d)
+  %r2 = call double @llvm.sqrt.f64(double %r1)
+  store double %r2, double* @x
+  %p = load i8** @s
+  %len = call i64 @strlen(i8* %p)
+  store i64 %len, i64* @n
+  ret void
+}
+
+; CHECK: define void @tx_args()
+; CHECK-NOT: @stm_reserve(
+; CHECK: call double @sqrt(double %d)
+; CHECK-NOT: @stm_reserve(
+; CHECK: call double @llvm.sqrt.f64(double %r1)
+; CHECK: [[ADDR:%[0-9]+]] = ptrtoint i8* %p to i64
+; CHECK-NEXT: call void (i32, ...)* @stm_reserve(i32 3, i32 1, i64 [[ADDR]], i32 0)
+; CHECK-NEXT: %len = call i64 @strlen(i8* %p)
@@ -0,0 +1,25 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM -S 2> /dev/null \
+; RUN:   | FileCheck %s
+; REQUIRES: loadable_module
+
+; strlen reads current memory rather than the snapshot, so a transaction
+; calling it begins as an ordinary one and reserves what it reads.
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@s = global i8* null
+
+declare i64 @strlen(i8*) nounwind readonly
+
+define i64 @tx_strlen() {
+  %p = load i8** @s
+  %len = call i64 @strlen(i8* %p)
+  ret i64 %len
+}
+
+; CHECK: define i64 @tx_strlen()
+; CHECK-NOT: stm_begin_snapshot
+; CHECK: call i8* @stm_begin()
+; CHECK: call void @stm_reserve_site(
+; CHECK: %p = load i8** @s
+; CHECK: call i64 @strlen(i8* %p)
@@ -0,0 +1,31 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMCanTM%shlibext -CanTM -S 2> /dev/null \
+; RUN:   | FileCheck %s
+; REQUIRES: loadable_module
+
+; A transaction that only stores to its own stack reads from snapshots.  It
+; keeps its reservations, for when the runtime runs it as an ordinary
+; transaction.
+
+target datalayout = "e-p:64:64:64-i32:32:32-i64:64:64"
+
+@a = global i32 0
+@b = global i32 0
+
+define i32 @tx_snapshot() {
+  %slot = alloca i32
+  %v = load i32* @a
+  %w = load i32* @b
+  %sum = add i32 %v, %w
+  store i32 %sum, i32* %slot
+  %r = load i32* %slot
+  ret i32 %r
+}
+
+; CHECK: define i32 @tx_snapshot()
+; CHECK: call i8* @stm_begin_snapshot()
+; CHECK: call void {{.*}}@stm_reserve_partial(
+; CHECK: %v = call i32 @stm_load32(
+; CHECK: %w = call i32 @stm_load32(
+; CHECK: store i32 %sum, i32* %slot
+; CHECK: %r = load i32* %slot
+; CHECK: call void @stm_commit()
@@ -0,0 +1,495 @@
+//===- MCJITTierUp.cpp - Compile hot interpreted functions with MCJIT -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements lli -tiered.  The interpreter runs the program and
+// hands the functions it finds hot to a background thread, which compiles each
+// one with MCJIT together with every function it calls.  That code comes from
+// a copy of the module read back from bitcode into a context of its own, with
+// the interpreter's global variables in place of the copy's, so that both
+// tiers share the program's memory.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "tier-up"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Instructions.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Config/config.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/Interpreter.h"
+#include "llvm/ExecutionEngine/JITMemoryManager.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/Support/IRBuilder.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetMachine.h"
+#include <deque>
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
+using namespace llvm;
+
+STATISTIC(NumTieredUp, "Number of hot functions compiled");
+STATISTIC(NumLeftInterpreted, "Number of hot functions that stay interpreted");
+
+namespace {
+  typedef std::pair<Function*, InterpreterTierUp::NativeEntry> CompiledFunction;
+
+  class MCJITTierUp : public InterpreterTierUp {
+    Module &M;
+    ExecutionEngine &Interp;
+    void (*Configure)(EngineBuilder &);
+    bool Background;
+
+    // Written when the first function gets hot, before the compiler thread
+    // starts, and only read afterwards.
+    bool SameLayout;
+    std::string ModuleID;
+    std::string Bitcode;
+    std::vector<void*> GlobalAddresses;
+    DenseMap<const Function*, unsigned> FunctionIndices;
+
+    // The engines holding the native code, and the contexts of their modules.
+    // Only the compiler thread changes them while it runs.
+    std::vector<std::pair<ExecutionEngine*, LLVMContext*> > Engines;
+
+    // Requests from the interpreter and the results for it, guarded by Lock
+    // when there is a compiler thread.
+    std::deque<std::pair<Function*, unsigned> > Pending;
+    std::vector<CompiledFunction> Compiled;
+    bool Stopping;
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+    pthread_mutex_t Lock;
+    pthread_cond_t Wakeup;
+    pthread_t Thread;
+    bool Started;
+
+    static void *runCompiler(void *Arg);
+#endif
+
+    void takeSnapshot();
+    bool addCallee(Function *Callee, SmallPtrSet<Function*, 16> &Closure,
+                   SmallVectorImpl<Function*> &Worklist);
+    bool canRunNatively(Function &F,
+                        const SmallPtrSet<GlobalVariable*, 8> &Unresolved,
+                        SmallPtrSet<Function*, 16> &Closure,
+                        SmallVectorImpl<Function*> &Worklist);
+    NativeEntry compile(unsigned Index);
+    void compileNow(Function *F, unsigned Index);
+
+  public:
+    MCJITTierUp(Module &M, ExecutionEngine &Interp,
+                void (*Configure)(EngineBuilder &), bool Background);
+    ~MCJITTierUp();
+
+    virtual void functionIsHot(Function *F);
+    virtual void takeCompiled(std::vector<CompiledFunction> &Done);
+  };
+}
+
+MCJITTierUp::MCJITTierUp(Module &M, ExecutionEngine &Interp,
+                         void (*Configure)(EngineBuilder &), bool Background)
+  : M(M), Interp(Interp), Configure(Configure), Background(Background),
+    SameLayout(false), Stopping(false) {
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  ::pthread_mutex_init(&Lock, 0);
+  ::pthread_cond_init(&Wakeup, 0);
+  Started = false;
+#endif
+}
+
+MCJITTierUp::~MCJITTierUp() {
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  // A compilation in progress is finished first.
+  if (Started) {
+    ::pthread_mutex_lock(&Lock);
+    Stopping = true;
+    ::pthread_cond_signal(&Wakeup);
+    ::pthread_mutex_unlock(&Lock);
+    ::pthread_join(Thread, 0);
+  }
+  ::pthread_cond_destroy(&Wakeup);
+  ::pthread_mutex_destroy(&Lock);
+#endif
+  for (unsigned i = 0, e = Engines.size(); i != e; ++i) {
+    delete Engines[i].first;
+    delete Engines[i].second;
+  }
+}
+
+/// hasSameLayout - Whether native code laid out by Native can use data that
+/// the interpreter lays out by Interp.  That takes the same byte order, and
+/// the same size and ABI alignment for each type a value can have; preferred
+/// alignments, the stack alignment and the native integer widths don't move
+/// anything.
+static bool hasSameLayout(const TargetData &Interp, const TargetData &Native,
+                          LLVMContext &Context) {
+  if (Interp.isLittleEndian() != Native.isLittleEndian() ||
+      Interp.getPointerSize() != Native.getPointerSize() ||
+      Interp.getPointerABIAlignment() != Native.getPointerABIAlignment())
+    return false;
+
+  Type *Types[] = {
+    Type::getInt1Ty(Context), Type::getInt8Ty(Context),
+    Type::getInt16Ty(Context), Type::getInt32Ty(Context),
+    Type::getInt64Ty(Context), Type::getFloatTy(Context),
+    Type::getDoubleTy(Context), StructType::get(Context)
+  };
+  for (unsigned i = 0; i != array_lengthof(Types); ++i)
+    if (Interp.getTypeAllocSize(Types[i]) != Native.getTypeAllocSize(Types[i]) ||
+        Interp.getABITypeAlignment(Types[i]) !=
+          Native.getABITypeAlignment(Types[i]))
+      return false;
+  return true;
+}
+
+/// takeSnapshot - Write the module as it is now for the compiler, and record
+/// where the interpreter keeps each global variable.  The interpreter only
+/// ever appends declarations to the module, so the indices stay valid.
+void MCJITTierUp::takeSnapshot() {
+  // Values cross between the tiers in the interpreter's memory layout, which
+  // comes from the module and need not be the one the native code uses.
+  EngineBuilder EB(&M);
+  Configure(EB);
+  OwningPtr<TargetMachine> TM(EB.selectTarget());
+  SameLayout = TM && TM->getTargetData() &&
+    hasSameLayout(*Interp.getTargetData(), *TM->getTargetData(),
+                  M.getContext());
+  DEBUG(if (!SameLayout)
+          dbgs() << "tier-up: the module's data layout is not the host's\n");
+
+  ModuleID = M.getModuleIdentifier();
+  raw_string_ostream OS(Bitcode);
+  WriteBitcodeToFile(&M, OS);
+  OS.flush();
+
+  for (Module::global_iterator I = M.global_begin(), E = M.global_end();
+       I != E; ++I)
+    GlobalAddresses.push_back(Interp.getPointerToGlobalIfAvailable(I));
+  unsigned Index = 0;
+  for (Module::iterator I = M.begin(), E = M.end(); I != E; ++I)
+    FunctionIndices[I] = Index++;
+}
+
+/// hasNativeType - Ty is passed between the tiers through memory, which only
+/// the interpreter's scalar types support.
+static bool hasNativeType(Type *Ty) {
+  if (IntegerType *ITy = dyn_cast<IntegerType>(Ty))
+    return ITy->getBitWidth() <= 64;
+  return Ty->isFloatTy() || Ty->isDoubleTy() || Ty->isPointerTy();
+}
+
+/// isNativeOperand - Constants in native code must not use functions, which
+/// the interpreter represents by their Function objects rather than their
+/// code, nor aliases or block addresses, which the copy doesn't keep, nor the
+/// Unresolved global variables, which the interpreter has no address for.
+static bool isNativeOperand(Value *V,
+                            const SmallPtrSet<GlobalVariable*, 8> &Unresolved,
+                            SmallPtrSet<Constant*, 16> &Visited) {
+  Constant *C = dyn_cast<Constant>(V);
+  if (!C)
+    return true;
+  if (GlobalVariable *GV = dyn_cast<GlobalVariable>(C))
+    return !Unresolved.count(GV);
+  if (isa<GlobalValue>(C) || isa<BlockAddress>(C))
+    return false;
+  if (!Visited.insert(C))
+    return true;
+  for (User::op_iterator I = C->op_begin(), E = C->op_end(); I != E; ++I)
+    if (!isNativeOperand(*I, Unresolved, Visited))
+      return false;
+  return true;
+}
+
+/// addCallee - Make sure that native code can call Callee: functions of the
+/// program are compiled along with their callers, and others must be in the
+/// process.
+bool MCJITTierUp::addCallee(Function *Callee,
+                            SmallPtrSet<Function*, 16> &Closure,
+                            SmallVectorImpl<Function*> &Worklist) {
+  if (!Callee->isDeclaration() || Callee->isMaterializable()) {
+    if (Closure.insert(Callee))
+      Worklist.push_back(Callee);
+    return true;
+  }
+  if (Callee->getIntrinsicID())
+    return true;
+
+  // The interpreter runs its own versions of these.
+  StringRef Name = Callee->getName();
+  if (Name == "exit" || Name == "atexit")
+    return false;
+  return sys::DynamicLibrary::SearchForAddressOfSymbol(Name) != 0;
+}
+
+/// canRunNatively - Check that the native code of F can run alongside the
+/// interpreter, and queue the functions it calls.
+bool
+MCJITTierUp::canRunNatively(Function &F,
+                            const SmallPtrSet<GlobalVariable*, 8> &Unresolved,
+                            SmallPtrSet<Function*, 16> &Closure,
+                            SmallVectorImpl<Function*> &Worklist) {
+  // The interpreter passes variable arguments in its own way.
+  if (F.isVarArg())
+    return false;
+
+  SmallPtrSet<Constant*, 16> Visited;
+  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+    // Nothing unwinds through the interpreter.
+    if (isa<InvokeInst>(*I) || isa<LandingPadInst>(*I) ||
+        isa<ResumeInst>(*I) || isa<IndirectBrInst>(*I) || isa<VAArgInst>(*I))
+      return false;
+
+    unsigned NumOperands = I->getNumOperands();
+    if (CallInst *CI = dyn_cast<CallInst>(&*I)) {
+      Function *Callee =
+        dyn_cast<Function>(CI->getCalledValue()->stripPointerCasts());
+      if (!Callee || !addCallee(Callee, Closure, Worklist))
+        return false;
+      NumOperands = CI->getNumArgOperands();
+    }
+    for (unsigned i = 0; i != NumOperands; ++i)
+      if (!isNativeOperand(I->getOperand(i), Unresolved, Visited))
+        return false;
+  }
+  return true;
+}
+
+/// compile - Compile the function at Index in the snapshot, and the functions
+/// it calls, into a module of their own.  Returns null if the function has to
+/// stay interpreted.
+InterpreterTierUp::NativeEntry MCJITTierUp::compile(unsigned Index) {
+  OwningPtr<LLVMContext> Context(new LLVMContext());
+  std::string ErrorMsg;
+  MemoryBuffer *Buffer = MemoryBuffer::getMemBuffer(Bitcode, ModuleID, false);
+  OwningPtr<Module> Copy(getLazyBitcodeModule(Buffer, *Context, &ErrorMsg));
+  if (!Copy) {
+    DEBUG(dbgs() << "tier-up: " << ErrorMsg << "\n");
+    return 0;
+  }
+
+  Module::iterator Root = Copy->begin();
+  std::advance(Root, Index);
+  FunctionType *RootTy = Root->getFunctionType();
+
+  // Native code would use the address of an unresolved global as if it were
+  // the global.
+  SmallPtrSet<GlobalVariable*, 8> Unresolved;
+  unsigned GlobalIndex = 0;
+  for (Module::global_iterator I = Copy->global_begin(),
+       E = Copy->global_end(); I != E; ++I, ++GlobalIndex)
+    if (!GlobalAddresses[GlobalIndex])
+      Unresolved.insert(I);
+
+  SmallPtrSet<Function*, 16> Closure;
+  SmallVector<Function*, 16> Worklist;
+  Closure.insert(Root);
+  Worklist.push_back(Root);
+  while (!Worklist.empty()) {
+    Function *F = Worklist.pop_back_val();
+    if (F->Materialize(&ErrorMsg) ||
+        !canRunNatively(*F, Unresolved, Closure, Worklist)) {
+      DEBUG(dbgs() << "tier-up: " << Root->getName() << " stays interpreted"
+                   << " because of " << F->getName() << "\n");
+      return 0;
+    }
+  }
+
+  // Only the closure is left, using the interpreter's global variables.
+  for (Module::iterator I = Copy->begin(), E = Copy->end(); I != E; ++I)
+    if (!Closure.count(I) && I->isMaterializable())
+      Copy->Discard(I);
+  if (Copy->MaterializeAllPermanently(&ErrorMsg))
+    return 0;
+
+  for (Module::global_iterator I = Copy->global_begin(),
+       E = Copy->global_end(); I != E; ++I)
+    I->setInitializer(0);
+  while (!Copy->alias_empty()) {
+    GlobalAlias *GA = Copy->alias_begin();
+    GA->replaceAllUsesWith(UndefValue::get(GA->getType()));
+    GA->eraseFromParent();
+  }
+
+  TargetData TD(Copy.get());
+  Type *IntPtrTy = TD.getIntPtrType(*Context);
+  for (unsigned i = 0; !Copy->global_empty(); ++i) {
+    GlobalVariable *GV = Copy->global_begin();
+    Constant *Addr = ConstantInt::get(IntPtrTy, (uintptr_t)GlobalAddresses[i]);
+    GV->replaceAllUsesWith(ConstantExpr::getIntToPtr(Addr, GV->getType()));
+    GV->eraseFromParent();
+  }
+
+  for (Module::iterator I = Copy->begin(), E = Copy->end(); I != E; ) {
+    Function *F = I++;
+    if (Closure.count(F)) {
+      F->setLinkage(GlobalValue::InternalLinkage);
+      continue;
+    }
+    F->removeDeadConstantUsers();
+    if (F->use_empty())
+      F->eraseFromParent();
+  }
+
+  // The entry takes its arguments from memory and stores the result there.
+  Type *Int8PtrTy = Type::getInt8PtrTy(*Context);
+  Type *Params[] = { PointerType::getUnqual(Int8PtrTy), Int8PtrTy };
+  Function *Entry =
+    Function::Create(FunctionType::get(Type::getVoidTy(*Context), Params,
+                                       false),
+                     GlobalValue::ExternalLinkage, "lli.tier.entry",
+                     Copy.get());
+  Function::arg_iterator Arg = Entry->arg_begin();
+  Value *Args = Arg++;
+  Value *Result = Arg;
+
+  IRBuilder<> Builder(BasicBlock::Create(*Context, "entry", Entry));
+  SmallVector<Value*, 8> CallArgs;
+  for (unsigned i = 0, e = RootTy->getNumParams(); i != e; ++i) {
+    Value *Slot = Builder.CreateLoad(Builder.CreateConstGEP1_32(Args, i));
+    Type *SlotTy = PointerType::getUnqual(RootTy->getParamType(i));
+    CallArgs.push_back(Builder.CreateLoad(Builder.CreateBitCast(Slot, SlotTy)));
+  }
+  CallInst *Call = Builder.CreateCall(Root, CallArgs);
+  Call->setCallingConv(Root->getCallingConv());
+  if (!RootTy->getReturnType()->isVoidTy())
+    Builder.CreateStore(Call, Builder.CreateBitCast(Result,
+                                    PointerType::getUnqual(Call->getType())));
+  Builder.CreateRetVoid();
+
+  EngineBuilder EB(Copy.get());
+  EB.setEngineKind(EngineKind::JIT);
+  EB.setUseMCJIT(true);
+  EB.setErrorStr(&ErrorMsg);
+  EB.setJITMemoryManager(JITMemoryManager::CreateDefaultMemManager());
+  Configure(EB);
+  ExecutionEngine *EE = EB.create();
+  if (!EE) {
+    DEBUG(dbgs() << "tier-up: " << ErrorMsg << "\n");
+    return 0;
+  }
+  Copy.take();
+
+  NativeEntry Code = (NativeEntry)(intptr_t)EE->getPointerToFunction(Entry);
+  Engines.push_back(std::make_pair(EE, Context.take()));
+  return Code;
+}
+
+/// compileNow - Compile F on the interpreter's thread.
+void MCJITTierUp::compileNow(Function *F, unsigned Index) {
+  if (NativeEntry Code = compile(Index)) {
+    ++NumTieredUp;
+    Compiled.push_back(std::make_pair(F, Code));
+    sys::AtomicIncrement(&NumCompiled);
+  } else {
+    ++NumLeftInterpreted;
+  }
+}
+
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+void *MCJITTierUp::runCompiler(void *Arg) {
+  MCJITTierUp &TierUp = *static_cast<MCJITTierUp*>(Arg);
+  ::pthread_mutex_lock(&TierUp.Lock);
+  while (true) {
+    while (!TierUp.Stopping && TierUp.Pending.empty())
+      ::pthread_cond_wait(&TierUp.Wakeup, &TierUp.Lock);
+    if (TierUp.Stopping)
+      break;
+    std::pair<Function*, unsigned> Request = TierUp.Pending.front();
+    TierUp.Pending.pop_front();
+    ::pthread_mutex_unlock(&TierUp.Lock);
+
+    NativeEntry Code = TierUp.compile(Request.second);
+
+    ::pthread_mutex_lock(&TierUp.Lock);
+    if (Code) {
+      ++NumTieredUp;
+      TierUp.Compiled.push_back(std::make_pair(Request.first, Code));
+      sys::AtomicIncrement(&TierUp.NumCompiled);
+    } else {
+      ++NumLeftInterpreted;
+    }
+  }
+  ::pthread_mutex_unlock(&TierUp.Lock);
+  return 0;
+}
+#endif
+
+void MCJITTierUp::functionIsHot(Function *F) {
+  FunctionType *FTy = F->getFunctionType();
+  bool Supported = !FTy->isVarArg() && (FTy->getReturnType()->isVoidTy() ||
+                                        hasNativeType(FTy->getReturnType()));
+  for (unsigned i = 0, e = FTy->getNumParams(); i != e && Supported; ++i)
+    Supported = hasNativeType(FTy->getParamType(i));
+  if (!Supported) {
+    ++NumLeftInterpreted;
+    return;
+  }
+
+  if (Bitcode.empty())
+    takeSnapshot();
+  if (!SameLayout) {
+    ++NumLeftInterpreted;
+    return;
+  }
+  DenseMap<const Function*, unsigned>::iterator I = FunctionIndices.find(F);
+  if (I == FunctionIndices.end())
+    return;
+
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  if (Background && !Started) {
+    if (!llvm_is_multithreaded())
+      llvm_start_multithreaded();
+    Started = ::pthread_create(&Thread, 0, runCompiler, this) == 0;
+  }
+  if (Started) {
+    ::pthread_mutex_lock(&Lock);
+    Pending.push_back(std::make_pair(F, I->second));
+    ::pthread_cond_signal(&Wakeup);
+    ::pthread_mutex_unlock(&Lock);
+    return;
+  }
+#endif
+  compileNow(F, I->second);
+}
+
+void MCJITTierUp::takeCompiled(std::vector<CompiledFunction> &Done) {
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  ::pthread_mutex_lock(&Lock);
+#endif
+  Done.insert(Done.end(), Compiled.begin(), Compiled.end());
+  Compiled.clear();
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  ::pthread_mutex_unlock(&Lock);
+#endif
+}
+
+/// createMCJITTierUp - Compile the functions of M that the interpreter Interp
+/// finds hot, with engines that Configure sets up for the target.  Unless
+/// Background is set, each is compiled as soon as it gets hot, on the
+/// interpreter's thread.
+InterpreterTierUp *createMCJITTierUp(Module &M, ExecutionEngine &Interp,
+                                     void (*Configure)(EngineBuilder &),
+                                     bool Background) {
+  // Native code calls the functions the program declares directly.
+  sys::DynamicLibrary::LoadLibraryPermanently(0, 0);
+  return new MCJITTierUp(M, Interp, Configure, Background);
+}
@@ -15,8 +15,11 @@
 
 #include "llvm/LLVMContext.h"
 #include "llvm/Module.h"
+#include "llvm/PassManager.h"
 #include "llvm/Type.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/Passes.h"
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/CodeGen/LinkAllCodegenComponents.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
@@ -25,7 +28,10 @@
 #include "llvm/ExecutionEngine/JITEventListener.h"
 #include "llvm/ExecutionEngine/JITMemoryManager.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/Support/CallSite.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/InstIterator.h"
 #include "llvm/Support/IRReader.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/MemoryBuffer.h"
@@ -35,6 +41,8 @@
 #include "llvm/Support/Process.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Transforms/CanTM.h"
 #include <cerrno>
 
 #ifdef __CYGWIN__
@@ -57,6 +65,34 @@ namespace {
                                  cl::desc("Force interpretation: disable JIT"),
                                  cl::init(false));
 
+  cl::opt<bool> Tiered("tiered",
+                        cl::desc("Interpret, and compile hot functions with "
+                                 "MCJIT on a background thread"),
+                        cl::init(false));
+
+  cl::opt<unsigned>
+  TierThreshold("tier-threshold",
+                cl::desc("Calls and loop iterations after which -tiered "
+                         "compiles a function (default = 1000)"),
+                cl::value_desc("count"), cl::init(1000));
+
+  cl::opt<bool>
+  TierInBackground("tier-in-background",
+                   cl::desc("Compile hot functions on a background thread "
+                            "with -tiered (default = true)"),
+                   cl::Hidden, cl::init(true));
+
+  cl::opt<bool> UseCanTM(
+    "cantm", cl::desc("Instrument transactions with the CanTM pass when they "
+                      "are first compiled"),
+    cl::init(false));
+
+  cl::opt<std::string>
+  CanTMRuntime("cantm-runtime",
+               cl::desc("Library providing the CanTM runtime (default: "
+                        "search the process)"),
+               cl::value_desc("library"));
+
   cl::opt<bool> UseMCJIT(
     "use-mcjit", cl::desc("Enable use of the MC-based JIT (if available)"),
     cl::init(false));
@@ -166,6 +202,12 @@ namespace {
 }
 
 static ExecutionEngine *EE = 0;
+static CodeGenOpt::Level OLvl = CodeGenOpt::Default;
+
+// Defined in MCJITTierUp.cpp
+extern InterpreterTierUp *createMCJITTierUp(Module &M, ExecutionEngine &Interp,
+                                            void (*Configure)(EngineBuilder &),
+                                            bool Background);
 
 static void do_shutdown() {
   // Cygwin-1.5 invokes DLL's dtors before atexit handler.
@@ -175,6 +217,122 @@ static void do_shutdown() {
 #endif
 }
 
+//===----------------------------------------------------------------------===//
+// CanTM support
+//
+
+/// runCanTM - Instrument the transactions of M.  The pass looks at the whole
+/// module, so everything is materialized first.
+static void runCanTM(Module &M, const TargetData *TD) {
+  std::string ErrorMsg;
+  if (M.MaterializeAll(&ErrorMsg)) {
+    errs() << "lli: bitcode didn't read correctly.\n";
+    errs() << "Reason: " << ErrorMsg << "\n";
+    exit(1);
+  }
+
+  PassManager PM;
+  PM.add(TD ? new TargetData(*TD) : new TargetData(&M));
+  PM.add(createBasicAliasAnalysisPass());
+  PM.add(createCanTMPass());
+  PM.run(M);
+}
+
+/// loadCanTMRuntime - Load the library given with -cantm-runtime.  MCJIT
+/// resolves symbols while it is created, so this happens before.
+static void loadCanTMRuntime() {
+  std::string ErrorMsg;
+  if (!CanTMRuntime.empty() &&
+      sys::DynamicLibrary::LoadLibraryPermanently(CanTMRuntime.c_str(),
+                                                  &ErrorMsg)) {
+    errs() << "lli: could not load the CanTM runtime: " << ErrorMsg << "\n";
+    exit(1);
+  }
+}
+
+/// bindCanTMRuntime - Map the stm_* entry points the pass declared to the
+/// runtime, so that a missing one is reported before the program runs.
+static void bindCanTMRuntime(Module &M, ExecutionEngine &Engine) {
+  for (Module::iterator I = M.begin(), E = M.end(); I != E; ++I) {
+    if (!I->isDeclaration() || !I->getName().startswith("stm_") ||
+        Engine.getPointerToGlobalIfAvailable(I))
+      continue;
+    void *Addr = sys::DynamicLibrary::SearchForAddressOfSymbol(I->getName());
+    if (!Addr) {
+      errs() << "lli: CanTM runtime entry point '" << I->getName()
+             << "' not found\n";
+      exit(1);
+    }
+    Engine.addGlobalMapping(I, Addr);
+  }
+}
+
+namespace {
+  /// CanTMJITListener - Run CanTM when the JIT is about to compile the first
+  /// transaction, so that programs which never enter one don't pay for the
+  /// instrumentation.
+  class CanTMJITListener : public JITEventListener {
+    ExecutionEngine &Engine;
+    bool Done;
+  public:
+    explicit CanTMJITListener(ExecutionEngine &EE) : Engine(EE), Done(false) {}
+
+    virtual void NotifyFunctionMaterialized(Function &F) {
+      if (Done || !isCanTMTransaction(&F))
+        return;
+      Done = true;
+
+      Module &M = *F.getParent();
+      runCanTM(M, Engine.getTargetData());
+      bindCanTMRuntime(M, Engine);
+
+      // The pass instruments every transaction in the module, not just F.
+      // Those and the functions they call that already ran outside of a
+      // transaction were compiled before they were instrumented; F itself
+      // is about to be.
+      SmallVector<Function*, 16> Worklist;
+      SmallPtrSet<Function*, 16> Visited;
+      for (Module::iterator I = M.begin(), E = M.end(); I != E; ++I) {
+        if (I->isDeclaration() || !isCanTMTransaction(I))
+          continue;
+        Worklist.push_back(I);
+        Visited.insert(I);
+        if (&*I != &F && Engine.getPointerToGlobalIfAvailable(I))
+          Engine.recompileAndRelinkFunction(I);
+      }
+      while (!Worklist.empty()) {
+        Function *Fn = Worklist.pop_back_val();
+        for (inst_iterator I = inst_begin(Fn), E = inst_end(Fn); I != E; ++I) {
+          CallSite CS(&*I);
+          Function *Callee = CS ? CS.getCalledFunction() : 0;
+          if (!Callee || Callee->isDeclaration() || !Visited.insert(Callee))
+            continue;
+          Worklist.push_back(Callee);
+          if (Engine.getPointerToGlobalIfAvailable(Callee))
+            Engine.recompileAndRelinkFunction(Callee);
+        }
+      }
+    }
+  };
+}
+
+/// setTargetOptions - Apply the target and code generation options to
+/// builder.  -tiered builds an engine for each function it compiles.
+static void setTargetOptions(EngineBuilder &builder) {
+  builder.setMArch(MArch);
+  builder.setMCPU(MCPU);
+  builder.setMAttrs(MAttrs);
+  builder.setRelocationModel(RelocModel);
+  builder.setCodeModel(CMModel);
+  builder.setOptLevel(OLvl);
+
+  TargetOptions Options;
+  Options.JITExceptionHandling = EnableJITExceptionHandling;
+  Options.JITEmitDebugInfo = EmitJitDebugInfo;
+  Options.JITEmitDebugInfoToDisk = EmitJitDebugInfoToDisk;
+  builder.setTargetOptions(Options);
+}
+
 //===----------------------------------------------------------------------===//
 // main Driver function
 //
@@ -197,17 +355,22 @@ int main(int argc, char **argv, char * const *envp) {
   if (DisableCoreFiles)
     sys::Process::PreventCoreFiles();
 
-  // Load the bitcode...
+  // Load the bitcode...  Function bodies are read when the JIT first compiles
+  // them.
   SMDiagnostic Err;
-  Module *Mod = ParseIRFile(InputFile, Err, Context);
+  Module *Mod = getLazyIRFileModule(InputFile, Err, Context);
   if (!Mod) {
     Err.print(argv[0], errs());
     return 1;
   }
 
-  // If not jitting lazily, load the whole bitcode file eagerly too.
+  // -tiered starts out in the interpreter.
+  bool Interpret = ForceInterpreter || Tiered;
+
+  // If not jitting lazily, load the whole bitcode file eagerly too.  MCJIT
+  // compiles the whole module at once.
   std::string ErrorMsg;
-  if (NoLazyCompilation) {
+  if (NoLazyCompilation || (UseMCJIT && !Interpret)) {
     if (Mod->MaterializeAllPermanently(&ErrorMsg)) {
       errs() << argv[0] << ": bitcode didn't read correctly.\n";
       errs() << "Reason: " << ErrorMsg << "\n";
@@ -215,16 +378,27 @@ int main(int argc, char **argv, char * const *envp) {
     }
   }
 
+  // Instrumented transactions restart by longjmp'ing back to a checkpoint
+  // taken with _setjmp, which the interpreter can't do.
+  if (UseCanTM && Interpret) {
+    errs() << argv[0] << ": -cantm can't be used with "
+           << (Tiered ? "-tiered" : "-force-interpreter") << ".\n";
+    return 1;
+  }
+
+  // MCJIT compiles the whole module up front, so instrument everything
+  // before creating it.
+  bool EagerCanTM = UseCanTM && UseMCJIT;
+  if (UseCanTM)
+    loadCanTMRuntime();
+  if (EagerCanTM)
+    runCanTM(*Mod, 0);
+
   EngineBuilder builder(Mod);
-  builder.setMArch(MArch);
-  builder.setMCPU(MCPU);
-  builder.setMAttrs(MAttrs);
-  builder.setRelocationModel(RelocModel);
-  builder.setCodeModel(CMModel);
   builder.setErrorStr(&ErrorMsg);
-  builder.setJITMemoryManager(ForceInterpreter ? 0 :
+  builder.setJITMemoryManager(Interpret ? 0 :
                               JITMemoryManager::CreateDefaultMemManager());
-  builder.setEngineKind(ForceInterpreter
+  builder.setEngineKind(Interpret
                         ? EngineKind::Interpreter
                         : EngineKind::JIT);
 
@@ -233,12 +407,11 @@ int main(int argc, char **argv, char * const *envp) {
     Mod->setTargetTriple(Triple::normalize(TargetTriple));
 
   // Enable MCJIT if desired.
-  if (UseMCJIT && !ForceInterpreter) {
+  if (UseMCJIT && !Interpret) {
     builder.setUseMCJIT(true);
     builder.setJITMemoryManager(JITMemoryManager::CreateDefaultMemManager());
   }
 
-  CodeGenOpt::Level OLvl = CodeGenOpt::Default;
   switch (OptLevel) {
   default:
     errs() << argv[0] << ": invalid optimization level.\n";
@@ -249,13 +422,7 @@ int main(int argc, char **argv, char * const *envp) {
   case '2': OLvl = CodeGenOpt::Default; break;
   case '3': OLvl = CodeGenOpt::Aggressive; break;
   }
-  builder.setOptLevel(OLvl);
-
-  TargetOptions Options;
-  Options.JITExceptionHandling = EnableJITExceptionHandling;
-  Options.JITEmitDebugInfo = EmitJitDebugInfo;
-  Options.JITEmitDebugInfoToDisk = EmitJitDebugInfoToDisk;
-  builder.setTargetOptions(Options);
+  setTargetOptions(builder);
 
   EE = builder.create();
   if (!EE) {
@@ -273,8 +440,18 @@ int main(int argc, char **argv, char * const *envp) {
   EE->RegisterJITEventListener(
                 JITEventListener::createIntelJITEventListener());
 
+  if (EagerCanTM)
+    bindCanTMRuntime(*Mod, *EE);
+  else if (UseCanTM)
+    EE->RegisterJITEventListener(new CanTMJITListener(*EE));
+
   EE->DisableLazyCompilation(NoLazyCompilation);
 
+  if (Tiered)
+    setInterpreterTierUp(EE, createMCJITTierUp(*Mod, *EE, setTargetOptions,
+                                               TierInBackground),
+                         TierThreshold);
+
   // If the user specifically requested an argv[0] to pass into the program,
   // do it now.
   if (!FakeArgv0.empty()) {
@@ -109,6 +109,7 @@ static const char *GetBlockName(unsigned BlockID,
   case bitc::METADATA_BLOCK_ID:      return "METADATA_BLOCK";
   case bitc::METADATA_ATTACHMENT_ID: return "METADATA_ATTACHMENT_BLOCK";
   case bitc::USELIST_BLOCK_ID:       return "USELIST_BLOCK_ID";
+  case bitc::FUNCTION_INDEX_BLOCK_ID: return "FUNCTION_INDEX_BLOCK";
   }
 }
 
@@ -156,6 +157,7 @@ static const char *GetCodeName(unsigned CodeID, unsigned BlockID,
     case bitc::MODULE_CODE_ALIAS:       return "ALIAS";
     case bitc::MODULE_CODE_PURGEVALS:   return "PURGEVALS";
     case bitc::MODULE_CODE_GCNAME:      return "GCNAME";
+    case bitc::MODULE_CODE_FNINDEX:     return "FNINDEX";
     }
   case bitc::PARAMATTR_BLOCK_ID:
     switch (CodeID) {
@@ -271,6 +273,11 @@ static const char *GetCodeName(unsigned CodeID, unsigned BlockID,
     default:return 0;
     case bitc::USELIST_CODE_ENTRY:   return "USELIST_CODE_ENTRY";
     }
+  case bitc::FUNCTION_INDEX_BLOCK_ID:
+    switch(CodeID) {
+    default:return 0;
+    case bitc::FNINDEX_CODE_ENTRY:   return "ENTRY";
+    }
   }
 }
 
@@ -16,16 +16,25 @@
 #include "llvm/LLVMContext.h"
 #include "llvm/Module.h"
 #include "llvm/Analysis/Verifier.h"
+#include "llvm/ADT/OwningPtr.h"
 #include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Config/config.h"
+#include "llvm/Support/Atomic.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/SystemUtils.h"
 #include "llvm/Support/IRReader.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Threading.h"
+#include <algorithm>
 #include <memory>
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 using namespace llvm;
 
 static cl::list<std::string>
@@ -49,30 +58,239 @@ Verbose("v", cl::desc("Print information about actions taken"));
 static cl::opt<bool>
 DumpAsm("d", cl::desc("Print assembly as linked"), cl::Hidden);
 
+static cl::opt<unsigned>
+Threads("j", cl::desc("Link the inputs on this many threads"),
+        cl::value_desc("N"), cl::init(1));
+
 // LoadFile - Read the specified bitcode file in and return it.  This routine
-// searches the link path for the specified file to try to find it...
+// searches the link path for the specified file to try to find it...  Messages
+// go to Log.
 //
 static inline std::auto_ptr<Module> LoadFile(const char *argv0,
                                              const std::string &FN, 
-                                             LLVMContext& Context) {
+                                             LLVMContext& Context,
+                                             raw_ostream &Log = errs()) {
   sys::Path Filename;
   if (!Filename.set(FN)) {
-    errs() << "Invalid file name: '" << FN << "'\n";
+    Log << "Invalid file name: '" << FN << "'\n";
     return std::auto_ptr<Module>();
   }
 
   SMDiagnostic Err;
-  if (Verbose) errs() << "Loading '" << Filename.c_str() << "'\n";
+  if (Verbose) Log << "Loading '" << Filename.c_str() << "'\n";
   Module* Result = 0;
   
   const std::string &FNStr = Filename.str();
   Result = ParseIRFile(FNStr, Err, Context);
   if (Result) return std::auto_ptr<Module>(Result);   // Load successful!
 
-  Err.print(argv0, errs());
+  Err.print(argv0, Log);
   return std::auto_ptr<Module>();
 }
 
+//===----------------------------------------------------------------------===//
+// Parallel linking
+//
+// An LLVMContext may only be used by one thread at a time, so with -j each
+// thread links a run of the inputs into a context of its own and writes the
+// result to bitcode.  Neighbouring results are then linked in pairs, again in
+// parallel, until two are left to link into the main context.  Everything is
+// linked in command line order, so the first definition of a weak or linkonce
+// symbol still wins and appending globals keep their order.
+//
+
+namespace {
+  /// LinkedPart - The bitcode of a module linked from the inputs First to
+  /// Last.
+  struct LinkedPart {
+    std::string First, Last;
+    std::string ModuleID;
+    std::string Bitcode;
+
+    std::string getName() const {
+      return First == Last ? First : First + " .. " + Last;
+    }
+  };
+
+  /// LinkJob - Inputs to link in order, either files or earlier parts, and
+  /// where the result goes.  Messages are kept in Log to be printed in order.
+  struct LinkJob {
+    std::vector<std::string> Files;
+    std::vector<const LinkedPart*> Parts;
+    LinkedPart *Result;
+    std::string Log;
+    bool Failed;
+  };
+
+  /// LinkRound - Jobs that can run at the same time.  Each thread takes the
+  /// next one from NextJob.
+  struct LinkRound {
+    const char *argv0;
+    std::vector<LinkJob> *Jobs;
+    volatile sys::cas_flag NextJob;
+  };
+}
+
+/// linkJob - Link the inputs of J into a module in Context, or return null
+/// after writing why to Log.
+static Module *linkJob(const LinkJob &J, const char *argv0,
+                       LLVMContext &Context, raw_ostream &Log) {
+  bool FromFiles = !J.Files.empty();
+  unsigned NumInputs = FromFiles ? J.Files.size() : J.Parts.size();
+  std::auto_ptr<Module> Composite;
+  for (unsigned i = 0; i != NumInputs; ++i) {
+    std::string Name;
+    std::auto_ptr<Module> M;
+    if (FromFiles) {
+      Name = J.Files[i];
+      M = LoadFile(argv0, Name, Context, Log);
+      if (M.get() == 0) {
+        Log << argv0 << ": error loading file '" << Name << "'\n";
+        return 0;
+      }
+    } else {
+      const LinkedPart &Part = *J.Parts[i];
+      Name = Part.getName();
+      std::string ErrorMessage;
+      OwningPtr<MemoryBuffer> Buffer(
+        MemoryBuffer::getMemBuffer(Part.Bitcode, Part.ModuleID, false));
+      M.reset(ParseBitcodeFile(Buffer.get(), Context, &ErrorMessage));
+      if (M.get() == 0) {
+        Log << argv0 << ": error reading the module linked from '" << Name
+            << "': " << ErrorMessage << "\n";
+        return 0;
+      }
+    }
+
+    if (Composite.get() == 0) {
+      Composite = M;
+      continue;
+    }
+
+    if (Verbose) Log << "Linking in '" << Name << "'\n";
+
+    std::string ErrorMessage;
+    if (Linker::LinkModules(Composite.get(), M.get(), Linker::DestroySource,
+                            &ErrorMessage)) {
+      Log << argv0 << ": link error in '" << Name << "': " << ErrorMessage
+          << "\n";
+      return 0;
+    }
+  }
+  return Composite.release();
+}
+
+static void *runLinkJobs(void *Arg) {
+  LinkRound &R = *static_cast<LinkRound*>(Arg);
+  while (true) {
+    unsigned i = sys::AtomicIncrement(&R.NextJob) - 1;
+    if (i >= R.Jobs->size())
+      break;
+    LinkJob &J = (*R.Jobs)[i];
+
+    LLVMContext Context;
+    raw_string_ostream Log(J.Log);
+    OwningPtr<Module> M(linkJob(J, R.argv0, Context, Log));
+    J.Failed = !M;
+    if (M) {
+      J.Result->ModuleID = M->getModuleIdentifier();
+      raw_string_ostream OS(J.Result->Bitcode);
+      WriteBitcodeToFile(M.get(), OS);
+    }
+  }
+  return 0;
+}
+
+/// runLinkRound - Run Jobs on up to -j threads and print their messages.
+/// Returns false if any of them failed.
+static bool runLinkRound(std::vector<LinkJob> &Jobs, const char *argv0) {
+  LinkRound R;
+  R.argv0 = argv0;
+  R.Jobs = &Jobs;
+  R.NextJob = 0;
+
+  // The calling thread is one of the workers.
+  unsigned NumThreads = std::min<unsigned>(Threads, Jobs.size());
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  std::vector<pthread_t> Workers(NumThreads);
+  std::vector<bool> Started(NumThreads);
+  for (unsigned i = 1; i != NumThreads; ++i)
+    Started[i] = ::pthread_create(&Workers[i], 0, runLinkJobs, &R) == 0;
+  runLinkJobs(&R);
+  for (unsigned i = 1; i != NumThreads; ++i)
+    if (Started[i])
+      ::pthread_join(Workers[i], 0);
+#else
+  (void)NumThreads;
+  runLinkJobs(&R);
+#endif
+
+  bool Failed = false;
+  for (unsigned i = 0, e = Jobs.size(); i != e; ++i) {
+    errs() << Jobs[i].Log;
+    Failed |= Jobs[i].Failed;
+  }
+  return !Failed;
+}
+
+/// linkInParallel - Link the inputs as described above and return the result,
+/// or null after reporting an error.
+static Module *linkInParallel(const char *argv0, LLVMContext &Context) {
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  if (!llvm_is_multithreaded())
+    llvm_start_multithreaded();
+#endif
+
+  // Give each thread a run of the inputs.
+  unsigned NumFiles = InputFilenames.size();
+  unsigned NumRuns = std::min<unsigned>(Threads, NumFiles);
+  std::vector<LinkedPart> Parts(NumRuns);
+  std::vector<LinkJob> Jobs(NumRuns);
+  for (unsigned i = 0; i != NumRuns; ++i) {
+    unsigned Begin = NumFiles * i / NumRuns;
+    unsigned End = NumFiles * (i + 1) / NumRuns;
+    Jobs[i].Files.assign(InputFilenames.begin() + Begin,
+                         InputFilenames.begin() + End);
+    Jobs[i].Result = &Parts[i];
+    Parts[i].First = InputFilenames[Begin];
+    Parts[i].Last = InputFilenames[End - 1];
+  }
+  if (!runLinkRound(Jobs, argv0))
+    return 0;
+
+  // Link neighbouring parts until two are left.  An odd one out moves on to
+  // the next round as it is.
+  while (Parts.size() > 2) {
+    unsigned NumPairs = Parts.size() / 2;
+    std::vector<LinkedPart> Linked(NumPairs + Parts.size() % 2);
+    Jobs.clear();
+    Jobs.resize(NumPairs);
+    for (unsigned i = 0; i != NumPairs; ++i) {
+      const LinkedPart &First = Parts[2 * i], &Second = Parts[2 * i + 1];
+      Jobs[i].Parts.push_back(&First);
+      Jobs[i].Parts.push_back(&Second);
+      Jobs[i].Result = &Linked[i];
+      Linked[i].First = First.First;
+      Linked[i].Last = Second.Last;
+    }
+    if (Parts.size() % 2) {
+      LinkedPart &Last = Linked.back();
+      Last.First = Parts.back().First;
+      Last.Last = Parts.back().Last;
+      Last.ModuleID = Parts.back().ModuleID;
+      Last.Bitcode.swap(Parts.back().Bitcode);
+    }
+    if (!runLinkRound(Jobs, argv0))
+      return 0;
+    Parts.swap(Linked);
+  }
+
+  LinkJob Final;
+  for (unsigned i = 0, e = Parts.size(); i != e; ++i)
+    Final.Parts.push_back(&Parts[i]);
+  return linkJob(Final, argv0, Context, errs());
+}
+
 int main(int argc, char **argv) {
   // Print a stack trace if we signal out.
   sys::PrintStackTraceOnErrorSignal();
@@ -85,12 +303,19 @@ int main(int argc, char **argv) {
   unsigned BaseArg = 0;
   std::string ErrorMessage;
 
-  std::auto_ptr<Module> Composite(LoadFile(argv[0],
-                                           InputFilenames[BaseArg], Context));
-  if (Composite.get() == 0) {
-    errs() << argv[0] << ": error loading file '"
-           << InputFilenames[BaseArg] << "'\n";
-    return 1;
+  std::auto_ptr<Module> Composite;
+  if (Threads > 1 && InputFilenames.size() > 2) {
+    Composite.reset(linkInParallel(argv[0], Context));
+    if (Composite.get() == 0)
+      return 1;
+    BaseArg = InputFilenames.size();
+  } else {
+    Composite = LoadFile(argv[0], InputFilenames[BaseArg], Context);
+    if (Composite.get() == 0) {
+      errs() << argv[0] << ": error loading file '"
+             << InputFilenames[BaseArg] << "'\n";
+      return 1;
+    }
   }
 
   for (unsigned i = BaseArg+1; i < InputFilenames.size(); ++i) {
@@ -32,6 +32,7 @@
 #include "llvm/Target/TargetData.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetRegisterInfo.h"
+#include "llvm/Transforms/CanTM.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Support/CommandLine.h"
@@ -44,6 +45,7 @@
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/system_error.h"
 #include "llvm/ADT/StringExtras.h"
+#include <cstdlib>
 using namespace llvm;
 
 static cl::opt<bool> DisableInline("disable-inlining", cl::init(false),
@@ -52,6 +54,19 @@ static cl::opt<bool> DisableInline("disable-inlining", cl::init(false),
 static cl::opt<bool> DisableGVNLoadPRE("disable-gvn-loadpre", cl::init(false),
   cl::desc("Do not run the GVN load PRE pass"));
 
+// The CanTM pass registers itself at the end of the link-time pipeline and
+// runs on the merged module when -cantm-pipeline is given. Reference it so
+// that it is pulled out of its archive.
+namespace {
+  struct ForceCanTMLinking {
+    ForceCanTMLinking() {
+      if (std::getenv("bar") != (char*) -1)
+        return;
+      (void) llvm::createCanTMPass();
+    }
+  } ForceCanTMLinking;
+}
+
 const char* LTOCodeGenerator::getVersionString() {
 #ifdef LLVM_VERSION_INFO
   return PACKAGE_NAME " version " PACKAGE_VERSION ", " LLVM_VERSION_INFO;
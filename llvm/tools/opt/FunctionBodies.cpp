@@ -0,0 +1,84 @@
+//===- FunctionBodies.cpp - Move function bodies between modules ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the helpers that opt -j and -function-cache use to put
+// bodies optimized in a module of their own back into the original one.
+//
+//===----------------------------------------------------------------------===//
+
+#include "FunctionBodies.h"
+#include "llvm/BasicBlock.h"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Function.h"
+#include "llvm/Instruction.h"
+#include "llvm/Module.h"
+using namespace llvm;
+
+bool llvm::hasAddressTakenOutside(Function &F) {
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    if (!BB->hasAddressTaken())
+      continue;
+    BlockAddress *BA = BlockAddress::get(BB);
+    for (Value::use_iterator UI = BA->use_begin(), UE = BA->use_end();
+         UI != UE; ++UI) {
+      Instruction *I = dyn_cast<Instruction>(*UI);
+      if (!I || I->getParent()->getParent() != &F)
+        return true;
+    }
+  }
+  return false;
+}
+
+/// exposeLocal - Make GV visible to other modules, remembering how to undo it.
+static void exposeLocal(GlobalValue *GV, std::vector<LocalSymbol> &Locals) {
+  bool Unnamed = !GV->hasName();
+  if (!GV->hasLocalLinkage() && !Unnamed)
+    return;
+
+  LocalSymbol L = { GV, GV->getLinkage(), GV->getVisibility(), Unnamed };
+  Locals.push_back(L);
+  if (Unnamed)
+    GV->setName("opt.shared");
+  if (GV->hasLocalLinkage()) {
+    GV->setLinkage(GlobalValue::ExternalLinkage);
+    GV->setVisibility(GlobalValue::HiddenVisibility);
+  }
+}
+
+void llvm::exposeLocals(Module &M, std::vector<LocalSymbol> &Locals) {
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+    exposeLocal(F, Locals);
+  for (Module::global_iterator I = M.global_begin(), E = M.global_end();
+       I != E; ++I)
+    exposeLocal(I, Locals);
+}
+
+void llvm::restoreLocals(std::vector<LocalSymbol> &Locals) {
+  for (unsigned i = 0, e = Locals.size(); i != e; ++i) {
+    LocalSymbol &L = Locals[i];
+    L.GV->setLinkage(L.Linkage);
+    L.GV->setVisibility(L.Visibility);
+    if (L.Unnamed)
+      L.GV->setName("");
+  }
+}
+
+void llvm::replaceBody(Function *F, Function *New) {
+  F->dropAllReferences();
+  F->getBasicBlockList().splice(F->end(), New->getBasicBlockList());
+  for (Function::arg_iterator OA = F->arg_begin(), NA = New->arg_begin(),
+       AE = F->arg_end(); OA != AE; ++OA, ++NA) {
+    NA->replaceAllUsesWith(OA);
+    OA->takeName(NA);
+  }
+  F->setAttributes(New->getAttributes());
+  New->replaceAllUsesWith(ConstantExpr::getBitCast(F, New->getType()));
+  New->eraseFromParent();
+}
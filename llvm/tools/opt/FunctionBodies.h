@@ -0,0 +1,54 @@
+//===- FunctionBodies.h - Move function bodies between modules --*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Helpers shared by opt -j and -function-cache, which optimize functions in a
+// module of their own and then put the new bodies back into the original one.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OPT_FUNCTION_BODIES_H
+#define OPT_FUNCTION_BODIES_H
+
+#include "llvm/GlobalValue.h"
+#include <vector>
+
+namespace llvm {
+
+class Function;
+class Module;
+
+/// LocalSymbol - A global that had local linkage, or no name, before it was
+/// made visible to other modules.
+struct LocalSymbol {
+  GlobalValue *GV;
+  GlobalValue::LinkageTypes Linkage;
+  GlobalValue::VisibilityTypes Visibility;
+  bool Unnamed;
+};
+
+/// exposeLocals - Give the local globals of M hidden external linkage, and the
+/// unnamed ones a name, so that a module linked in can refer to them.
+/// Locals records how to undo it.
+void exposeLocals(Module &M, std::vector<LocalSymbol> &Locals);
+
+/// restoreLocals - Undo exposeLocals.
+void restoreLocals(std::vector<LocalSymbol> &Locals);
+
+/// hasAddressTakenOutside - Return true if the address of a block of F is
+/// used anywhere but in F itself, which splitting F from its users would
+/// break.
+bool hasAddressTakenOutside(Function &F);
+
+/// replaceBody - Move the body of New, which must have the same arguments as
+/// F, into F and delete New.  F keeps its place, name and linkage.
+void replaceBody(Function *F, Function *New);
+
+} // End llvm namespace
+
+#endif
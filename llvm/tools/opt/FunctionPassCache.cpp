@@ -0,0 +1,407 @@
+//===- FunctionPassCache.cpp - Reuse optimized function bodies ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements opt -function-cache=<dir>, which keeps the result of
+// running a list of function passes over each function in <dir>, so that a
+// later run over a function that hasn't changed reuses the result instead of
+// optimizing it again.
+//
+// An entry is keyed by all that the passes can see of the function: the
+// version of opt and its command line, the target, and a module holding the
+// function, declarations of the globals it refers to and the initializers of
+// the constants among them.  That module numbers values and metadata on its
+// own, so its bitcode doesn't change with edits elsewhere in the file.  The
+// entry is named after the MD5 hash of the key, which is the same on every
+// run and host, and holds the key itself, to rule out collisions, followed by
+// the bitcode of a module holding the optimized function.  On a hit, that
+// module is linked in and its body moved into the original function.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "function-cache"
+#include "FunctionBodies.h"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Function.h"
+#include "llvm/GlobalVariable.h"
+#include "llvm/Instructions.h"
+#include "llvm/Linker.h"
+#include "llvm/Metadata.h"
+#include "llvm/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Config/config.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetLibraryInfo.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include <vector>
+using namespace llvm;
+
+STATISTIC(NumHits,   "Number of functions taken from the cache");
+STATISTIC(NumMisses, "Number of functions optimized");
+STATISTIC(NumStored, "Number of functions added to the cache");
+
+namespace {
+  /// References - The globals a function refers to, directly or through
+  /// constants and metadata.
+  struct References {
+    SetVector<GlobalValue*> Globals;
+    SmallPtrSet<const Value*, 32> Visited;
+    bool Cacheable;
+
+    References() : Cacheable(true) {}
+  };
+
+  /// CachedFunction - A function of the module and where its entry is.
+  struct CachedFunction {
+    Function *F;
+    SmallPtrSet<GlobalValue*, 16> Inputs;
+    std::string Key;
+    std::string Path;
+    std::string Bitcode;
+  };
+}
+
+/// addReferences - Add the globals that V refers to.  Constant globals are
+/// followed into their initializers, which passes may fold loads from.
+static void addReferences(const Value *V, References &Refs) {
+  if (!V || !Refs.Visited.insert(V))
+    return;
+
+  if (const GlobalValue *GV = dyn_cast<GlobalValue>(V)) {
+    // An unnamed global can't be found again in the next run's module, and an
+    // alias would need its aliasee.
+    if (!GV->hasName() || isa<GlobalAlias>(GV)) {
+      Refs.Cacheable = false;
+      return;
+    }
+    Refs.Globals.insert(const_cast<GlobalValue*>(GV));
+    const GlobalVariable *GVar = dyn_cast<GlobalVariable>(GV);
+    if (GVar && GVar->isConstant() && GVar->hasDefinitiveInitializer())
+      addReferences(GVar->getInitializer(), Refs);
+    return;
+  }
+
+  if (isa<BlockAddress>(V)) {
+    Refs.Cacheable = false;
+    return;
+  }
+
+  if (const MDNode *N = dyn_cast<MDNode>(V)) {
+    for (unsigned i = 0, e = N->getNumOperands(); i != e; ++i)
+      addReferences(N->getOperand(i), Refs);
+    return;
+  }
+
+  if (const Constant *C = dyn_cast<Constant>(V))
+    for (unsigned i = 0, e = C->getNumOperands(); i != e; ++i)
+      addReferences(C->getOperand(i), Refs);
+}
+
+static void addReferences(Function &F, References &Refs) {
+  SmallVector<std::pair<unsigned, MDNode*>, 4> MDs;
+  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+    for (User::op_iterator OI = I->op_begin(), OE = I->op_end(); OI != OE;
+         ++OI)
+      addReferences(*OI, Refs);
+    I->getAllMetadata(MDs);
+    for (unsigned i = 0, e = MDs.size(); i != e; ++i)
+      addReferences(MDs[i].second, Refs);
+  }
+}
+
+/// cloneFunction - Copy F into a module of its own, which declares the
+/// globals in Refs and defines those in Define with their initializers.
+static Module *cloneFunction(Function &F, const References &Refs,
+                             const SmallPtrSet<GlobalValue*, 8> &Define) {
+  Module &M = *F.getParent();
+  Module *Clone = new Module(F.getName(), F.getContext());
+  Clone->setTargetTriple(M.getTargetTriple());
+  Clone->setDataLayout(M.getDataLayout());
+
+  ValueToValueMapTy VMap;
+  Function *NewF = Function::Create(F.getFunctionType(), F.getLinkage(),
+                                    F.getName(), Clone);
+  NewF->copyAttributesFrom(&F);
+  VMap[&F] = NewF;
+
+  for (unsigned i = 0, e = Refs.Globals.size(); i != e; ++i) {
+    GlobalValue *GV = Refs.Globals[i];
+    if (GV == &F)
+      continue;
+    GlobalValue *New;
+    if (Function *Callee = dyn_cast<Function>(GV)) {
+      New = Function::Create(Callee->getFunctionType(),
+                             GlobalValue::ExternalLinkage, Callee->getName(),
+                             Clone);
+    } else {
+      GlobalVariable *G = cast<GlobalVariable>(GV);
+      New = new GlobalVariable(*Clone, G->getType()->getElementType(),
+                               G->isConstant(), GlobalValue::ExternalLinkage,
+                               0, G->getName(), 0, G->isThreadLocal(),
+                               G->getType()->getAddressSpace());
+    }
+    New->copyAttributesFrom(GV);
+    VMap[GV] = New;
+  }
+
+  // Initializers may refer to any of the globals, so they come last.
+  for (unsigned i = 0, e = Refs.Globals.size(); i != e; ++i) {
+    GlobalVariable *G = dyn_cast<GlobalVariable>(Refs.Globals[i]);
+    if (!G || !Define.count(G))
+      continue;
+    GlobalVariable *New = cast<GlobalVariable>(VMap[G]);
+    New->setInitializer(MapValue(G->getInitializer(), VMap));
+    New->setLinkage(G->getLinkage());
+  }
+
+  Function::arg_iterator NA = NewF->arg_begin();
+  for (Function::arg_iterator A = F.arg_begin(), E = F.arg_end(); A != E;
+       ++A, ++NA) {
+    NA->setName(A->getName());
+    VMap[A] = NA;
+  }
+  SmallVector<ReturnInst*, 8> Returns;
+  CloneFunctionInto(NewF, &F, VMap, /*ModuleLevelChanges=*/true, Returns);
+  return Clone;
+}
+
+/// getKey - Describe to Key all that Pipeline can see of F, which refers to
+/// Refs.
+static void getKey(Function &F, const References &Refs,
+                   const std::string &Pipeline, std::string &Key) {
+  SmallPtrSet<GlobalValue*, 8> Define;
+  for (unsigned i = 0, e = Refs.Globals.size(); i != e; ++i) {
+    GlobalVariable *G = dyn_cast<GlobalVariable>(Refs.Globals[i]);
+    if (G && G->isConstant() && G->hasDefinitiveInitializer())
+      Define.insert(G);
+  }
+  OwningPtr<Module> Clone(cloneFunction(F, Refs, Define));
+
+  // The clone only declares most globals, so say what they were.
+  raw_string_ostream OS(Key);
+  OS << Pipeline;
+  for (unsigned i = 0, e = Refs.Globals.size(); i != e; ++i) {
+    GlobalValue *GV = Refs.Globals[i];
+    OS << GV->getName() << ' ' << unsigned(GV->getLinkage()) << ' '
+       << GV->isDeclaration() << '\n';
+  }
+  OS << '\n';
+  WriteBitcodeToFile(Clone.get(), OS);
+  OS.flush();
+}
+
+/// lookup - Read the entry of CF and keep its bitcode if the key matches.
+static void lookup(CachedFunction &CF) {
+  OwningPtr<MemoryBuffer> Buffer;
+  if (MemoryBuffer::getFile(CF.Path, Buffer))
+    return;
+
+  // The entry is the size of the key on a line of its own, the key and the
+  // bitcode.
+  StringRef Entry = Buffer->getBuffer();
+  std::pair<StringRef, StringRef> Split = Entry.split('\n');
+  uint64_t KeySize;
+  if (Split.first.getAsInteger(10, KeySize) || KeySize > Split.second.size() ||
+      Split.second.substr(0, KeySize) != CF.Key)
+    return;
+  CF.Bitcode = Split.second.substr(KeySize);
+}
+
+/// store - Write the entry of CF, whose function has been optimized.
+/// Failing to is not an error; the function is optimized again next time.
+static void store(CachedFunction &CF, const std::string &CacheDir) {
+  Function &F = *CF.F;
+  References Refs;
+  addReferences(F, Refs);
+  if (!Refs.Cacheable)
+    return;
+
+  // Globals the passes created are defined in the entry, provided they are
+  // constants that can be renamed.
+  SmallPtrSet<GlobalValue*, 8> Define;
+  for (unsigned i = 0, e = Refs.Globals.size(); i != e; ++i) {
+    GlobalValue *GV = Refs.Globals[i];
+    if (GV == &F || CF.Inputs.count(GV) || !GV->hasLocalLinkage())
+      continue;
+    GlobalVariable *G = dyn_cast<GlobalVariable>(GV);
+    if (!G || !G->isConstant() || !G->hasDefinitiveInitializer())
+      return;
+    Define.insert(G);
+  }
+  OwningPtr<Module> Clone(cloneFunction(F, Refs, Define));
+
+  // Write to a file of its own and rename it, so that a concurrent run never
+  // sees half an entry.
+  int FD;
+  SmallString<128> TempPath;
+  if (sys::fs::unique_file(CacheDir + "/%%%%%%%%.tmp", FD, TempPath, false))
+    return;
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << CF.Key.size() << '\n' << CF.Key;
+    WriteBitcodeToFile(Clone.get(), OS);
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      bool Existed;
+      sys::fs::remove(TempPath.str(), Existed);
+      return;
+    }
+  }
+  if (sys::fs::rename(TempPath.str(), CF.Path)) {
+    bool Existed;
+    sys::fs::remove(TempPath.str(), Existed);
+    return;
+  }
+  ++NumStored;
+}
+
+/// useEntry - Replace the body of the function of CF by the one in its entry.
+/// Returns false if the entry can't be read.
+static bool useEntry(CachedFunction &CF) {
+  Function &F = *CF.F;
+  Module &M = *F.getParent();
+
+  std::string ErrorMsg;
+  OwningPtr<MemoryBuffer> Buffer(
+    MemoryBuffer::getMemBuffer(CF.Bitcode, "", false));
+  OwningPtr<Module> Src(ParseBitcodeFile(Buffer.get(), M.getContext(),
+                                         &ErrorMsg));
+  Function *New = Src ? Src->getFunction(F.getName()) : 0;
+  if (!New || New->isDeclaration())
+    return false;
+
+  New->setName(F.getName() + ".cached");
+  New->setLinkage(GlobalValue::ExternalLinkage);
+  std::string Renamed = New->getName();
+  if (Linker::LinkModules(&M, Src.get(), Linker::DestroySource, &ErrorMsg))
+    report_fatal_error("opt -function-cache: could not link the entry '" +
+                       CF.Path + "': " + ErrorMsg);
+
+  New = M.getFunction(Renamed);
+  if (!New || New->getFunctionType() != F.getFunctionType())
+    report_fatal_error("opt -function-cache: the entry '" + CF.Path +
+                       "' doesn't match '" + F.getName().str() + "'");
+  replaceBody(&F, New);
+  return true;
+}
+
+/// runFunctionPassesWithCache - Run Passes, which must all be function
+/// passes, over the functions of M, taking the result from the cache in
+/// CacheDir for those that it has seen before and adding the others.
+/// CommandLine is the command line of opt, whose options may change what the
+/// passes do.  Returns false, with the reason in ErrorMsg, if the cache can't
+/// be used; the caller then runs the passes as usual.
+bool runFunctionPassesWithCache(Module &M,
+                                const std::vector<const PassInfo*> &Passes,
+                                const std::string &CacheDir,
+                                const std::string &CommandLine,
+                                const std::string &DataLayout,
+                                bool DisableSimplifyLibCalls,
+                                std::string &ErrorMsg) {
+  bool Existed;
+  if (error_code EC = sys::fs::create_directories(CacheDir, Existed)) {
+    ErrorMsg = "could not create '" + CacheDir + "': " + EC.message();
+    return false;
+  }
+
+  // Everything that decides what the passes do, other than the function.
+  std::string Pipeline = "opt -function-cache 2\n";
+  Pipeline += "LLVM " PACKAGE_VERSION "\n";
+#ifdef LLVM_VERSION_INFO
+  Pipeline += LLVM_VERSION_INFO "\n";
+#endif
+  Pipeline += CommandLine + "\n";
+  for (unsigned i = 0, e = Passes.size(); i != e; ++i)
+    Pipeline += std::string("-") + Passes[i]->getPassArgument() + "\n";
+  Pipeline += M.getTargetTriple() + "\n" + DataLayout + "\n";
+  if (DisableSimplifyLibCalls)
+    Pipeline += "-disable-simplify-libcalls\n";
+
+  // Work out every key before the passes change any declarations.
+  std::vector<CachedFunction> Functions;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+    if (!F->isDeclaration())
+      Functions.push_back(CachedFunction());
+  Module::iterator FI = M.begin();
+  for (unsigned i = 0, e = Functions.size(); i != e; ++i, ++FI) {
+    while (FI->isDeclaration())
+      ++FI;
+    CachedFunction &CF = Functions[i];
+    CF.F = FI;
+
+    References Refs;
+    addReferences(*CF.F, Refs);
+    if (!Refs.Cacheable || !CF.F->hasName() || hasAddressTakenOutside(*CF.F))
+      continue;
+    CF.Inputs.insert(Refs.Globals.begin(), Refs.Globals.end());
+    getKey(*CF.F, Refs, Pipeline, CF.Key);
+
+    MD5 Hash;
+    Hash.update(CF.Key);
+    MD5::MD5Result Result;
+    Hash.final(Result);
+    SmallString<32> Name;
+    MD5::stringifyResult(Result, Name);
+    CF.Path = CacheDir + "/" + Name.str().str() + ".fn";
+    lookup(CF);
+  }
+
+  // Use the entries that were found.  Entries refer to the local globals of
+  // M by name.
+  std::vector<LocalSymbol> Locals;
+  exposeLocals(M, Locals);
+  for (unsigned i = 0, e = Functions.size(); i != e; ++i) {
+    CachedFunction &CF = Functions[i];
+    if (!CF.Bitcode.empty() && !useEntry(CF))
+      CF.Bitcode.clear();
+    if (!CF.Bitcode.empty())
+      ++NumHits;
+  }
+  restoreLocals(Locals);
+
+  // Optimize the rest and add them to the cache.
+  FunctionPassManager FPM(&M);
+  TargetLibraryInfo *TLI = new TargetLibraryInfo(Triple(M.getTargetTriple()));
+  if (DisableSimplifyLibCalls)
+    TLI->disableAllFunctions();
+  FPM.add(TLI);
+  if (!DataLayout.empty())
+    FPM.add(new TargetData(DataLayout));
+  for (unsigned i = 0, e = Passes.size(); i != e; ++i)
+    FPM.add(Passes[i]->getNormalCtor()());
+
+  FPM.doInitialization();
+  for (unsigned i = 0, e = Functions.size(); i != e; ++i) {
+    CachedFunction &CF = Functions[i];
+    if (!CF.Bitcode.empty())
+      continue;
+    FPM.run(*CF.F);
+    ++NumMisses;
+    if (!CF.Path.empty())
+      store(CF, CacheDir);
+  }
+  FPM.doFinalization();
+  return true;
+}
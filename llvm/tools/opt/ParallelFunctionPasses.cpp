@@ -0,0 +1,274 @@
+//===- ParallelFunctionPasses.cpp - Run function passes on threads --------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements opt -j N, which runs a pipeline of function passes over
+// shards of the module's functions on N threads.
+//
+// An LLVMContext may only be used by one thread at a time: types, constants
+// and metadata are uniqued in it, and the use lists of globals are shared by
+// every function that refers to them.  Rather than locking all of those, each
+// thread reads its own copy of the module from bitcode, into a context of its
+// own, with only the functions of its shard defined and with its own instances
+// of the passes.  The optimized functions are written back to bitcode and
+// their bodies moved into the original module, which is the only part that
+// runs serially.
+//
+//===----------------------------------------------------------------------===//
+
+#include "FunctionBodies.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Linker.h"
+#include "llvm/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Config/config.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetLibraryInfo.h"
+#include <algorithm>
+#include <vector>
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
+using namespace llvm;
+
+namespace {
+  /// ParallelPipeline - What every thread needs to rebuild the pipeline.
+  struct ParallelPipeline {
+    const std::vector<const PassInfo*> *Passes;
+    std::string DataLayout;
+    bool DisableSimplifyLibCalls;
+    std::string Bitcode;
+  };
+
+  /// Shard - The functions one thread optimizes, as indices into the
+  /// module's function list, and what it produced: a module holding their
+  /// new bodies under the names in Renamed.
+  struct Shard {
+    const ParallelPipeline *Pipeline;
+    std::vector<unsigned> Functions;
+    std::vector<std::string> Renamed;
+    std::string Bitcode;
+    std::string ErrorMsg;
+  };
+}
+
+/// getFunctionSize - The number of instructions in F, used to balance the
+/// shards.
+static unsigned getFunctionSize(const Function &F) {
+  unsigned Size = 0;
+  for (Function::const_iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    Size += BB->size();
+  return Size;
+}
+
+/// runShard - Optimize the functions of one shard in a context of its own.
+static void *runShard(void *Arg) {
+  Shard &S = *static_cast<Shard*>(Arg);
+  const ParallelPipeline &P = *S.Pipeline;
+  LLVMContext Context;
+
+  OwningPtr<MemoryBuffer> Buffer(
+    MemoryBuffer::getMemBuffer(P.Bitcode, "", false));
+  OwningPtr<Module> M(ParseBitcodeFile(Buffer.get(), Context, &S.ErrorMsg));
+  if (!M)
+    return 0;
+
+  // Everything outside of the shard becomes a declaration.
+  std::vector<Function*> Functions;
+  unsigned Index = 0, Next = 0;
+  for (Module::iterator F = M->begin(), E = M->end(); F != E; ++F, ++Index) {
+    if (Next < S.Functions.size() && S.Functions[Next] == Index) {
+      Functions.push_back(F);
+      ++Next;
+    } else if (!F->isDeclaration()) {
+      F->deleteBody();
+    }
+  }
+
+  SmallPtrSet<GlobalVariable*, 32> Original;
+  for (Module::global_iterator I = M->global_begin(), E = M->global_end();
+       I != E; ++I)
+    Original.insert(I);
+
+  FunctionPassManager FPM(M.get());
+  TargetLibraryInfo *TLI = new TargetLibraryInfo(Triple(M->getTargetTriple()));
+  if (P.DisableSimplifyLibCalls)
+    TLI->disableAllFunctions();
+  FPM.add(TLI);
+  if (!P.DataLayout.empty())
+    FPM.add(new TargetData(P.DataLayout));
+  for (unsigned i = 0, e = P.Passes->size(); i != e; ++i)
+    FPM.add((*P.Passes)[i]->getNormalCtor()());
+
+  FPM.doInitialization();
+  for (unsigned i = 0, e = Functions.size(); i != e; ++i)
+    FPM.run(*Functions[i]);
+  FPM.doFinalization();
+
+  // Only send back what the original module doesn't already have: the new
+  // bodies, under names that don't clash with the old ones, and any globals
+  // the passes created.
+  for (unsigned i = 0, e = Functions.size(); i != e; ++i) {
+    Function *F = Functions[i];
+    F->setName(F->getName() + ".shard");
+    F->setLinkage(GlobalValue::ExternalLinkage);
+    S.Renamed.push_back(F->getName());
+  }
+  std::vector<GlobalVariable*> Appending;
+  for (Module::global_iterator I = M->global_begin(), E = M->global_end();
+       I != E; ++I) {
+    if (!Original.count(I))
+      continue;
+    if (I->hasAppendingLinkage()) {
+      Appending.push_back(I);
+      continue;
+    }
+    I->setInitializer(0);
+    I->setLinkage(GlobalValue::ExternalLinkage);
+  }
+  for (unsigned i = 0, e = Appending.size(); i != e; ++i)
+    Appending[i]->eraseFromParent();
+  while (!M->named_metadata_empty())
+    M->named_metadata_begin()->eraseFromParent();
+  M->setModuleInlineAsm("");
+
+  raw_string_ostream OS(S.Bitcode);
+  WriteBitcodeToFile(M.get(), OS);
+  OS.flush();
+  return 0;
+}
+
+/// mergeShard - Link the module the shard produced into M and move the new
+/// bodies into the original functions, which keep their place, name and
+/// linkage.
+static void mergeShard(Module &M, const Shard &S) {
+  std::vector<Function*> Functions;
+  Module::iterator F = M.begin();
+  for (unsigned i = 0, Index = 0, e = S.Functions.size(); i != e; ++i) {
+    for (; Index != S.Functions[i]; ++Index)
+      ++F;
+    Functions.push_back(F);
+  }
+
+  std::string ErrorMsg;
+  OwningPtr<MemoryBuffer> Buffer(
+    MemoryBuffer::getMemBuffer(S.Bitcode, "", false));
+  Module *Src = ParseBitcodeFile(Buffer.get(), M.getContext(), &ErrorMsg);
+  if (!Src || Linker::LinkModules(&M, Src, Linker::DestroySource, &ErrorMsg))
+    report_fatal_error("opt -j: could not merge optimized functions: " +
+                       ErrorMsg);
+  delete Src;
+
+  for (unsigned i = 0, e = Functions.size(); i != e; ++i) {
+    Function *New = M.getFunction(S.Renamed[i]);
+    if (!New)
+      report_fatal_error("opt -j: optimized function '" + S.Renamed[i] +
+                         "' went missing");
+    replaceBody(Functions[i], New);
+  }
+}
+
+/// runFunctionPassesInParallel - Run Passes, which must all be function
+/// passes, over the functions of M on up to Threads threads.  Returns false,
+/// with the reason in ErrorMsg if there is one worth reporting, when M can't
+/// be split; the caller then runs the passes as usual.
+bool runFunctionPassesInParallel(Module &M,
+                                 const std::vector<const PassInfo*> &Passes,
+                                 unsigned Threads,
+                                 const std::string &DataLayout,
+                                 bool DisableSimplifyLibCalls,
+                                 std::string &ErrorMsg) {
+  if (!M.alias_empty()) {
+    ErrorMsg = "modules with aliases are not split";
+    return false;
+  }
+
+  std::vector<std::pair<unsigned, unsigned> > Sizes;
+  unsigned Index = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F, ++Index) {
+    if (F->isDeclaration())
+      continue;
+    if (hasAddressTakenOutside(*F)) {
+      ErrorMsg = "the address of a block of '" + F->getName().str() +
+                 "' is taken outside of it";
+      return false;
+    }
+    Sizes.push_back(std::make_pair(getFunctionSize(*F), Index));
+  }
+  Threads = std::min<unsigned>(Threads, Sizes.size());
+  if (Threads < 2)
+    return false;
+
+  // Give each function, largest first, to the least loaded shard.
+  ParallelPipeline Pipeline;
+  std::vector<Shard> Shards(Threads);
+  std::vector<unsigned> Load(Threads);
+  std::sort(Sizes.begin(), Sizes.end());
+  for (unsigned i = Sizes.size(); i != 0; --i) {
+    unsigned Min = std::min_element(Load.begin(), Load.end()) - Load.begin();
+    Load[Min] += Sizes[i - 1].first + 1;
+    Shards[Min].Functions.push_back(Sizes[i - 1].second);
+  }
+  for (unsigned i = 0; i != Threads; ++i) {
+    std::sort(Shards[i].Functions.begin(), Shards[i].Functions.end());
+    Shards[i].Pipeline = &Pipeline;
+  }
+
+  // A shard refers to the globals of the others by name, so local symbols
+  // become hidden external ones until the bodies are back.
+  std::vector<LocalSymbol> Locals;
+  exposeLocals(M, Locals);
+
+  Pipeline.Passes = &Passes;
+  Pipeline.DataLayout = DataLayout;
+  Pipeline.DisableSimplifyLibCalls = DisableSimplifyLibCalls;
+  raw_string_ostream OS(Pipeline.Bitcode);
+  WriteBitcodeToFile(&M, OS);
+  OS.flush();
+
+  // The calling thread takes the first shard itself.
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  if (!llvm_is_multithreaded())
+    llvm_start_multithreaded();
+  std::vector<pthread_t> Workers(Threads);
+  std::vector<bool> Started(Threads);
+  for (unsigned i = 1; i != Threads; ++i)
+    Started[i] = ::pthread_create(&Workers[i], 0, runShard, &Shards[i]) == 0;
+  runShard(&Shards[0]);
+  for (unsigned i = 1; i != Threads; ++i) {
+    if (Started[i])
+      ::pthread_join(Workers[i], 0);
+    else
+      runShard(&Shards[i]);
+  }
+#else
+  for (unsigned i = 0; i != Threads; ++i)
+    runShard(&Shards[i]);
+#endif
+
+  for (unsigned i = 0; i != Threads; ++i) {
+    if (Shards[i].Bitcode.empty()) {
+      ErrorMsg = Shards[i].ErrorMsg;
+      restoreLocals(Locals);
+      return false;
+    }
+  }
+
+  for (unsigned i = 0; i != Threads; ++i)
+    mergeShard(M, Shards[i]);
+  restoreLocals(Locals);
+  return true;
+}
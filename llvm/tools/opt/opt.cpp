@@ -26,6 +26,7 @@
 #include "llvm/Target/TargetData.h"
 #include "llvm/Target/TargetLibraryInfo.h"
 #include "llvm/Target/TargetMachine.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/Support/PassNameParser.h"
@@ -144,6 +145,38 @@ DefaultDataLayout("default-data-layout",
           cl::desc("data layout string to use if not specified by module"),
           cl::value_desc("layout-string"), cl::init(""));
 
+static cl::opt<unsigned>
+Threads("j", cl::desc("Run a pipeline of function passes on N threads"),
+        cl::value_desc("N"), cl::init(1));
+
+static cl::opt<bool>
+LazyBitcode("lazy-bitcode",
+            cl::desc("Read function bodies from the bitcode file only when a "
+                     "pass needs them"));
+
+static cl::opt<std::string>
+FunctionCache("function-cache",
+              cl::desc("Reuse the functions optimized by earlier runs from "
+                       "this directory"),
+              cl::value_desc("directory"));
+
+// Defined in ParallelFunctionPasses.cpp
+extern bool runFunctionPassesInParallel(Module &M,
+                                        const std::vector<const PassInfo*> &Passes,
+                                        unsigned Threads,
+                                        const std::string &DataLayout,
+                                        bool DisableSimplifyLibCalls,
+                                        std::string &ErrorMsg);
+
+// Defined in FunctionPassCache.cpp
+extern bool runFunctionPassesWithCache(Module &M,
+                                       const std::vector<const PassInfo*> &Passes,
+                                       const std::string &CacheDir,
+                                       const std::string &CommandLine,
+                                       const std::string &DataLayout,
+                                       bool DisableSimplifyLibCalls,
+                                       std::string &ErrorMsg);
+
 // ---------- Define Printers for module and function passes ------------
 namespace {
 
@@ -466,6 +499,64 @@ static void AddStandardLinkPasses(PassManagerBase &PM) {
 }
 
 
+/// canRunFunctionPassesAlone - -j and -function-cache, named by Option, apply
+/// when the command line holds nothing but a list of passes, and nothing needs
+/// to see them interleaved.  checkFunctionPasses checks the passes themselves.
+static bool canRunFunctionPassesAlone(const char *argv0, const char *Option) {
+  const char *Reason = 0;
+  if (PassList.empty() || StandardCompileOpts || StandardLinkOpts ||
+      OptLevelO1 || OptLevelO2 || OptLevelO3 || StripDebug)
+    Reason = "only lists of function passes are supported";
+  else if (AnalyzeOnly || PrintEachXForm || VerifyEach || PrintBreakpoints ||
+           TimePassesIsEnabled)
+    Reason = "the passes must run in order on one thread";
+  else if (LazyBitcode)
+    Reason = "-lazy-bitcode reads one function at a time";
+
+  if (Reason)
+    errs() << argv0 << ": " << Option << " ignored: " << Reason << "\n";
+  return !Reason;
+}
+
+/// SafeFunctionPasses - The transformations -j and -function-cache run.  Each
+/// of them changes nothing but the function it runs on, apart from adding
+/// declarations and private constants.  Passes that change the rest of the
+/// module, like the sanitizers appending to llvm.global_ctors, would have
+/// their changes made once per thread or lost from the cache.
+static const char *const SafeFunctionPasses[] = {
+  "adce", "break-crit-edges", "constprop", "correlated-propagation", "dce",
+  "die", "dse", "early-cse", "gvn", "instcombine", "instsimplify",
+  "jump-threading", "lcssa", "loop-simplify", "lower-expect", "lowerswitch",
+  "mem2reg", "memcpyopt", "mergereturn", "reassociate", "reg2mem",
+  "scalarrepl", "scalarrepl-ssa", "sccp", "simplify-libcalls", "simplifycfg",
+  "sink", "tailcallelim"
+};
+
+/// checkFunctionPasses - Make sure that -j or -function-cache, named by
+/// Option, can run every pass on the command line: the transformations in
+/// SafeFunctionPasses, and analyses of functions or of nothing at all, such as
+/// -basicaa.
+static bool checkFunctionPasses(const char *argv0, const char *Option) {
+  for (unsigned i = 0; i < PassList.size(); ++i) {
+    const PassInfo *PassInf = PassList[i];
+    StringRef Arg = PassInf->getPassArgument();
+    bool Safe = false;
+    if (PassInf->isAnalysis() && PassInf->getNormalCtor()) {
+      OwningPtr<Pass> P(PassInf->getNormalCtor()());
+      Safe = P->getPassKind() == PT_Function || P->getAsImmutablePass();
+    } else {
+      Safe = std::find(SafeFunctionPasses, array_endof(SafeFunctionPasses),
+                       Arg) != array_endof(SafeFunctionPasses);
+    }
+    if (!Safe) {
+      errs() << argv0 << ": " << Option << " can't run the pass '-" << Arg
+             << "'\n";
+      return false;
+    }
+  }
+  return true;
+}
+
 //===----------------------------------------------------------------------===//
 // main for opt
 //
@@ -508,7 +599,17 @@ int main(int argc, char **argv) {
 
   // Load the input module...
   std::auto_ptr<Module> M;
-  M.reset(ParseIRFile(InputFilename, Err, Context));
+  if (LazyBitcode) {
+    // Function bodies are read from the input while the output is written,
+    // so the two must not be the same file.
+    if (InputFilename != "-" && InputFilename == OutputFilename) {
+      errs() << argv[0] << ": -lazy-bitcode can't write to the input file\n";
+      return 1;
+    }
+    M.reset(getLazyIRFileModule(InputFilename, Err, Context));
+  } else {
+    M.reset(ParseIRFile(InputFilename, Err, Context));
+  }
 
   if (M.get() == 0) {
     Err.print(argv[0], errs());
@@ -595,13 +696,49 @@ int main(int argc, char **argv) {
     NoOutput = true;
   }
 
+  // Run the function passes with the cache or on threads now if possible,
+  // which leaves only verification and output to the pass manager.
+  bool RanFunctionPasses = false;
+  std::vector<const PassInfo*> FunctionPasses(PassList.begin(), PassList.end());
+  if (!FunctionCache.empty() &&
+      canRunFunctionPassesAlone(argv[0], "-function-cache")) {
+    if (!checkFunctionPasses(argv[0], "-function-cache"))
+      return 1;
+    // Arguments can't hold a null character, so it separates them.
+    std::string CommandLine;
+    for (int i = 0; i != argc; ++i)
+      CommandLine += std::string(argv[i]) + '\0';
+    std::string ErrorMsg;
+    RanFunctionPasses = runFunctionPassesWithCache(*M, FunctionPasses,
+                          FunctionCache, CommandLine,
+                          TD ? TD->getStringRepresentation() : std::string(),
+                          DisableSimplifyLibCalls, ErrorMsg);
+    if (!RanFunctionPasses)
+      errs() << argv[0] << ": -function-cache ignored: " << ErrorMsg << "\n";
+    else if (Threads > 1)
+      errs() << argv[0] << ": -j ignored: -function-cache runs the passes on "
+                           "one thread\n";
+  }
+  if (!RanFunctionPasses && Threads > 1 &&
+      canRunFunctionPassesAlone(argv[0], "-j")) {
+    if (!checkFunctionPasses(argv[0], "-j"))
+      return 1;
+    std::string ErrorMsg;
+    RanFunctionPasses = runFunctionPassesInParallel(*M, FunctionPasses,
+                          Threads,
+                          TD ? TD->getStringRepresentation() : std::string(),
+                          DisableSimplifyLibCalls, ErrorMsg);
+    if (!RanFunctionPasses && !ErrorMsg.empty())
+      errs() << argv[0] << ": -j ignored: " << ErrorMsg << "\n";
+  }
+
   // If the -strip-debug command line option was specified, add it.  If
   // -std-compile-opts was also specified, it will handle StripDebug.
   if (StripDebug && !StandardCompileOpts)
     addPass(Passes, createStripSymbolsPass(true));
 
   // Create a new optimization pass for each one specified on the command line
-  for (unsigned i = 0; i < PassList.size(); ++i) {
+  for (unsigned i = 0; i < PassList.size() && !RanFunctionPasses; ++i) {
     // Check to see if -std-compile-opts was specified before this option.  If
     // so, handle it.
     if (StandardCompileOpts &&
@@ -30,16 +30,42 @@ int tx()
 
 #include <inttypes.h>
 
+#include <setjmp.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 
-void stm_reserve( int num_args, ...)
+// Tracing stand-ins for the runtime in llvm/runtime/libcantm
+extern "C" {
+
+jmp_buf checkpoint;
+
+void *stm_begin()
+{
+  printf ("Begin\n");
+  return checkpoint;
+}
+
+void *stm_begin_htm(int retries)
+{
+  return stm_begin();
+}
+
+void *stm_begin_snapshot()
+{
+  return stm_begin();
+}
+
+void stm_commit()
+{
+  printf ("Commit\n");
+}
+
+static void print_reservation(va_list vl)
 {
   int i;
   uintptr_t val;
-  va_list vl;
-  va_start(vl,num_args);
   int num_loads = va_arg(vl,int);
   printf ("%d Load(s) passed: ", num_loads);
   for (i=0;i<num_loads;i++)
@@ -54,10 +80,72 @@ void stm_reserve( int num_args, ...)
     val=va_arg(vl,uintptr_t);
     printf ("%016"PRIxPTR" ", val);
   }
+  printf ("\n");
+}
+
+void stm_reserve( int num_args, ...)
+{
+  va_list vl;
+  va_start(vl,num_args);
+  print_reservation(vl);
+  va_end(vl);
+}
+
+void stm_reserve_ranges( int num_args, ...)
+{
+  int i, n;
+  uintptr_t addr, len;
+  va_list vl;
+  va_start(vl,num_args);
+  n = va_arg(vl,int);
+  printf ("%d Range(s) read: ", n);
+  for (i=0;i<n;i++)
+  {
+    addr=va_arg(vl,uintptr_t);
+    len=va_arg(vl,uintptr_t);
+    printf ("%016"PRIxPTR"+%"PRIuPTR" ", addr, len);
+  }
+  n = va_arg(vl,int);
+  printf ("%d Range(s) written: ", n);
+  for (i=0;i<n;i++)
+  {
+    addr=va_arg(vl,uintptr_t);
+    len=va_arg(vl,uintptr_t);
+    printf ("%016"PRIxPTR"+%"PRIuPTR" ", addr, len);
+  }
   va_end(vl);
   printf ("\n");
 }
 
+struct stm_site
+{
+  unsigned num_loads;
+  unsigned num_stores;
+  const uintptr_t *addrs;
+  void *plan;
+};
+
+void stm_reserve_site(stm_site *site)
+{
+  unsigned i;
+  printf ("%u Load(s) passed: ", site->num_loads);
+  for (i=0;i<site->num_loads;i++)
+    printf ("%016"PRIxPTR" ", site->addrs[i]);
+  printf ("%u Store(s) passed: ", site->num_stores);
+  for (i=0;i<site->num_stores;i++)
+    printf ("%016"PRIxPTR" ", site->addrs[site->num_loads + i]);
+  printf ("(table)\n");
+}
+
+void stm_reserve_partial(stm_site *site, int num_args, ...)
+{
+  va_list vl;
+  stm_reserve_site(site);
+  va_start(vl,num_args);
+  print_reservation(vl);
+  va_end(vl);
+}
+
 int stm_load( uintptr_t addr)
 {
   printf ("Loading value stored at: ");
@@ -74,6 +162,48 @@ void stm_store(int val, uintptr_t addr)
     *(int *)addr = val;
 }
 
+#define STM_ACCESSORS(bits) \
+uint##bits##_t stm_load##bits(const void *addr) \
+{ \
+  printf ("Loading %d bits at: %016"PRIxPTR"\n", bits, (uintptr_t)addr); \
+  return *(const uint##bits##_t *)addr; \
+} \
+void stm_store##bits(uint##bits##_t val, void *addr) \
+{ \
+  printf ("Storing %d bits at: %016"PRIxPTR"\n", bits, (uintptr_t)addr); \
+  *(uint##bits##_t *)addr = val; \
+}
+
+STM_ACCESSORS(8)
+STM_ACCESSORS(16)
+STM_ACCESSORS(32)
+STM_ACCESSORS(64)
+
+void *stm_malloc(size_t size)
+{
+  void *ptr = malloc(size);
+  printf ("Allocated %zu bytes at: %016"PRIxPTR"\n", size, (uintptr_t)ptr);
+  return ptr;
+}
+
+void stm_free(void *ptr)
+{
+  printf ("Freeing: %016"PRIxPTR"\n", (uintptr_t)ptr);
+  free(ptr);
+}
+
+void stm_irrevocable()
+{
+  printf ("Irrevocable\n");
+}
+
+void stm_redo_log()
+{
+  printf ("Redo log\n");
+}
+
+}
+
 int a, b, c, d;
 
 int foo(int& b)
@@ -81,6 +211,23 @@ int foo(int& b)
     return b+1;
 }
 
+int* foo4(int& b)
+{
+    int* s = new int();
+    *s = b;
+    return s;
+}
+
+int foo7(int& b)
+{
+    int retVal = 0;
+    int* s = new int();
+    *s = b;
+    retVal = *s;
+    delete s;
+    return retVal;
+}
+
 #if 0
 
 int* foo2(int& b)
@@ -94,13 +241,6 @@ int* foo3(int& b)
     return &s;
 }
 
-int* foo4(int& b)
-{
-    int* s = new int();
-    *s = b;
-    return s;
-}
-
 int foo5(int& b, int* c)
 {
     int s;
@@ -115,16 +255,6 @@ int foo6(int b)
     return b+1;
 }
 
-int foo7(int& b)
-{
-    int retVal = 0;
-    int* s = new int();
-    *s = b;
-    retVal = *s;
-    delete s;
-    return retVal;
-}
-
 int tx()
 {
     int *j;
@@ -173,6 +303,9 @@ int tx()
     } else {
         a = foo(b);
     }
+    int *k = foo4(c);
+    b += foo7(*k);
+    delete k;
     return a + b;
 }
 #endif